@@ -0,0 +1,273 @@
+#include "backlight.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+#include "driver/ledc.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "openweather.h"
+
+#define DUTY_MAX ((1 << BACKLIGHT_LEDC_RESOLUTION) - 1)
+#define DEG_TO_RAD(d) ((d) * M_PI / 180.0)
+
+static const char *TAG = "backlight";
+
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+static SemaphoreHandle_t s_ledc_mutex = NULL;
+
+static uint8_t s_percent = BACKLIGHT_DAY_PERCENT;
+static uint8_t s_schedule_percent = BACKLIGHT_DAY_PERCENT;
+static bool s_enabled = true;
+static int s_sunrise_min = -1;
+static int s_sunset_min = -1;
+
+// Energy accounting, integrated each time the applied duty changes
+static int64_t s_boot_us = 0;
+static int64_t s_last_account_us = 0;
+static double s_duty_seconds = 0;  // sum of duty fraction * seconds
+
+static void account_locked(void)
+{
+    int64_t now = esp_timer_get_time();
+    uint8_t applied = s_enabled ? s_percent : 0;
+    s_duty_seconds += (applied / 100.0) * (now - s_last_account_us) / 1e6;
+    s_last_account_us = now;
+}
+
+// Called with s_ledc_mutex held
+static void apply_duty_locked(uint8_t percent, int fade_ms)
+{
+    uint32_t duty = (uint32_t)percent * DUTY_MAX / 100;
+
+    if (fade_ms > 0) {
+        ledc_set_fade_with_time(BACKLIGHT_LEDC_MODE, BACKLIGHT_LEDC_CHANNEL, duty, fade_ms);
+        ledc_fade_start(BACKLIGHT_LEDC_MODE, BACKLIGHT_LEDC_CHANNEL, LEDC_FADE_NO_WAIT);
+    } else {
+        ledc_set_duty(BACKLIGHT_LEDC_MODE, BACKLIGHT_LEDC_CHANNEL, duty);
+        ledc_update_duty(BACKLIGHT_LEDC_MODE, BACKLIGHT_LEDC_CHANNEL);
+    }
+}
+
+static void apply_duty(uint8_t percent, int fade_ms)
+{
+    xSemaphoreTake(s_ledc_mutex, portMAX_DELAY);
+    apply_duty_locked(percent, fade_ms);
+    xSemaphoreGive(s_ledc_mutex);
+}
+
+esp_err_t backlight_init(int gpio_num)
+{
+    const ledc_timer_config_t timer_conf = {
+        .speed_mode = BACKLIGHT_LEDC_MODE,
+        .duty_resolution = BACKLIGHT_LEDC_RESOLUTION,
+        .timer_num = BACKLIGHT_LEDC_TIMER,
+        .freq_hz = BACKLIGHT_LEDC_FREQ_HZ,
+        .clk_cfg = BACKLIGHT_LEDC_CLK,
+    };
+    esp_err_t ret = ledc_timer_config(&timer_conf);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to configure LEDC timer");
+        return ret;
+    }
+
+    const ledc_channel_config_t channel_conf = {
+        .gpio_num = gpio_num,
+        .speed_mode = BACKLIGHT_LEDC_MODE,
+        .channel = BACKLIGHT_LEDC_CHANNEL,
+        .timer_sel = BACKLIGHT_LEDC_TIMER,
+        .duty = DUTY_MAX * BACKLIGHT_DAY_PERCENT / 100,
+        .hpoint = 0,
+        // PWM and so the backlight stay on through automatic light sleep
+        .sleep_mode = LEDC_SLEEP_MODE_KEEP_ALIVE,
+    };
+    ret = ledc_channel_config(&channel_conf);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to configure LEDC channel");
+        return ret;
+    }
+
+    ret = ledc_fade_func_install(0);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to install LEDC fade");
+        return ret;
+    }
+
+    s_ledc_mutex = xSemaphoreCreateMutex();
+    s_boot_us = esp_timer_get_time();
+    s_last_account_us = s_boot_us;
+
+    ESP_LOGI(TAG, "Backlight on GPIO %d, %d%%", gpio_num, BACKLIGHT_DAY_PERCENT);
+    return ESP_OK;
+}
+
+void backlight_set_percent(uint8_t percent, int fade_ms)
+{
+    if (percent > 100) {
+        percent = 100;
+    }
+
+    taskENTER_CRITICAL(&s_lock);
+    account_locked();
+    s_percent = percent;
+    bool enabled = s_enabled;
+    taskEXIT_CRITICAL(&s_lock);
+
+    if (enabled) {
+        apply_duty(percent, fade_ms);
+    }
+}
+
+// The LEDC mutex is held from the state change to the duty write, so of two
+// concurrent calls the panel ends up the way the later one left the state
+static bool set_enabled(bool toggle, bool enabled)
+{
+    xSemaphoreTake(s_ledc_mutex, portMAX_DELAY);
+    taskENTER_CRITICAL(&s_lock);
+    account_locked();
+    s_enabled = toggle ? !s_enabled : enabled;
+    enabled = s_enabled;
+    uint8_t percent = s_percent;
+    taskEXIT_CRITICAL(&s_lock);
+
+    apply_duty_locked(enabled ? percent : 0, BACKLIGHT_FADE_MS / 4);
+    xSemaphoreGive(s_ledc_mutex);
+    return enabled;
+}
+
+void backlight_set_enabled(bool enabled)
+{
+    set_enabled(false, enabled);
+}
+
+bool backlight_toggle(void)
+{
+    return set_enabled(true, false);
+}
+
+void backlight_get_stats(backlight_stats_t *stats)
+{
+    taskENTER_CRITICAL(&s_lock);
+    account_locked();
+    double elapsed_s = (s_last_account_us - s_boot_us) / 1e6;
+    stats->duty_percent = s_percent;
+    stats->schedule_percent = s_schedule_percent;
+    stats->enabled = s_enabled;
+    stats->avg_duty_percent = elapsed_s > 0 ? (float)(100.0 * s_duty_seconds / elapsed_s) : 0;
+    stats->energy_mwh = (float)(s_duty_seconds * BACKLIGHT_FULL_POWER_MW / 3600.0);
+    stats->uptime_s = (uint64_t)elapsed_s;
+    stats->sunrise_min = s_sunrise_min;
+    stats->sunset_min = s_sunset_min;
+    taskEXIT_CRITICAL(&s_lock);
+}
+
+void backlight_log_stats(void)
+{
+    backlight_stats_t stats;
+    backlight_get_stats(&stats);
+
+    ESP_LOGI(TAG, "Duty %d%% (schedule %d%%, %s), avg %.1f%%, %.2f mWh in %llu s",
+             stats.duty_percent, stats.schedule_percent, stats.enabled ? "on" : "off",
+             stats.avg_duty_percent, stats.energy_mwh, stats.uptime_s);
+    if (stats.sunrise_min >= 0) {
+        ESP_LOGI(TAG, "Sunrise %02d:%02d, sunset %02d:%02d",
+                 stats.sunrise_min / 60, stats.sunrise_min % 60,
+                 stats.sunset_min / 60, stats.sunset_min % 60);
+    }
+}
+
+// NOAA approximation, returns false during polar day/night
+static bool sun_times_utc(int day_of_year, double *sunrise_min, double *sunset_min)
+{
+    double g = 2.0 * M_PI / 365.0 * (day_of_year - 1);
+    double eqtime = 229.18 * (0.000075 + 0.001868 * cos(g) - 0.032077 * sin(g) -
+                              0.014615 * cos(2 * g) - 0.040849 * sin(2 * g));
+    double decl = 0.006918 - 0.399912 * cos(g) + 0.070257 * sin(g) - 0.006758 * cos(2 * g) +
+                  0.000907 * sin(2 * g) - 0.002697 * cos(3 * g) + 0.00148 * sin(3 * g);
+    double lat = DEG_TO_RAD(BACKLIGHT_LATITUDE);
+
+    double cos_ha = cos(DEG_TO_RAD(90.833)) / (cos(lat) * cos(decl)) - tan(lat) * tan(decl);
+    if (cos_ha < -1.0 || cos_ha > 1.0) {
+        return false;
+    }
+    double ha = acos(cos_ha) * 180.0 / M_PI;
+
+    *sunrise_min = 720 - 4 * (BACKLIGHT_LONGITUDE + ha) - eqtime;
+    *sunset_min = 720 - 4 * (BACKLIGHT_LONGITUDE - ha) - eqtime;
+    return true;
+}
+
+static int wrap_minutes(int minutes)
+{
+    minutes %= 1440;
+    return minutes < 0 ? minutes + 1440 : minutes;
+}
+
+// Linear ramp from night to day level across [center - T, center + T]
+static int ramp(int minute, int center, bool rising)
+{
+    int d = wrap_minutes(minute - center + 720) - 720;  // signed distance, -720..719
+    int t = d + BACKLIGHT_TWILIGHT_MIN;
+    int span = 2 * BACKLIGHT_TWILIGHT_MIN;
+    if (!rising) {
+        t = span - t;
+    }
+    return BACKLIGHT_NIGHT_PERCENT + (BACKLIGHT_DAY_PERCENT - BACKLIGHT_NIGHT_PERCENT) * t / span;
+}
+
+static uint8_t schedule_percent(int minute, int sunrise, int sunset)
+{
+    int from_sunrise = wrap_minutes(minute - sunrise);
+    int day_length = wrap_minutes(sunset - sunrise);
+
+    if (abs(wrap_minutes(minute - sunrise + 720) - 720) <= BACKLIGHT_TWILIGHT_MIN) {
+        return ramp(minute, sunrise, true);
+    }
+    if (abs(wrap_minutes(minute - sunset + 720) - 720) <= BACKLIGHT_TWILIGHT_MIN) {
+        return ramp(minute, sunset, false);
+    }
+    return from_sunrise < day_length ? BACKLIGHT_DAY_PERCENT : BACKLIGHT_NIGHT_PERCENT;
+}
+
+void backlight_schedule_task(void *pvParameters)
+{
+    int log_counter = 0;
+
+    while (1) {
+        time_data_t now = {0};
+        if (xSemaphoreTake(time_mutex, pdMS_TO_TICKS(100)) == pdTRUE) {
+            now = g_time_data;
+            xSemaphoreGive(time_mutex);
+        }
+
+        double sunrise_utc, sunset_utc;
+        if (now.synced && sun_times_utc(now.timeinfo.tm_yday + 1, &sunrise_utc, &sunset_utc)) {
+            // Offset between local time and UTC, from the same instant
+            int local_min = now.timeinfo.tm_hour * 60 + now.timeinfo.tm_min;
+            int utc_min = (int)((now.current_time % 86400) / 60);
+            int offset = wrap_minutes(local_min - utc_min + 720) - 720;
+
+            int sunrise = wrap_minutes((int)sunrise_utc + offset);
+            int sunset = wrap_minutes((int)sunset_utc + offset);
+            uint8_t target = schedule_percent(local_min, sunrise, sunset);
+
+            taskENTER_CRITICAL(&s_lock);
+            s_sunrise_min = sunrise;
+            s_sunset_min = sunset;
+            s_schedule_percent = target;
+            bool changed = (target != s_percent);
+            taskEXIT_CRITICAL(&s_lock);
+
+            if (changed) {
+                ESP_LOGI(TAG, "Schedule brightness %d%%", target);
+                backlight_set_percent(target, BACKLIGHT_FADE_MS);
+            }
+        }
+
+        if (++log_counter >= 3600 / BACKLIGHT_SCHEDULE_PERIOD_S) {
+            log_counter = 0;
+            backlight_log_stats();
+        }
+        vTaskDelay(pdMS_TO_TICKS(BACKLIGHT_SCHEDULE_PERIOD_S * 1000));
+    }
+}
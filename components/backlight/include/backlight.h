@@ -0,0 +1,46 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+// LEDC config
+#define BACKLIGHT_LEDC_TIMER      LEDC_TIMER_0
+#define BACKLIGHT_LEDC_CHANNEL    LEDC_CHANNEL_0
+#define BACKLIGHT_LEDC_MODE       LEDC_LOW_SPEED_MODE
+#define BACKLIGHT_LEDC_FREQ_HZ    5000
+#define BACKLIGHT_LEDC_RESOLUTION LEDC_TIMER_10_BIT
+// RC_FAST keeps running in light sleep, the APB clock does not
+#define BACKLIGHT_LEDC_CLK        LEDC_USE_RC_FAST_CLK
+
+// Brightness levels in percent
+#define BACKLIGHT_DAY_PERCENT     100
+#define BACKLIGHT_NIGHT_PERCENT   15
+#define BACKLIGHT_FADE_MS         1500
+
+// Schedule: location used for sunrise/sunset (Tokyo)
+#define BACKLIGHT_LATITUDE        35.68
+#define BACKLIGHT_LONGITUDE       139.69
+#define BACKLIGHT_TWILIGHT_MIN    30    // ramp length on each side of sunrise/sunset
+#define BACKLIGHT_SCHEDULE_PERIOD_S 60
+
+// Backlight power at 100% duty, used for the energy estimate
+#define BACKLIGHT_FULL_POWER_MW   120
+
+typedef struct {
+    uint8_t duty_percent;       // current target duty
+    uint8_t schedule_percent;   // what the schedule asks for
+    bool enabled;               // false when switched off by the user
+    float avg_duty_percent;     // time-weighted average since boot
+    float energy_mwh;           // estimated energy since boot
+    uint64_t uptime_s;
+    int sunrise_min;            // local minutes after midnight, -1 if unknown
+    int sunset_min;
+} backlight_stats_t;
+
+esp_err_t backlight_init(int gpio_num);
+void backlight_set_percent(uint8_t percent, int fade_ms);
+void backlight_set_enabled(bool enabled);
+bool backlight_toggle(void);
+void backlight_get_stats(backlight_stats_t *stats);
+void backlight_log_stats(void);
+void backlight_schedule_task(void *pvParameters);
@@ -0,0 +1,238 @@
+#include "boot.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "diagnostics.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/event_groups.h"
+#include "freertos/task.h"
+
+typedef struct {
+    boot_stage_state_t state;
+    int64_t start_us;
+    int64_t end_us;
+    esp_err_t err;
+} stage_run_t;
+
+typedef struct {
+    const char *name;
+    int64_t at_us;
+} boot_mark_t;
+
+static const char *TAG = "boot";
+
+static const char *s_state_names[] = {
+    [BOOT_STAGE_PENDING] = "pending",
+    [BOOT_STAGE_RUNNING] = "running",
+    [BOOT_STAGE_DONE] = "done",
+    [BOOT_STAGE_FAILED] = "failed",
+    [BOOT_STAGE_SKIPPED] = "skipped",
+};
+
+static const boot_stage_t *s_stages = NULL;
+static stage_run_t s_runs[BOOT_MAX_STAGES];
+static int s_count = 0;
+static EventGroupHandle_t s_done = NULL;    // bit n: stage n finished
+static uint32_t s_launched = 0;
+static uint32_t s_finished = 0;
+static uint32_t s_failed = 0;
+static boot_mark_t s_marks[BOOT_MAX_MARKS];
+static int s_mark_count = 0;
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static void stage_task(void *arg);
+static void finish_stage(int id);
+
+// Starts every stage whose dependencies just finished. Tasks are only
+// created when ready, so waiting stages cost no stack.
+static void launch_ready(void)
+{
+    for (int i = 0; i < s_count; i++) {
+        portENTER_CRITICAL(&s_lock);
+        bool ready = !(s_launched & BOOT_DEP(i)) &&
+                     (s_finished & s_stages[i].deps) == s_stages[i].deps;
+        if (ready) {
+            s_launched |= BOOT_DEP(i);
+        }
+        portEXIT_CRITICAL(&s_lock);
+        if (!ready) {
+            continue;
+        }
+
+        uint32_t stack = s_stages[i].stack ? s_stages[i].stack : BOOT_STAGE_STACK;
+        if (xTaskCreatePinnedToCore(stage_task, s_stages[i].name, stack, (void *)(intptr_t)i,
+                                    BOOT_STAGE_PRIORITY, NULL, s_stages[i].core) != pdPASS) {
+            // Failed like any other stage, so its dependents and waiters go on
+            s_runs[i].start_us = esp_timer_get_time();
+            s_runs[i].state = BOOT_STAGE_FAILED;
+            s_runs[i].err = ESP_ERR_NO_MEM;
+            finish_stage(i);
+        }
+    }
+}
+
+// Records the outcome of a stage and starts the stages waiting for it
+static void finish_stage(int id)
+{
+    const boot_stage_t *stage = &s_stages[id];
+    stage_run_t *run = &s_runs[id];
+
+    run->end_us = esp_timer_get_time();
+
+    portENTER_CRITICAL(&s_lock);
+    s_finished |= BOOT_DEP(id);
+    s_failed |= run->state != BOOT_STAGE_DONE ? BOOT_DEP(id) : 0;
+    bool all = s_finished == BOOT_DEP(s_count) - 1;
+    portEXIT_CRITICAL(&s_lock);
+
+    if (run->state != BOOT_STAGE_DONE) {
+        ESP_LOGE(TAG, "Stage '%s' %s: %s", stage->name, s_state_names[run->state],
+                 esp_err_to_name(run->err));
+    } else {
+        ESP_LOGI(TAG, "Stage '%s' done at %lld ms (%lld ms)", stage->name, run->end_us / 1000,
+                 (run->end_us - run->start_us) / 1000);
+    }
+
+    launch_ready();
+    xEventGroupSetBits(s_done, BOOT_DEP(id));
+    if (all) {
+        boot_log_timeline();
+    }
+}
+
+static void stage_task(void *arg)
+{
+    int id = (intptr_t)arg;
+    const boot_stage_t *stage = &s_stages[id];
+    stage_run_t *run = &s_runs[id];
+
+    run->start_us = esp_timer_get_time();
+    if (s_failed & stage->deps) {
+        run->state = BOOT_STAGE_SKIPPED;
+        run->err = ESP_ERR_INVALID_STATE;
+    } else {
+        run->state = BOOT_STAGE_RUNNING;
+        run->err = stage->run();
+        run->state = run->err == ESP_OK ? BOOT_STAGE_DONE : BOOT_STAGE_FAILED;
+    }
+
+    finish_stage(id);
+    vTaskDelete(NULL);
+}
+
+bool boot_wait(uint32_t mask, TickType_t timeout)
+{
+    EventBits_t bits = xEventGroupWaitBits(s_done, mask, pdFALSE, pdTRUE, timeout);
+    return (bits & mask) == mask;
+}
+
+boot_stage_state_t boot_stage_state(int stage)
+{
+    return stage >= 0 && stage < s_count ? s_runs[stage].state : BOOT_STAGE_PENDING;
+}
+
+void boot_mark(const char *name)
+{
+    int64_t now = esp_timer_get_time();
+
+    portENTER_CRITICAL(&s_lock);
+    for (int i = 0; i < s_mark_count; i++) {
+        if (strcmp(s_marks[i].name, name) == 0) {
+            portEXIT_CRITICAL(&s_lock);
+            return;
+        }
+    }
+    bool added = s_mark_count < BOOT_MAX_MARKS;
+    if (added) {
+        s_marks[s_mark_count++] = (boot_mark_t){.name = name, .at_us = now};
+    }
+    portEXIT_CRITICAL(&s_lock);
+
+    if (added) {
+        ESP_LOGI(TAG, "Mark '%s' at %lld ms", name, now / 1000);
+    }
+}
+
+static void print_timeline(void)
+{
+    for (int i = 0; i < s_count; i++) {
+        const stage_run_t *run = &s_runs[i];
+        if (run->state == BOOT_STAGE_PENDING || run->state == BOOT_STAGE_RUNNING) {
+            printf("  %-10s %s\n", s_stages[i].name, s_state_names[run->state]);
+            continue;
+        }
+        printf("  %-10s %6lld -> %6lld ms (%5lld ms) %s\n", s_stages[i].name,
+               run->start_us / 1000, run->end_us / 1000, (run->end_us - run->start_us) / 1000,
+               s_state_names[run->state]);
+    }
+    for (int i = 0; i < s_mark_count; i++) {
+        printf("  %-10s %6lld ms\n", s_marks[i].name, s_marks[i].at_us / 1000);
+    }
+}
+
+void boot_log_timeline(void)
+{
+    for (int i = 0; i < s_count; i++) {
+        const stage_run_t *run = &s_runs[i];
+        ESP_LOGI(TAG, "%-10s %6lld -> %6lld ms %s", s_stages[i].name, run->start_us / 1000,
+                 run->end_us / 1000, s_state_names[run->state]);
+    }
+    for (int i = 0; i < s_mark_count; i++) {
+        ESP_LOGI(TAG, "%-10s %6lld ms", s_marks[i].name, s_marks[i].at_us / 1000);
+    }
+}
+
+static int boot_cmd(int argc, char **argv)
+{
+    print_timeline();
+    return 0;
+}
+
+static void boot_metrics(diag_writer_t *w)
+{
+    for (int i = 0; i < s_count; i++) {
+        const stage_run_t *run = &s_runs[i];
+        if (run->end_us == 0) {
+            continue;
+        }
+        diag_printf(w, "boot_stage_start_ms{stage=\"%s\"} %lld\n", s_stages[i].name,
+                    run->start_us / 1000);
+        diag_printf(w, "boot_stage_ms{stage=\"%s\"} %lld\n", s_stages[i].name,
+                    (run->end_us - run->start_us) / 1000);
+        diag_printf(w, "boot_stage_ok{stage=\"%s\"} %d\n", s_stages[i].name,
+                    run->state == BOOT_STAGE_DONE);
+    }
+    for (int i = 0; i < s_mark_count; i++) {
+        diag_printf(w, "boot_mark_ms{mark=\"%s\"} %lld\n", s_marks[i].name,
+                    s_marks[i].at_us / 1000);
+    }
+}
+
+esp_err_t boot_start(const boot_stage_t *stages, int count)
+{
+    if (count > BOOT_MAX_STAGES || s_stages != NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    // Dependencies only point backwards, so the graph cannot have a cycle
+    for (int i = 0; i < count; i++) {
+        if (stages[i].deps & ~(BOOT_DEP(i) - 1)) {
+            ESP_LOGE(TAG, "Stage '%s' depends on a later stage", stages[i].name);
+            return ESP_ERR_INVALID_ARG;
+        }
+    }
+
+    s_done = xEventGroupCreate();
+    if (s_done == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    s_stages = stages;
+    s_count = count;
+
+    diagnostics_register_command("boot", "Boot stage timeline", boot_cmd);
+    diagnostics_register_metrics("boot", boot_metrics);
+
+    launch_ready();
+    return ESP_OK;
+}
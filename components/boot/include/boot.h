@@ -0,0 +1,43 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+
+// Boot orchestrator: init stages declare the stages they depend on and
+// each runs in its own short-lived task as soon as those are done, so
+// independent stages overlap. A stage whose dependency failed is skipped.
+// Every stage and milestone lands on a timeline shown by the "boot" command
+// and the boot_* metrics.
+
+#define BOOT_MAX_STAGES     16
+#define BOOT_MAX_MARKS      8
+#define BOOT_STAGE_STACK    3072
+#define BOOT_STAGE_PRIORITY 5
+
+#define BOOT_DEP(stage) (1UL << (stage))
+
+typedef struct {
+    const char *name;
+    esp_err_t (*run)(void);
+    uint32_t deps;          // BOOT_DEP() of the stages that must finish first
+    uint32_t stack;         // 0 for BOOT_STAGE_STACK
+    int core;               // tskNO_AFFINITY or a core id
+} boot_stage_t;
+
+typedef enum {
+    BOOT_STAGE_PENDING,
+    BOOT_STAGE_RUNNING,
+    BOOT_STAGE_DONE,
+    BOOT_STAGE_FAILED,
+    BOOT_STAGE_SKIPPED,     // a dependency failed
+} boot_stage_state_t;
+
+// Stages are indexed by their position, the table must outlive the boot
+esp_err_t boot_start(const boot_stage_t *stages, int count);
+// True once every stage in mask finished, failed stages count as finished
+bool boot_wait(uint32_t mask, TickType_t timeout);
+boot_stage_state_t boot_stage_state(int stage);
+// Records a named point on the timeline, the first call per name counts
+void boot_mark(const char *name);
+void boot_log_timeline(void);
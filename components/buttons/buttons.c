@@ -1,105 +1,317 @@
-#include <stdio.h>
+/* Interrupt-driven buttons.
+ *
+ * An edge on a button pin disables that pin's interrupt, stamps the time
+ * and (re)starts a one-shot debounce timer. When the timer fires the
+ * interrupt is enabled again and the pin is sampled once; a level that
+ * differs from the last stable one becomes a button_event_t on the queue.
+ * The "edge" is a level interrupt armed for the opposite of the stable
+ * level: unlike an edge interrupt it also wakes the chip from light sleep.
+ * input_task blocks on the queue, feeds the gesture recognizer and runs the
+ * action mapped to each gesture, so nothing wakes up while no button is
+ * touched.
+ */
 #include "buttons.h"
+
+#include <stdio.h>
+
+#include "backlight.h"
+#include "diagnostics.h"
 #include "driver/gpio.h"
 #include "esp_log.h"
-#include "esp_err.h"
+#include "esp_sleep.h"
+#include "esp_timer.h"
 #include "freertos/FreeRTOS.h"
-#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/timers.h"
+#include "gestures.h"
+#include "get_weather.h"
+#include "screen_manager.h"
 #include "st7789.h"
 
-// GPIO config
-#define ON_OFF_BUTTON GPIO_NUM_32
-#define NEXT_SCREEN_BUTTON GPIO_NUM_33
-#define DEBOUNCE_TIME_MS 50
-
-static int current_screen = 0;  // 0 = sensor screen, 1 = temp graph screen
+typedef struct {
+    gpio_num_t gpio;
+    uint8_t id;
+    bool pressed;               // last stable level
+    int64_t edge_us;
+    TimerHandle_t timer;
+} button_t;
 
 static const char *TAG = "buttons";
 
-void on_off_button_task(void *arg)
+static button_t s_buttons[BUTTON_COUNT] = {
+    [BUTTON_ON_OFF] = {.gpio = BUTTON_ON_OFF_GPIO, .id = BUTTON_ON_OFF},
+    [BUTTON_NEXT_SCREEN] = {.gpio = BUTTON_NEXT_SCREEN_GPIO, .id = BUTTON_NEXT_SCREEN},
+};
+
+static QueueHandle_t s_queue = NULL;
+static buttons_stats_t s_stats;
+static portMUX_TYPE s_stats_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static void arm_wakeup(button_t *b)
+{
+    gpio_wakeup_enable(b->gpio, b->pressed ? GPIO_INTR_HIGH_LEVEL : GPIO_INTR_LOW_LEVEL);
+    gpio_intr_enable(b->gpio);
+}
+
+static void button_isr(void *arg)
 {
-   // Configure GPIO as input
-    gpio_config_t io_conf = {
-        .pin_bit_mask = (1ULL << ON_OFF_BUTTON),
-        .mode = GPIO_MODE_INPUT,
-        .pull_up_en = GPIO_PULLUP_ENABLE,  // Enable internal pull-up
-        .pull_down_en = GPIO_PULLDOWN_DISABLE,
-        .intr_type = GPIO_INTR_DISABLE
+    button_t *b = arg;
+    BaseType_t woken = pdFALSE;
+
+    // Ignore the rest of the bounce burst until the timer samples the pin
+    gpio_intr_disable(b->gpio);
+    b->edge_us = esp_timer_get_time();
+    if (xTimerResetFromISR(b->timer, &woken) != pdPASS) {
+        // Timer queue full, nothing would re-enable the pin: the armed
+        // level fires again and retries
+        gpio_intr_enable(b->gpio);
+    }
+    portYIELD_FROM_ISR(woken);
+}
+
+// Runs in the timer service task
+static void debounce_cb(TimerHandle_t timer)
+{
+    button_t *b = pvTimerGetTimerID(timer);
+
+    bool pressed = gpio_get_level(b->gpio) == 0;
+    if (pressed == b->pressed) {
+        gpio_intr_enable(b->gpio);
+        return;
+    }
+    b->pressed = pressed;
+    // Armed for the release while pressed and the other way round. Should
+    // the pin have flipped back already, the interrupt fires right away.
+    arm_wakeup(b);
+
+    button_event_t event = {
+        .button = b->id,
+        .type = BUTTON_EVENT_EDGE,
+        .pressed = pressed,
+        .edge_us = b->edge_us,
     };
-    gpio_config(&io_conf);
+    bool sent = xQueueSend(s_queue, &event, 0) == pdTRUE;
 
-    bool last_state = true;
-    bool current_state;
-    bool screen_state = true;
-    
-    ESP_LOGI(TAG, "Button monitoring started on GPIO %d", ON_OFF_BUTTON);
+    portENTER_CRITICAL(&s_stats_lock);
+    s_stats.events++;
+    s_stats.dropped += !sent;
+    portEXIT_CRITICAL(&s_stats_lock);
+}
 
-    while (1) {
-        current_state = gpio_get_level(ON_OFF_BUTTON);
-        
-        if (last_state && !current_state) {
-            vTaskDelay(pdMS_TO_TICKS(DEBOUNCE_TIME_MS));
-            current_state = gpio_get_level(ON_OFF_BUTTON);
-            
-            if (!current_state) {
-                ESP_LOGI(TAG, "Power button PRESSED");
-                
-                screen_state = !screen_state;
-                
-                gpio_set_level(PIN_NUM_BK_LIGHT, screen_state ? 1 : 0);
-                ESP_LOGI(TAG, "Backlight %s", screen_state ? "ON" : "OFF");
-            }
+static bool action_backlight(int64_t edge_us)
+{
+    bool screen_state = backlight_toggle();
+    ESP_LOGI(TAG, "Backlight %s", screen_state ? "ON" : "OFF");
+    return true;
+}
+
+static bool action_next_screen(int64_t edge_us)
+{
+    // Streamed from the pre-render cache when it holds the next screen,
+    // otherwise built and rendered by the screen manager
+    if (lcd_prerender_show_next(edge_us)) {
+        ESP_LOGD(TAG, "Switched from the pre-render cache");
+        return true;
+    }
+    if (screen_manager_show_next() != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to switch screen");
+        return false;
+    }
+    lcd_latency_track(edge_us);
+    return true;
+}
+
+static bool show_screen(int id, int64_t edge_us)
+{
+    if (screen_manager_show(id) != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to show screen %d", id);
+        return false;
+    }
+    lcd_latency_track(edge_us);
+    return true;
+}
+
+// First brings up the chart, then steps through its windows
+static bool action_history_zoom(int64_t edge_us)
+{
+    if (screen_manager_current() != SCREEN_HISTORY) {
+        return show_screen(SCREEN_HISTORY, edge_us);
+    }
+    history_screen_next_window();
+    return true;
+}
+
+static bool action_weather_refresh(int64_t edge_us)
+{
+    ESP_LOGI(TAG, "Weather refresh requested");
+    weather_refresh();
+    return true;
+}
+
+static bool action_diag_screen(int64_t edge_us)
+{
+    if (screen_manager_current() == SCREEN_DIAG) {
+        return action_next_screen(edge_us);
+    }
+    return show_screen(SCREEN_DIAG, edge_us);
+}
+
+typedef struct {
+    uint8_t button;     // ignored for GESTURE_CHORD
+    uint8_t gesture;
+    bool (*run)(int64_t edge_us);
+} button_action_t;
+
+/* Screen switching stays on a short press of its own button with no
+ * double-click action, so it fires on release without waiting for a second
+ * click. The backlight toggle waits BUTTON_DOUBLE_CLICK_MS instead. */
+static const button_action_t s_actions[] = {
+    {BUTTON_ON_OFF, GESTURE_SHORT, action_backlight},
+    {BUTTON_ON_OFF, GESTURE_DOUBLE, action_weather_refresh},
+    {BUTTON_NEXT_SCREEN, GESTURE_SHORT, action_next_screen},
+    {BUTTON_NEXT_SCREEN, GESTURE_LONG, action_history_zoom},
+    {BUTTON_NEXT_SCREEN, GESTURE_REPEAT, action_history_zoom},
+    {BUTTON_COUNT, GESTURE_CHORD, action_diag_screen},
+};
+
+static void on_gesture(int button, gesture_t gesture, int64_t edge_us)
+{
+    const button_action_t *action = NULL;
+    for (int i = 0; i < sizeof(s_actions) / sizeof(s_actions[0]); i++) {
+        if (s_actions[i].gesture == gesture &&
+            (gesture == GESTURE_CHORD || s_actions[i].button == button)) {
+            action = &s_actions[i];
+            break;
         }
-        
-        last_state = current_state;
-        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+
+    portENTER_CRITICAL(&s_stats_lock);
+    s_stats.gestures[gesture]++;
+    portEXIT_CRITICAL(&s_stats_lock);
+
+    ESP_LOGI(TAG, "Button %d: %s", button, gesture_name(gesture));
+    if (action == NULL || !action->run(edge_us)) {
+        return;
+    }
+
+    uint32_t latency = esp_timer_get_time() - edge_us;
+    ESP_LOGI(TAG, "Button %d: %lu us from edge to action", button, (unsigned long)latency);
+
+    portENTER_CRITICAL(&s_stats_lock);
+    s_stats.actions++;
+    s_stats.latency_us += latency;
+    s_stats.latency_max_us = latency > s_stats.latency_max_us ? latency
+                                                              : s_stats.latency_max_us;
+    portEXIT_CRITICAL(&s_stats_lock);
+}
+
+void input_task(void *arg)
+{
+    button_event_t event;
+
+    while (1) {
+        xQueueReceive(s_queue, &event, portMAX_DELAY);
+        gestures_feed(&event, on_gesture);
     }
 }
 
-void next_screen_button_task(void *arg)
+const char *gesture_name(gesture_t gesture)
 {
-    gpio_config_t io_conf = {
-        .pin_bit_mask = (1ULL << NEXT_SCREEN_BUTTON),
-        .mode = GPIO_MODE_INPUT,
-        .pull_up_en = GPIO_PULLUP_ENABLE,
-        .pull_down_en = GPIO_PULLDOWN_DISABLE,
-        .intr_type = GPIO_INTR_DISABLE
+    static const char *names[] = {
+        [GESTURE_SHORT] = "short",
+        [GESTURE_LONG] = "long",
+        [GESTURE_DOUBLE] = "double",
+        [GESTURE_REPEAT] = "repeat",
+        [GESTURE_CHORD] = "chord",
     };
-    gpio_config(&io_conf);
+    return gesture < GESTURE_COUNT ? names[gesture] : "?";
+}
+
+void buttons_get_stats(buttons_stats_t *stats)
+{
+    portENTER_CRITICAL(&s_stats_lock);
+    *stats = s_stats;
+    portEXIT_CRITICAL(&s_stats_lock);
+}
 
-    bool last_state = true;
-    bool current_state;
+static int input_cmd(int argc, char **argv)
+{
+    buttons_stats_t s;
+    buttons_get_stats(&s);
+    printf("events %lu (dropped %lu), actions %lu, latency avg %lld max %lu us\n",
+           (unsigned long)s.events, (unsigned long)s.dropped, (unsigned long)s.actions,
+           s.actions ? s.latency_us / s.actions : 0, (unsigned long)s.latency_max_us);
+    for (int i = 0; i < GESTURE_COUNT; i++) {
+        printf("  %-7s %lu\n", gesture_name(i), (unsigned long)s.gestures[i]);
+    }
+    return 0;
+}
 
-    ESP_LOGI(TAG, "Button monitoring started on GPIO %d", NEXT_SCREEN_BUTTON);
+static void input_metrics(diag_writer_t *w)
+{
+    buttons_stats_t s;
+    buttons_get_stats(&s);
+    diag_printf(w, "input_events_total %lu\n", (unsigned long)s.events);
+    diag_printf(w, "input_dropped_total %lu\n", (unsigned long)s.dropped);
+    for (int i = 0; i < GESTURE_COUNT; i++) {
+        diag_printf(w, "input_gestures_total{gesture=\"%s\"} %lu\n", gesture_name(i),
+                    (unsigned long)s.gestures[i]);
+    }
+    diag_printf(w, "input_actions_total %lu\n", (unsigned long)s.actions);
+    diag_printf(w, "input_latency_us_total %lld\n", s.latency_us);
+    diag_printf(w, "input_latency_max_us %lu\n", (unsigned long)s.latency_max_us);
+}
 
-    while (1) {
-        current_state = gpio_get_level(NEXT_SCREEN_BUTTON);
-
-        if (last_state && !current_state) {
-            vTaskDelay(pdMS_TO_TICKS(DEBOUNCE_TIME_MS));
-            current_state = gpio_get_level(NEXT_SCREEN_BUTTON);
-
-            if (!current_state) {
-                ESP_LOGI(TAG, "Next Button PRESSED");
-
-                // Toggle between screens
-                current_screen = (current_screen + 1) % 2;  // Toggle between 0 and 1
-
-                // Switch screen (must be done in LVGL lock)
-                if (lvgl_port_lock(0)) {
-                    if (current_screen == 0) {
-                        lv_screen_load(screen_sensor);
-                        ESP_LOGI(TAG, "Switched to Sensor screen");
-                    } else {
-                        lv_screen_load(screen_weather);
-                        ESP_LOGI(TAG, "Switched to Temp screen");
-                    }
-                    lvgl_port_unlock();
-                }
-            }
+esp_err_t buttons_init(void)
+{
+    s_queue = xQueueCreate(BUTTON_QUEUE_LEN, sizeof(button_event_t));
+    if (s_queue == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    esp_err_t err = gpio_install_isr_service(0);
+    if (err != ESP_OK && err != ESP_ERR_INVALID_STATE) {
+        return err;     // INVALID_STATE: already installed by someone else
+    }
+
+    for (int i = 0; i < BUTTON_COUNT; i++) {
+        button_t *b = &s_buttons[i];
+        b->timer = xTimerCreate("debounce", pdMS_TO_TICKS(BUTTON_DEBOUNCE_MS), pdFALSE, b,
+                                debounce_cb);
+        if (b->timer == NULL) {
+            return ESP_ERR_NO_MEM;
         }
 
-        last_state = current_state;
-        vTaskDelay(pdMS_TO_TICKS(10));
+        gpio_config_t io_conf = {
+            .pin_bit_mask = (1ULL << b->gpio),
+            .mode = GPIO_MODE_INPUT,
+            .pull_up_en = GPIO_PULLUP_ENABLE,  // Enable internal pull-up
+            .pull_down_en = GPIO_PULLDOWN_DISABLE,
+            .intr_type = GPIO_INTR_DISABLE     // armed below
+        };
+        ESP_ERROR_CHECK(gpio_config(&io_conf));
+        b->pressed = gpio_get_level(b->gpio) == 0;
+        ESP_ERROR_CHECK(gpio_isr_handler_add(b->gpio, button_isr, b));
+        arm_wakeup(b);
+
+        ESP_LOGI(TAG, "Button %d on GPIO %d", i, b->gpio);
+    }
+
+    // Light sleep wakes on whichever button pin reaches its armed level
+    ESP_ERROR_CHECK(esp_sleep_enable_gpio_wakeup());
+
+    bool wants_double[BUTTON_COUNT] = {0};
+    for (int i = 0; i < sizeof(s_actions) / sizeof(s_actions[0]); i++) {
+        if (s_actions[i].gesture == GESTURE_DOUBLE) {
+            wants_double[s_actions[i].button] = true;
+        }
     }
+    err = gestures_init(s_queue, wants_double);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    diagnostics_register_command("input", "Button event, gesture and latency stats", input_cmd);
+    diagnostics_register_metrics("input", input_metrics);
+    return ESP_OK;
 }
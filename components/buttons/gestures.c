@@ -0,0 +1,201 @@
+/* Button gesture recognizer.
+ *
+ * Each button runs the transition table below on three inputs: press,
+ * release and timeout. A transition may report a gesture and arms, stops
+ * or keeps the button's one-shot timer. The timers post their expiry into
+ * the input queue, so the machine only ever runs in input_task and there is
+ * no timer activity while both buttons are idle.
+ *
+ * A press while the other button is down and has not reached a long press
+ * yet makes a chord; both buttons then ignore everything until released.
+ */
+#include "gestures.h"
+
+#include <stdint.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/timers.h"
+
+typedef enum {
+    G_IDLE,
+    G_DOWN,     // pressed, long press timer running
+    G_UP,       // released once, waiting for a second click
+    G_DOWN2,    // second click pressed
+    G_HELD,     // long press reported, repeating
+    G_CHORD,    // part of a chord, waiting for release
+    G_STATE_COUNT,
+} gesture_state_t;
+
+typedef enum {
+    IN_PRESS,
+    IN_RELEASE,
+    IN_RELEASE_SINGLE,  // release on a button without a double-click action
+    IN_TIMEOUT,
+    IN_COUNT,
+} gesture_input_t;
+
+typedef enum {
+    T_KEEP,
+    T_STOP,
+    T_LONG,
+    T_DOUBLE,
+    T_REPEAT,
+} timer_op_t;
+
+#define NO_GESTURE GESTURE_COUNT
+
+typedef struct {
+    uint8_t next;       // gesture_state_t
+    uint8_t gesture;    // gesture_t, NO_GESTURE for none
+    uint8_t timer;      // timer_op_t
+} transition_t;
+
+#define GO(_next, _gesture, _timer) {(_next), (_gesture), (_timer)}
+#define STAY(_state) GO(_state, NO_GESTURE, T_KEEP)
+
+static const transition_t s_table[G_STATE_COUNT][IN_COUNT] = {
+    [G_IDLE] = {
+        [IN_PRESS]          = GO(G_DOWN, NO_GESTURE, T_LONG),
+        [IN_RELEASE]        = STAY(G_IDLE),
+        [IN_RELEASE_SINGLE] = STAY(G_IDLE),
+        [IN_TIMEOUT]        = STAY(G_IDLE),
+    },
+    [G_DOWN] = {
+        [IN_PRESS]          = STAY(G_DOWN),
+        [IN_RELEASE]        = GO(G_UP, NO_GESTURE, T_DOUBLE),
+        [IN_RELEASE_SINGLE] = GO(G_IDLE, GESTURE_SHORT, T_STOP),
+        [IN_TIMEOUT]        = GO(G_HELD, GESTURE_LONG, T_REPEAT),
+    },
+    [G_UP] = {
+        [IN_PRESS]          = GO(G_DOWN2, NO_GESTURE, T_STOP),
+        [IN_RELEASE]        = STAY(G_UP),
+        [IN_RELEASE_SINGLE] = STAY(G_UP),
+        [IN_TIMEOUT]        = GO(G_IDLE, GESTURE_SHORT, T_KEEP),
+    },
+    [G_DOWN2] = {
+        [IN_PRESS]          = STAY(G_DOWN2),
+        [IN_RELEASE]        = GO(G_IDLE, GESTURE_DOUBLE, T_STOP),
+        [IN_RELEASE_SINGLE] = GO(G_IDLE, GESTURE_DOUBLE, T_STOP),
+        [IN_TIMEOUT]        = STAY(G_DOWN2),
+    },
+    [G_HELD] = {
+        [IN_PRESS]          = STAY(G_HELD),
+        [IN_RELEASE]        = GO(G_IDLE, NO_GESTURE, T_STOP),
+        [IN_RELEASE_SINGLE] = GO(G_IDLE, NO_GESTURE, T_STOP),
+        [IN_TIMEOUT]        = GO(G_HELD, GESTURE_REPEAT, T_REPEAT),
+    },
+    [G_CHORD] = {
+        [IN_PRESS]          = STAY(G_CHORD),
+        [IN_RELEASE]        = GO(G_IDLE, NO_GESTURE, T_STOP),
+        [IN_RELEASE_SINGLE] = GO(G_IDLE, NO_GESTURE, T_STOP),
+        [IN_TIMEOUT]        = STAY(G_CHORD),
+    },
+};
+
+static const uint32_t s_timer_ms[] = {
+    [T_LONG] = BUTTON_LONG_PRESS_MS,
+    [T_DOUBLE] = BUTTON_DOUBLE_CLICK_MS,
+    [T_REPEAT] = BUTTON_REPEAT_MS,
+};
+
+typedef struct {
+    uint8_t state;
+    volatile uint32_t seq;  // bumped on every arm or stop, drops late timeouts
+    TimerHandle_t timer;
+} gesture_button_t;
+
+static const char *TAG = "gestures";
+
+static gesture_button_t s_buttons[BUTTON_COUNT];
+static bool s_wants_double[BUTTON_COUNT];
+static QueueHandle_t s_queue = NULL;
+
+// Runs in the timer service task
+static void timeout_cb(TimerHandle_t timer)
+{
+    int button = (intptr_t)pvTimerGetTimerID(timer);
+    button_event_t event = {
+        .button = button,
+        .type = BUTTON_EVENT_TIMEOUT,
+        .seq = s_buttons[button].seq,
+        .edge_us = esp_timer_get_time(),
+    };
+    if (xQueueSend(s_queue, &event, 0) != pdTRUE) {
+        ESP_LOGW(TAG, "Queue full, timeout of button %d lost", button);
+    }
+}
+
+static void apply_timer(gesture_button_t *g, timer_op_t op)
+{
+    if (op == T_KEEP) {
+        return;
+    }
+    g->seq++;
+    if (op == T_STOP) {
+        xTimerStop(g->timer, 0);
+    } else {
+        // Also (re)starts the timer
+        xTimerChangePeriod(g->timer, pdMS_TO_TICKS(s_timer_ms[op]), 0);
+    }
+}
+
+// A press while another button is down, short of a long press
+static bool start_chord(int button)
+{
+    for (int i = 0; i < BUTTON_COUNT; i++) {
+        if (i != button && s_buttons[i].state == G_DOWN) {
+            for (int j = 0; j < BUTTON_COUNT; j++) {
+                s_buttons[j].state = G_CHORD;
+                apply_timer(&s_buttons[j], T_STOP);
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+void gestures_feed(const button_event_t *event, gesture_cb_t cb)
+{
+    gesture_button_t *g = &s_buttons[event->button];
+    gesture_input_t input;
+
+    if (event->type == BUTTON_EVENT_TIMEOUT) {
+        if (event->seq != g->seq) {
+            return;     // re-armed or stopped after it fired
+        }
+        input = IN_TIMEOUT;
+    } else if (event->pressed) {
+        if (g->state == G_IDLE && start_chord(event->button)) {
+            cb(BUTTON_COUNT, GESTURE_CHORD, event->edge_us);
+            return;
+        }
+        input = IN_PRESS;
+    } else {
+        input = s_wants_double[event->button] ? IN_RELEASE : IN_RELEASE_SINGLE;
+    }
+
+    const transition_t *t = &s_table[g->state][input];
+    ESP_LOGD(TAG, "Button %d: state %d input %d -> %d", event->button, g->state, input,
+             t->next);
+    g->state = t->next;
+    apply_timer(g, t->timer);
+    if (t->gesture != NO_GESTURE) {
+        cb(event->button, t->gesture, event->edge_us);
+    }
+}
+
+esp_err_t gestures_init(QueueHandle_t queue, const bool *wants_double)
+{
+    s_queue = queue;
+    for (int i = 0; i < BUTTON_COUNT; i++) {
+        s_wants_double[i] = wants_double[i];
+        s_buttons[i].state = G_IDLE;
+        s_buttons[i].timer = xTimerCreate("gesture", pdMS_TO_TICKS(BUTTON_LONG_PRESS_MS),
+                                          pdFALSE, (void *)(intptr_t)i, timeout_cb);
+        if (s_buttons[i].timer == NULL) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    return ESP_OK;
+}
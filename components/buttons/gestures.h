@@ -0,0 +1,11 @@
+#include "buttons.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+
+// button is BUTTON_COUNT for GESTURE_CHORD
+typedef void (*gesture_cb_t)(int button, gesture_t gesture, int64_t edge_us);
+
+// wants_double[b]: wait for a second click before reporting a short press
+esp_err_t gestures_init(QueueHandle_t queue, const bool *wants_double);
+// Runs one queued event through the state machine, from input_task only
+void gestures_feed(const button_event_t *event, gesture_cb_t cb);
@@ -1,2 +1,58 @@
-void on_off_button_task(void *arg);
-void next_screen_button_task(void *arg);
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+// GPIO config
+#define BUTTON_ON_OFF_GPIO      GPIO_NUM_32
+#define BUTTON_NEXT_SCREEN_GPIO GPIO_NUM_33
+#define BUTTON_DEBOUNCE_MS      30
+#define BUTTON_QUEUE_LEN        8
+
+// Gesture timing
+#define BUTTON_LONG_PRESS_MS    600     // also the window for the second button of a chord
+#define BUTTON_DOUBLE_CLICK_MS  300     // only waited for on buttons with a double-click action
+#define BUTTON_REPEAT_MS        400     // while held after a long press
+
+typedef enum {
+    BUTTON_ON_OFF,
+    BUTTON_NEXT_SCREEN,
+    BUTTON_COUNT,
+} button_id_t;
+
+typedef enum {
+    GESTURE_SHORT,
+    GESTURE_LONG,
+    GESTURE_DOUBLE,
+    GESTURE_REPEAT,
+    GESTURE_CHORD,      // both buttons, reported once for the pair
+    GESTURE_COUNT,
+} gesture_t;
+
+typedef enum {
+    BUTTON_EVENT_EDGE,      // debounced level change
+    BUTTON_EVENT_TIMEOUT,   // gesture timer expired
+} button_event_type_t;
+
+typedef struct {
+    uint8_t button;     // button_id_t
+    uint8_t type;       // button_event_type_t
+    bool pressed;
+    uint32_t seq;       // timeouts: arming the event belongs to
+    int64_t edge_us;    // edges: first edge of the bounce burst
+} button_event_t;
+
+typedef struct {
+    uint32_t events;
+    uint32_t dropped;           // queue full
+    uint32_t gestures[GESTURE_COUNT];
+    uint32_t actions;
+    int64_t latency_us;         // edge to end of action, total
+    uint32_t latency_max_us;
+} buttons_stats_t;
+
+// Edge interrupts and debounce timers, events go to input_task
+esp_err_t buttons_init(void);
+void input_task(void *arg);
+void buttons_get_stats(buttons_stats_t *stats);
+const char *gesture_name(gesture_t gesture);
@@ -0,0 +1,211 @@
+#include "diagnostics.h"
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_console.h"
+#include "esp_http_server.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+
+struct diag_writer {
+    httpd_req_t *req;   // NULL when printing to the console
+    esp_err_t err;
+    size_t len;
+    char buf[DIAG_CHUNK_SIZE];
+};
+
+typedef struct {
+    const char *name;
+    diag_metrics_fn_t fn;
+} provider_t;
+
+static const char *TAG = "diagnostics";
+
+static esp_console_cmd_t s_commands[DIAG_MAX_COMMANDS];
+static int s_command_count = 0;
+static bool s_console_started = false;
+
+static void system_metrics(diag_writer_t *w);
+
+static provider_t s_providers[DIAG_MAX_PROVIDERS] = {
+    {.name = "system", .fn = system_metrics},
+};
+static int s_provider_count = 1;
+
+static httpd_handle_t s_server = NULL;
+
+esp_err_t diagnostics_register_command(const char *name, const char *help,
+                                       diag_command_fn_t func)
+{
+    if (s_command_count >= DIAG_MAX_COMMANDS) {
+        ESP_LOGE(TAG, "Cannot register command '%s'", name);
+        return ESP_ERR_NO_MEM;
+    }
+
+    esp_console_cmd_t *cmd = &s_commands[s_command_count++];
+    *cmd = (esp_console_cmd_t){
+        .command = name,
+        .help = help,
+        .func = func,
+    };
+    // Before the console starts the commands are registered by the start call
+    return s_console_started ? esp_console_cmd_register(cmd) : ESP_OK;
+}
+
+esp_err_t diagnostics_register_metrics(const char *name, diag_metrics_fn_t fn)
+{
+    if (s_provider_count >= DIAG_MAX_PROVIDERS) {
+        ESP_LOGE(TAG, "Cannot register metrics '%s'", name);
+        return ESP_ERR_NO_MEM;
+    }
+    s_providers[s_provider_count++] = (provider_t){.name = name, .fn = fn};
+    return ESP_OK;
+}
+
+static void writer_flush(diag_writer_t *w)
+{
+    if (w->len > 0 && w->err == ESP_OK) {
+        w->err = httpd_resp_send_chunk(w->req, w->buf, w->len);
+    }
+    w->len = 0;
+}
+
+void diag_printf(diag_writer_t *w, const char *fmt, ...)
+{
+    va_list args;
+
+    if (w->req == NULL) {
+        va_start(args, fmt);
+        vprintf(fmt, args);
+        va_end(args);
+        return;
+    }
+
+    // Retry once into an empty buffer if the line does not fit the rest
+    for (int attempt = 0; attempt < 2; attempt++) {
+        size_t room = sizeof(w->buf) - w->len;
+        va_start(args, fmt);
+        int n = vsnprintf(w->buf + w->len, room, fmt, args);
+        va_end(args);
+
+        if (n < 0) {
+            return;
+        }
+        if ((size_t)n < room) {
+            w->len += n;
+            return;
+        }
+        if (w->len == 0) {
+            ESP_LOGW(TAG, "Metric line truncated");
+            // Still a line of its own, the next one must not be glued on
+            w->len = sizeof(w->buf) - 1;
+            w->buf[w->len - 1] = '\n';
+            return;
+        }
+        writer_flush(w);
+    }
+}
+
+static void write_all(diag_writer_t *w)
+{
+    for (int i = 0; i < s_provider_count; i++) {
+        diag_printf(w, "# %s\n", s_providers[i].name);
+        s_providers[i].fn(w);
+    }
+}
+
+// Always available, heap and uptime
+static void system_metrics(diag_writer_t *w)
+{
+    diag_printf(w, "uptime_seconds %lld\n", esp_timer_get_time() / 1000000);
+    diag_printf(w, "heap_free_bytes %lu\n", (unsigned long)esp_get_free_heap_size());
+    diag_printf(w, "heap_min_free_bytes %lu\n",
+                (unsigned long)esp_get_minimum_free_heap_size());
+}
+
+static int metrics_cmd(int argc, char **argv)
+{
+    diag_writer_t w = {.req = NULL};
+    write_all(&w);
+    return 0;
+}
+
+static esp_err_t metrics_get_handler(httpd_req_t *req)
+{
+    // The chunk buffer is too big for the server task's stack
+    diag_writer_t *w = calloc(1, sizeof(diag_writer_t));
+    if (w == NULL) {
+        return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, NULL);
+    }
+    w->req = req;
+
+    httpd_resp_set_type(req, "text/plain; version=0.0.4");
+    write_all(w);
+    writer_flush(w);
+    esp_err_t err = w->err;
+    free(w);
+
+    if (err != ESP_OK) {
+        return err;
+    }
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+esp_err_t diagnostics_start_console(void)
+{
+    if (s_console_started) {
+        return ESP_OK;
+    }
+
+    esp_console_repl_t *repl = NULL;
+    esp_console_repl_config_t repl_config = ESP_CONSOLE_REPL_CONFIG_DEFAULT();
+    repl_config.prompt = "openweather>";
+    esp_console_dev_uart_config_t uart_config = ESP_CONSOLE_DEV_UART_CONFIG_DEFAULT();
+
+    esp_err_t err = esp_console_new_repl_uart(&uart_config, &repl_config, &repl);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Console init failed: %s", esp_err_to_name(err));
+        return err;
+    }
+
+    esp_console_register_help_command();
+    diagnostics_register_command("metrics", "Print every metric, as served on /metrics",
+                                 metrics_cmd);
+    for (int i = 0; i < s_command_count; i++) {
+        esp_console_cmd_register(&s_commands[i]);
+    }
+    s_console_started = true;
+
+    return esp_console_start_repl(repl);
+}
+
+esp_err_t diagnostics_start_http(void)
+{
+    if (s_server) {
+        return ESP_OK;
+    }
+
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.server_port = DIAG_HTTP_PORT;
+
+    esp_err_t err = httpd_start(&s_server, &config);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "HTTP server failed: %s", esp_err_to_name(err));
+        return err;
+    }
+
+    const httpd_uri_t metrics_uri = {
+        .uri = "/metrics",
+        .method = HTTP_GET,
+        .handler = metrics_get_handler,
+    };
+    httpd_register_uri_handler(s_server, &metrics_uri);
+
+    ESP_LOGI(TAG, "Metrics on port %d", DIAG_HTTP_PORT);
+    return ESP_OK;
+}
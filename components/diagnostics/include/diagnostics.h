@@ -0,0 +1,31 @@
+#include <stddef.h>
+
+#include "esp_err.h"
+
+// Field diagnostics: a serial console (esp_console REPL) and a Prometheus
+// style text endpoint at http://<device>/metrics. Components register
+// commands and metrics providers at init, before or after the start calls.
+
+#define DIAG_MAX_COMMANDS   12
+#define DIAG_MAX_PROVIDERS  12
+#define DIAG_HTTP_PORT      80
+#define DIAG_CHUNK_SIZE     512   // /metrics is sent in chunks of this size
+
+typedef struct diag_writer diag_writer_t;
+
+// Appends metric lines, to the HTTP response or to the console
+typedef void (*diag_metrics_fn_t)(diag_writer_t *w);
+typedef int (*diag_command_fn_t)(int argc, char **argv);
+
+// Strings are kept by pointer and must outlive the program
+esp_err_t diagnostics_register_command(const char *name, const char *help,
+                                       diag_command_fn_t func);
+esp_err_t diagnostics_register_metrics(const char *name, diag_metrics_fn_t fn);
+
+void diag_printf(diag_writer_t *w, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+// Console on the default UART, safe to call once at boot
+esp_err_t diagnostics_start_console(void);
+// HTTP server, needs the network stack to be up
+esp_err_t diagnostics_start_http(void);
@@ -0,0 +1,371 @@
+/* Font pack loader.
+ *
+ * The pack is mapped once at boot. Glyph descriptors are found with a
+ * binary search over the sorted index in flash, so metrics cost no RAM.
+ * Bitmaps (1-8 bpp, see tools/fontpack.py) are expanded to the A8 LVGL
+ * draws from and kept in an LRU list bounded by FONT_PACK_CACHE_KB; a hit
+ * is a copy into LVGL's glyph buffer. Both draw units may ask for glyphs
+ * at once, the cache is behind a mutex.
+ */
+#include "font_pack.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "diagnostics.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#define PACK_MAGIC   "OWFP"
+#define PACK_VERSION 1
+
+typedef struct __attribute__((packed)) {
+    char magic[4];
+    uint16_t version;
+    uint16_t font_count;
+    uint32_t total_size;
+    uint32_t reserved;
+} pack_header_t;
+
+typedef struct __attribute__((packed)) {
+    char name[16];
+    uint32_t offset;
+    uint32_t glyph_count;
+    uint16_t line_height;
+    int16_t base_line;
+    uint8_t bpp;
+    uint8_t reserved[3];
+} pack_font_t;
+
+typedef struct __attribute__((packed)) {
+    uint32_t codepoint;
+    uint32_t bitmap_offset;     // from the font offset
+    uint16_t adv_w;
+    uint8_t box_w;
+    uint8_t box_h;
+    int8_t ofs_x;
+    int8_t ofs_y;
+    uint16_t reserved;
+} pack_glyph_t;
+
+typedef struct {
+    lv_font_t font;
+    const pack_font_t *entry;
+    const uint8_t *base;
+    const pack_glyph_t *glyphs;
+    uint8_t id;
+} loaded_font_t;
+
+typedef struct cache_entry {
+    struct cache_entry *prev;
+    struct cache_entry *next;
+    uint32_t key;               // font id << 24 | glyph index
+    uint16_t size;
+    uint8_t data[];
+} cache_entry_t;
+
+static const char *TAG = "font_pack";
+
+static const uint8_t *s_map = NULL;
+static esp_partition_mmap_handle_t s_map_handle;
+static loaded_font_t s_fonts[FONT_PACK_MAX_FONTS];
+static int s_font_count = 0;
+
+// Most recently used first
+static cache_entry_t *s_head = NULL;
+static cache_entry_t *s_tail = NULL;
+static SemaphoreHandle_t s_cache_lock = NULL;
+static font_pack_stats_t s_stats;
+
+static const pack_glyph_t *find_glyph(const loaded_font_t *lf, uint32_t letter)
+{
+    int lo = 0, hi = (int)lf->entry->glyph_count - 1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        uint32_t cp = lf->glyphs[mid].codepoint;
+        if (cp == letter) {
+            return &lf->glyphs[mid];
+        }
+        if (cp < letter) {
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return NULL;
+}
+
+static bool get_glyph_dsc(const lv_font_t *font, lv_font_glyph_dsc_t *dsc_out,
+                          uint32_t letter, uint32_t letter_next)
+{
+    const loaded_font_t *lf = font->dsc;
+    const pack_glyph_t *g = find_glyph(lf, letter);
+    if (g == NULL) {
+        return false;   // LVGL tries the fallback font next
+    }
+
+    dsc_out->adv_w = g->adv_w;
+    dsc_out->box_w = g->box_w;
+    dsc_out->box_h = g->box_h;
+    dsc_out->ofs_x = g->ofs_x;
+    dsc_out->ofs_y = g->ofs_y;
+    dsc_out->format = (lv_font_glyph_format_t)lf->entry->bpp;  // A1 .. A8
+    dsc_out->is_placeholder = false;
+    dsc_out->gid.index = g - lf->glyphs;
+    return true;
+}
+
+static void unlink_entry(cache_entry_t *e)
+{
+    if (e->prev) {
+        e->prev->next = e->next;
+    } else {
+        s_head = e->next;
+    }
+    if (e->next) {
+        e->next->prev = e->prev;
+    } else {
+        s_tail = e->prev;
+    }
+}
+
+static void push_front(cache_entry_t *e)
+{
+    e->prev = NULL;
+    e->next = s_head;
+    if (s_head) {
+        s_head->prev = e;
+    }
+    s_head = e;
+    if (s_tail == NULL) {
+        s_tail = e;
+    }
+}
+
+static void expand(uint8_t *dst, const uint8_t *src, uint32_t count, uint8_t bpp)
+{
+    if (bpp == 8) {
+        memcpy(dst, src, count);
+        return;
+    }
+
+    const uint8_t scale = 255 / ((1 << bpp) - 1);
+    const uint8_t mask = (1 << bpp) - 1;
+    uint32_t bit = 0;
+    for (uint32_t i = 0; i < count; i++, bit += bpp) {
+        uint8_t byte = src[bit / 8];
+        dst[i] = ((byte >> (8 - bpp - bit % 8)) & mask) * scale;
+    }
+}
+
+// Called with the cache lock held
+static cache_entry_t *load_glyph(const loaded_font_t *lf, uint32_t index, uint32_t key)
+{
+    const pack_glyph_t *g = &lf->glyphs[index];
+    uint32_t size = g->box_w * g->box_h;
+
+    while (s_tail && s_stats.cached_bytes + size > FONT_PACK_CACHE_KB * 1024) {
+        cache_entry_t *victim = s_tail;
+        unlink_entry(victim);
+        s_stats.cached_bytes -= victim->size;
+        s_stats.cached_glyphs--;
+        s_stats.evictions++;
+        heap_caps_free(victim);
+    }
+
+    cache_entry_t *e = heap_caps_malloc(sizeof(cache_entry_t) + size,
+                                        MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (e == NULL) {
+        return NULL;
+    }
+    e->key = key;
+    e->size = size;
+    expand(e->data, lf->base + g->bitmap_offset, size, lf->entry->bpp);
+
+    push_front(e);
+    s_stats.cached_bytes += size;
+    s_stats.cached_glyphs++;
+    return e;
+}
+
+static const void *get_glyph_bitmap(lv_font_glyph_dsc_t *g_dsc, lv_draw_buf_t *draw_buf)
+{
+    const loaded_font_t *lf = g_dsc->resolved_font->dsc;
+    uint32_t index = g_dsc->gid.index;
+
+    if (g_dsc->req_raw_bitmap) {
+        return lf->base + lf->glyphs[index].bitmap_offset;
+    }
+    if (g_dsc->box_w == 0 || g_dsc->box_h == 0) {
+        return NULL;
+    }
+
+    uint32_t key = ((uint32_t)lf->id << 24) | index;
+    xSemaphoreTake(s_cache_lock, portMAX_DELAY);
+    int64_t start = esp_timer_get_time();
+    s_stats.lookups++;
+
+    cache_entry_t *e = s_head;
+    while (e && e->key != key) {
+        e = e->next;
+    }
+
+    if (e) {
+        s_stats.hits++;
+        unlink_entry(e);
+        push_front(e);
+    } else {
+        e = load_glyph(lf, index, key);
+        uint32_t elapsed = esp_timer_get_time() - start;
+        s_stats.misses++;
+        s_stats.miss_us += elapsed;
+        s_stats.miss_max_us = LV_MAX(s_stats.miss_max_us, elapsed);
+    }
+
+    if (e) {
+        // LVGL's buffer may pad rows
+        uint32_t stride = draw_buf->header.stride;
+        for (uint32_t y = 0; y < g_dsc->box_h; y++) {
+            memcpy(draw_buf->data + y * stride, e->data + y * g_dsc->box_w, g_dsc->box_w);
+        }
+    }
+    xSemaphoreGive(s_cache_lock);
+
+    if (e == NULL) {
+        return NULL;
+    }
+    lv_draw_buf_flush_cache(draw_buf, NULL);
+    return draw_buf;
+}
+
+void font_pack_get_stats(font_pack_stats_t *stats)
+{
+    if (s_cache_lock == NULL) {
+        *stats = (font_pack_stats_t){0};
+        return;
+    }
+    xSemaphoreTake(s_cache_lock, portMAX_DELAY);
+    *stats = s_stats;
+    xSemaphoreGive(s_cache_lock);
+}
+
+const lv_font_t *font_pack_get(const char *name, const lv_font_t *fallback)
+{
+    for (int i = 0; i < s_font_count; i++) {
+        loaded_font_t *lf = &s_fonts[i];
+        if (strncmp(lf->entry->name, name, sizeof(lf->entry->name)) == 0) {
+            lf->font.fallback = fallback;
+            return &lf->font;
+        }
+    }
+    return NULL;
+}
+
+static int fonts_cmd(int argc, char **argv)
+{
+    font_pack_stats_t s;
+    font_pack_get_stats(&s);
+
+    for (int i = 0; i < s_font_count; i++) {
+        printf("%.16s: %lu glyphs, %u px, %u bpp\n", s_fonts[i].entry->name,
+               (unsigned long)s_fonts[i].entry->glyph_count,
+               (unsigned)s_fonts[i].entry->line_height, (unsigned)s_fonts[i].entry->bpp);
+    }
+    printf("cache: %lu glyphs, %u/%u B, %lu lookups, hit rate %lu%%, %lu evictions\n",
+           (unsigned long)s.cached_glyphs, (unsigned)s.cached_bytes,
+           FONT_PACK_CACHE_KB * 1024, (unsigned long)s.lookups,
+           (unsigned long)(s.lookups ? 100ULL * s.hits / s.lookups : 0),
+           (unsigned long)s.evictions);
+    printf("misses: %lu, avg %lld us, max %lu us\n", (unsigned long)s.misses,
+           s.misses ? s.miss_us / s.misses : 0, (unsigned long)s.miss_max_us);
+    return 0;
+}
+
+static void fonts_metrics(diag_writer_t *w)
+{
+    font_pack_stats_t s;
+    font_pack_get_stats(&s);
+
+    diag_printf(w, "font_cache_lookups_total %lu\n", (unsigned long)s.lookups);
+    diag_printf(w, "font_cache_hits_total %lu\n", (unsigned long)s.hits);
+    diag_printf(w, "font_cache_misses_total %lu\n", (unsigned long)s.misses);
+    diag_printf(w, "font_cache_evictions_total %lu\n", (unsigned long)s.evictions);
+    diag_printf(w, "font_cache_bytes %u\n", (unsigned)s.cached_bytes);
+    diag_printf(w, "font_cache_glyphs %lu\n", (unsigned long)s.cached_glyphs);
+    diag_printf(w, "font_glyph_miss_us_total %lld\n", s.miss_us);
+    diag_printf(w, "font_glyph_miss_max_us %lu\n", (unsigned long)s.miss_max_us);
+}
+
+esp_err_t font_pack_init(void)
+{
+    const esp_partition_t *part = esp_partition_find_first(
+        ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, FONT_PACK_PARTITION);
+    if (part == NULL) {
+        ESP_LOGW(TAG, "No '%s' partition", FONT_PACK_PARTITION);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    pack_header_t header;
+    esp_err_t err = esp_partition_read(part, 0, &header, sizeof(header));
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (memcmp(header.magic, PACK_MAGIC, 4) != 0 || header.version != PACK_VERSION ||
+        header.total_size > part->size) {
+        ESP_LOGW(TAG, "No font pack in '%s', flash one built by tools/fontpack.py",
+                 FONT_PACK_PARTITION);
+        return ESP_ERR_INVALID_VERSION;
+    }
+
+    // Only what the pack uses, the data mapping window is shared with the app
+    const void *map = NULL;
+    err = esp_partition_mmap(part, 0, header.total_size, ESP_PARTITION_MMAP_DATA, &map,
+                             &s_map_handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to map the font pack: %s", esp_err_to_name(err));
+        return err;
+    }
+    s_map = map;
+
+    s_cache_lock = xSemaphoreCreateMutex();
+    if (s_cache_lock == NULL) {
+        esp_partition_munmap(s_map_handle);
+        s_map = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+
+    const pack_font_t *entries = (const pack_font_t *)(s_map + sizeof(pack_header_t));
+    for (int i = 0; i < header.font_count && s_font_count < FONT_PACK_MAX_FONTS; i++) {
+        const pack_font_t *entry = &entries[i];
+        uint8_t bpp = entry->bpp;
+        if ((bpp != 1 && bpp != 2 && bpp != 4 && bpp != 8) ||
+            entry->offset + entry->glyph_count * sizeof(pack_glyph_t) > header.total_size) {
+            ESP_LOGW(TAG, "Skipping malformed font %d", i);
+            continue;
+        }
+
+        loaded_font_t *lf = &s_fonts[s_font_count];
+        lf->entry = entry;
+        lf->base = s_map + entry->offset;
+        lf->glyphs = (const pack_glyph_t *)lf->base;
+        lf->id = s_font_count++;
+        lf->font = (lv_font_t){
+            .get_glyph_dsc = get_glyph_dsc,
+            .get_glyph_bitmap = get_glyph_bitmap,
+            .line_height = entry->line_height,
+            .base_line = entry->base_line,
+            .subpx = LV_FONT_SUBPX_NONE,
+            .dsc = lf,
+        };
+        ESP_LOGI(TAG, "Font '%.16s': %lu glyphs, %u bpp", entry->name,
+                 (unsigned long)entry->glyph_count, (unsigned)bpp);
+    }
+
+    diagnostics_register_command("fonts", "Font pack glyph cache stats", fonts_cmd);
+    diagnostics_register_metrics("fonts", fonts_metrics);
+    return ESP_OK;
+}
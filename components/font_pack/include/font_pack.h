@@ -0,0 +1,31 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "lvgl.h"
+
+// Fonts read from the "fonts" data partition (built by tools/fontpack.py)
+// through a memory mapping. Glyph metrics are looked up in place, bitmaps
+// are decoded to A8 on first use and kept in a bounded LRU cache.
+
+#define FONT_PACK_PARTITION  "fonts"
+#define FONT_PACK_MAX_FONTS  4
+#define FONT_PACK_CACHE_KB   16
+
+typedef struct {
+    uint32_t lookups;
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t evictions;
+    uint32_t cached_glyphs;
+    size_t cached_bytes;
+    int64_t miss_us;        // total time spent decoding misses
+    uint32_t miss_max_us;
+} font_pack_stats_t;
+
+// Maps the partition; without one the getters return NULL
+esp_err_t font_pack_init(void);
+
+// fallback is used for code points the packed font lacks, may be NULL
+const lv_font_t *font_pack_get(const char *name, const lv_font_t *fallback);
+void font_pack_get_stats(font_pack_stats_t *stats);
@@ -3,17 +3,71 @@
 #include "esp_log.h"
 #include "esp_timer.h"
 #include "get_sensor_data.h"
+#include "sensor_history.h"
 #include "scd41.h"
 #include "openweather.h"
+#include "power.h"
 
 // SCD41 I2C config
 #define I2C_MASTER_SCL_IO 22
 #define I2C_MASTER_SDA_IO 21
 #define I2C_MASTER_FREQ_HZ 100000
 
+// Commands the driver does not wrap, battery mode only
+#define SCD41_ADDR              0x62
+#define SCD41_CMD_STOP_PERIODIC 0x3F86
+#define SCD41_CMD_SINGLE_SHOT   0x219D
+#define SCD41_CMD_POWER_DOWN    0x36E0
+#define SCD41_CMD_WAKE_UP       0x36F6
+
 static const char *TAG = "get_sensor_data";
 
-void sensor_task(void)
+// Held for each command including its execution time, the SCD41 does not
+// answer until it is done
+static SemaphoreHandle_t s_i2c_lock = NULL;
+static bool s_asleep = false;
+
+static esp_err_t sensor_command(uint16_t cmd, uint32_t exec_ms)
+{
+    uint8_t buf[2] = {cmd >> 8, cmd & 0xff};
+    esp_err_t err = ESP_ERR_INVALID_STATE;
+
+    xSemaphoreTake(s_i2c_lock, portMAX_DELAY);
+    if (!s_asleep) {
+        err = i2c_master_write_to_device(I2C_NUM_0, SCD41_ADDR, buf, sizeof(buf),
+                                         pdMS_TO_TICKS(100));
+        vTaskDelay(pdMS_TO_TICKS(exec_ms));
+    }
+    xSemaphoreGive(s_i2c_lock);
+    return err;
+}
+
+void sensor_sleep(void)
+{
+    if (s_i2c_lock == NULL) {
+        return;
+    }
+    // Idle after a single shot, power down leaves only the interface on
+    sensor_command(SCD41_CMD_POWER_DOWN, 1);
+    xSemaphoreTake(s_i2c_lock, portMAX_DELAY);
+    s_asleep = true;
+    xSemaphoreGive(s_i2c_lock);
+}
+
+// Battery mode: one single shot per wake, the sensor is powered down
+// through the sleep instead of measuring every 5 s
+static void start_single_shot_mode(void)
+{
+    if (power_wake_cause() == POWER_WAKE_COLD) {
+        // Idle after power on, still measuring after a reset
+        sensor_command(SCD41_CMD_STOP_PERIODIC, 500);
+    } else {
+        // Not acknowledged by design
+        sensor_command(SCD41_CMD_WAKE_UP, 30);
+    }
+}
+
+void sensor_task(void *pvParameters)
 {
     i2c_config_t conf = {
         .mode = I2C_MODE_MASTER,
@@ -32,31 +86,56 @@ void sensor_task(void)
     config.timeout_ms = 1000;
 
     ESP_ERROR_CHECK(scd41_init(&config));
-    ESP_ERROR_CHECK(scd41_start_measurement());
-
-    // Wait for first measurement (5 seconds)
-    vTaskDelay(pdMS_TO_TICKS(5000));
+    s_i2c_lock = xSemaphoreCreateMutex();
+    if (POWER_DEEP_SLEEP) {
+        start_single_shot_mode();
+    } else {
+        ESP_ERROR_CHECK(scd41_start_measurement());
+        // Wait for first measurement (5 seconds)
+        vTaskDelay(pdMS_TO_TICKS(5000));
+    }
 
     while (1) {
+        if (POWER_DEEP_SLEEP) {
+            sensor_command(SCD41_CMD_SINGLE_SHOT, 5000);
+        }
+
         scd41_data_t data;
-        esp_err_t ret = scd41_read_measurement(&data);
+        esp_err_t ret = ESP_ERR_INVALID_STATE;
+        xSemaphoreTake(s_i2c_lock, portMAX_DELAY);
+        if (!s_asleep) {
+            // The read waits out the sensor's command delays, stay awake for it
+            power_lock(POWER_LOCK_SENSOR);
+            ret = scd41_read_measurement(&data);
+            power_unlock(POWER_LOCK_SENSOR);
+        }
+        xSemaphoreGive(s_i2c_lock);
 
         if (ret == ESP_OK && data.data_ready) {
             if (xSemaphoreTake(sensor_mutex, pdMS_TO_TICKS(100)) == pdTRUE) {
                 g_sensor_data.co2_ppm = data.co2_ppm;
                 g_sensor_data.temperature = data.temperature;
                 g_sensor_data.humidity = data.humidity;
-                g_sensor_data.timestamp = esp_timer_get_time() / 1000; // ms
+                g_sensor_data.timestamp = power_clock_ms();
+                sensor_data_t sample = g_sensor_data;
                 xSemaphoreGive(sensor_mutex);
                 
                 // Signal new data is ready
-                xEventGroupSetBits(data_events, SENSOR_DATA_READY);
+                EventBits_t bits = SENSOR_DATA_READY;
+                if (sensor_history_add(&sample)) {
+                    bits |= HISTORY_DATA_READY;
+                }
+                xEventGroupSetBits(data_events, bits);
                 // ESP_LOGI(TAG, "CO2: %d ppm, Temperature: %.1f°C, Humidity: %.1f%%",
                 //         data.co2_ppm, data.temperature, data.humidity);
             }
         } else {
             ESP_LOGW(TAG, "Failed to read sensor data");
         }
+        if (POWER_DEEP_SLEEP) {
+            // One sample per cycle, a button wake keeps showing it
+            vTaskSuspend(NULL);
+        }
         // SCD41 provides new data every 5 seconds
         vTaskDelay(pdMS_TO_TICKS(5000));
     }
@@ -1 +1,3 @@
-void sensor_task();
+void sensor_task(void *pvParameters);
+// Battery mode: powers the SCD41 down before deep sleep
+void sensor_sleep(void);
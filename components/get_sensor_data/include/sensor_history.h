@@ -0,0 +1,32 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "openweather.h"
+
+// Points kept per window, one chart column each
+#define SENSOR_HISTORY_POINTS 120
+
+typedef enum {
+    SENSOR_HISTORY_1H,
+    SENSOR_HISTORY_24H,
+    SENSOR_HISTORY_7D,
+    SENSOR_HISTORY_WINDOW_COUNT,
+} sensor_history_window_t;
+
+// Average of one bucket, temperature and humidity in tenths
+typedef struct {
+    uint16_t co2_ppm;
+    int16_t temperature_x10;
+    uint16_t humidity_x10;
+} sensor_history_point_t;
+
+// Returns true if any window completed a new point
+bool sensor_history_add(const sensor_data_t *sample);
+
+// Copies up to max points added after *seq, oldest first, and advances *seq
+// past them. Points that already left the window are skipped, so a seq of 0
+// reads the whole window.
+int sensor_history_read(sensor_history_window_t window, uint32_t *seq,
+                        sensor_history_point_t *points, int max);
+
+const char *sensor_history_window_name(sensor_history_window_t window);
@@ -0,0 +1,102 @@
+#include "sensor_history.h"
+
+#include <string.h>
+
+#include "esp_attr.h"
+
+typedef struct {
+    const char *name;
+    uint32_t period_ms;     // time covered by one point
+    sensor_history_point_t points[SENSOR_HISTORY_POINTS];
+    uint32_t seq;           // points ever added, head is seq % SENSOR_HISTORY_POINTS
+    // Running sums of the bucket being filled
+    uint64_t bucket_start;
+    uint32_t co2_sum;
+    int32_t temp_sum;
+    uint32_t humid_sum;
+    uint16_t samples;
+} history_tier_t;
+
+#define TIER(_name, _window_s)                                                 \
+    { .name = (_name), .period_ms = (_window_s) * 1000UL / SENSOR_HISTORY_POINTS }
+
+// In RTC slow memory, the history survives the deep sleep of battery mode
+static RTC_DATA_ATTR history_tier_t s_tiers[SENSOR_HISTORY_WINDOW_COUNT] = {
+    [SENSOR_HISTORY_1H] = TIER("1h", 3600),
+    [SENSOR_HISTORY_24H] = TIER("24h", 24 * 3600),
+    [SENSOR_HISTORY_7D] = TIER("7d", 7 * 24 * 3600),
+};
+
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+
+bool sensor_history_add(const sensor_data_t *sample)
+{
+    bool added = false;
+    int16_t temp_x10 = (int16_t)(sample->temperature * 10.0f);
+    uint16_t humid_x10 = (uint16_t)(sample->humidity * 10.0f);
+
+    portENTER_CRITICAL(&s_lock);
+    for (int i = 0; i < SENSOR_HISTORY_WINDOW_COUNT; i++) {
+        history_tier_t *tier = &s_tiers[i];
+
+        // A sample past the end of the bucket closes it and opens the next
+        if (tier->samples > 0 &&
+            sample->timestamp - tier->bucket_start >= tier->period_ms) {
+            sensor_history_point_t *p = &tier->points[tier->seq % SENSOR_HISTORY_POINTS];
+            p->co2_ppm = tier->co2_sum / tier->samples;
+            p->temperature_x10 = tier->temp_sum / tier->samples;
+            p->humidity_x10 = tier->humid_sum / tier->samples;
+            tier->seq++;
+
+            tier->co2_sum = 0;
+            tier->temp_sum = 0;
+            tier->humid_sum = 0;
+            tier->samples = 0;
+            added = true;
+        }
+
+        if (tier->samples == 0) {
+            tier->bucket_start = sample->timestamp;
+        }
+        tier->co2_sum += sample->co2_ppm;
+        tier->temp_sum += temp_x10;
+        tier->humid_sum += humid_x10;
+        tier->samples++;
+    }
+    portEXIT_CRITICAL(&s_lock);
+
+    return added;
+}
+
+int sensor_history_read(sensor_history_window_t window, uint32_t *seq,
+                        sensor_history_point_t *points, int max)
+{
+    if (window >= SENSOR_HISTORY_WINDOW_COUNT) {
+        return 0;
+    }
+    history_tier_t *tier = &s_tiers[window];
+
+    portENTER_CRITICAL(&s_lock);
+    uint32_t first = *seq;
+    if (tier->seq - first > SENSOR_HISTORY_POINTS) {
+        // Older points already left the ring
+        first = tier->seq - SENSOR_HISTORY_POINTS;
+    }
+    uint32_t count = tier->seq - first;
+    if (count > (uint32_t)max) {
+        count = max;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        points[i] = tier->points[(first + i) % SENSOR_HISTORY_POINTS];
+    }
+    *seq = first + count;
+    portEXIT_CRITICAL(&s_lock);
+
+    return count;
+}
+
+const char *sensor_history_window_name(sensor_history_window_t window)
+{
+    return window < SENSOR_HISTORY_WINDOW_COUNT ? s_tiers[window].name : "?";
+}
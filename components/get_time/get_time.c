@@ -1,24 +1,106 @@
+#include <sys/time.h>
+
 #include "esp_sntp.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "get_time.h"
 #include "openweather.h"
+#include "wifi_connect.h"
 
 static const char *TAG = "get_time";
 
+static esp_timer_handle_t tick_timer = NULL;
+
+static bool s_synced = false;
+
 void time_sync_notification_cb(struct timeval *tv)
 {
     ESP_LOGI(TAG, "Time synchronized!");
+    s_synced = true;
+}
+
+static void set_tz(void)
+{
+    static bool tz_set = false;
+    if (!tz_set) {
+        setenv("TZ", "JST-9", 1);  // Japan Standard Time (UTC+9)
+        tzset();
+        tz_set = true;
+    }
+}
+
+static void arm_tick_timer(void)
+{
+    // Re-armed every tick from the wall clock, so SNTP steps and timer
+    // drift never accumulate
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    esp_timer_start_once(tick_timer, 1000000 - tv.tv_usec + CLOCK_TICK_SLACK_US);
+}
+
+static void tick_timer_cb(void *arg)
+{
+    time_t now;
+    struct tm timeinfo;
+    time(&now);
+    localtime_r(&now, &timeinfo);
+
+    // Runs in the esp_timer task, never block it
+    if (xSemaphoreTake(time_mutex, 0) == pdTRUE) {
+        g_time_data.current_time = now;
+        g_time_data.timeinfo = timeinfo;
+        xSemaphoreGive(time_mutex);
+    }
+    xEventGroupSetBits(data_events, CLOCK_TICK);
+
+    arm_tick_timer();
+}
+
+void clock_tick_start(void)
+{
+    if (tick_timer != NULL) {
+        return;
+    }
+
+    const esp_timer_create_args_t timer_args = {
+        .callback = tick_timer_cb,
+        .name = "clock_tick",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&timer_args, &tick_timer));
+    arm_tick_timer();
+}
+
+void time_publish(void)
+{
+    set_tz();
+
+    time_t now;
+    struct tm timeinfo;
+    time(&now);
+    localtime_r(&now, &timeinfo);
+
+    if (xSemaphoreTake(time_mutex, pdMS_TO_TICKS(100)) == pdTRUE) {
+        g_time_data.current_time = now;
+        g_time_data.timeinfo = timeinfo;
+        // Sticky: the RTC keeps the clock set, through deep sleep too
+        g_time_data.synced |= s_synced;
+        xSemaphoreGive(time_mutex);
+
+        xEventGroupSetBits(data_events, TIME_DATA_READY);
+    }
 }
 
 void time_task(void *pvParameters)
 {
-    setenv("TZ", "JST-9", 1);  // Japan Standard Time (UTC+9)
-    tzset();
+    set_tz();
     // Initialize SNTP
     esp_sntp_setoperatingmode(SNTP_OPMODE_POLL);
     esp_sntp_setservername(0, "pool.ntp.org");
     esp_sntp_set_time_sync_notification_cb(time_sync_notification_cb);
     esp_sntp_init();
+
+    // SNTP retries by itself, only the wait for the first sync needs the link
+    wifi_power_acquire(portMAX_DELAY);
     
     int retry = 0;
     const int retry_count = 10;
@@ -27,25 +109,15 @@ void time_task(void *pvParameters)
         ESP_LOGI(TAG, "Waiting for system time to be set... (%d/%d)", retry, retry_count);
         vTaskDelay(pdMS_TO_TICKS(2000));
     }
+
+    wifi_power_release();
+
+    if (CLOCK_SHOW_SECONDS) {
+        clock_tick_start();
+    }
     
     while (1) {
-        time_t now;
-        struct tm timeinfo;
-        time(&now);
-        localtime_r(&now, &timeinfo);
-        
-        if (xSemaphoreTake(time_mutex, pdMS_TO_TICKS(100)) == pdTRUE) {
-            g_time_data.current_time = now;
-            g_time_data.timeinfo = timeinfo;
-            g_time_data.synced = (esp_sntp_get_sync_status() == SNTP_SYNC_STATUS_COMPLETED);
-            xSemaphoreGive(time_mutex);
-            
-            xEventGroupSetBits(data_events, TIME_DATA_READY);
-            
-            // ESP_LOGI(TAG, "Current time: %04d-%02d-%02d %02d:%02d:%02d",
-            //          timeinfo.tm_year + 1900, timeinfo.tm_mon + 1, timeinfo.tm_mday,
-            //          timeinfo.tm_hour, timeinfo.tm_min, timeinfo.tm_sec);
-        }
+        time_publish();
         vTaskDelay(pdMS_TO_TICKS(10000));
     }
 }
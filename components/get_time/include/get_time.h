@@ -1 +1,8 @@
+// Seconds on the clock, driven by a 1 Hz timer aligned to the wall clock
+#define CLOCK_SHOW_SECONDS  1
+#define CLOCK_TICK_SLACK_US 2000    // fire just after the second boundary
+
 void time_task(void *pvParameters);
+// Copies the system clock into g_time_data and sets TIME_DATA_READY
+void time_publish(void);
+void clock_tick_start(void);
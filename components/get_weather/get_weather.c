@@ -6,6 +6,8 @@
 #include "cJSON.h"
 #include "esp_timer.h"
 #include "openweather.h"
+#include "power.h"
+#include "wifi_connect.h"
 
 #define WEATHER_API_KEY "key"
 #define CITY "Tokyo"
@@ -13,12 +15,16 @@
     "http://api.weatherapi.com/v1/current.json?key=" WEATHER_API_KEY "&q=" CITY "&aqi=no"
 
 #define MAX_HTTP_OUTPUT_BUFFER 2048
+#define WEATHER_PERIOD_MS 30000
 
 static char http_response_buffer[MAX_HTTP_OUTPUT_BUFFER] = {0};
 static int response_len = 0;
 
 static const char* TAG = "get_weather";
 
+static const char* s_lang = NULL;
+static TaskHandle_t s_task = NULL;
+
 esp_err_t _http_event_handler(esp_http_client_event_t* evt) {
     switch (evt->event_id) {
         case HTTP_EVENT_ERROR:
@@ -115,7 +121,7 @@ esp_err_t parse_weather_response(const char* json_string) {
         strncpy(g_weather_data.condition, condition_text, sizeof(g_weather_data.condition) - 1);
         g_weather_data.condition[sizeof(g_weather_data.condition) - 1] = '\0';
 
-        g_weather_data.updated_at = esp_timer_get_time() / 1000;  // milliseconds
+        g_weather_data.updated_at = power_clock_ms();
 
         xSemaphoreGive(weather_mutex);
 
@@ -138,16 +144,41 @@ esp_err_t parse_weather_response(const char* json_string) {
     return ESP_OK;
 }
 
+void weather_set_lang(const char* lang) {
+    s_lang = lang;
+}
+
+void weather_refresh(void) {
+    if (s_task) {
+        xTaskNotifyGive(s_task);
+    }
+}
+
 void weather_task(void* pvParameters) {
+    char url[192];
+    s_task = xTaskGetCurrentTaskHandle();
+    snprintf(url, sizeof(url), "%s%s%s", WEATHER_API_URL, s_lang ? "&lang=" : "",
+             s_lang ? s_lang : "");
+
     esp_http_client_config_t config = {
-        .url = WEATHER_API_URL,
+        .url = url,
         .event_handler = _http_event_handler,
         .timeout_ms = 10000,
     };
     while (1) {
+        // Brings the radio up under the duty-cycle policy, otherwise waits
+        // out a reconnect
+        if (wifi_power_acquire(pdMS_TO_TICKS(WIFI_ACQUIRE_TIMEOUT_MS)) != ESP_OK) {
+            ESP_LOGW(TAG, "No link, skipping this fetch");
+            wifi_power_release();
+            ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(WEATHER_PERIOD_MS));
+            continue;
+        }
         response_len = 0;
         memset(http_response_buffer, 0, MAX_HTTP_OUTPUT_BUFFER);
 
+        // Full speed for the session, parsing included
+        power_lock(POWER_LOCK_NET);
         esp_http_client_handle_t client = esp_http_client_init(&config);
         esp_err_t err = esp_http_client_perform(client);
 
@@ -174,6 +205,9 @@ void weather_task(void* pvParameters) {
             ESP_LOGE(TAG, "HTTP GET request failed: %s", esp_err_to_name(err));
         }
         esp_http_client_cleanup(client);
-        vTaskDelay(pdMS_TO_TICKS(30 * 1000));
+        power_unlock(POWER_LOCK_NET);
+        wifi_power_release();
+        // Woken early by weather_refresh()
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(WEATHER_PERIOD_MS));
     }
 }
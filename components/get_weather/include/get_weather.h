@@ -2,5 +2,11 @@
 #include "esp_log.h"
 #include "esp_err.h"
 
+// weatherapi lang code used when the display can show it
+#define WEATHER_LANG_LOCAL "ja"
 
+// Condition text language, NULL for English; call before weather_task
+void weather_set_lang(const char *lang);
 void weather_task(void *pvParameters);
+// Fetch now instead of at the end of the current period
+void weather_refresh(void);
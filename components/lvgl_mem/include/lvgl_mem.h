@@ -0,0 +1,39 @@
+#include <stddef.h>
+#include <stdint.h>
+
+// LVGL heap backend (CONFIG_LV_USE_CUSTOM_MALLOC): a dedicated pool in
+// internal RAM where every block is tagged with the owner that allocated it.
+
+#define LVGL_MEM_POOL_KB        64
+#define LVGL_MEM_MAX_OWNERS     12
+#define LVGL_MEM_LOG_PERIOD_S   60
+#define LVGL_MEM_HEADROOM_PCT   25    // margin added to the measured peak
+
+#define LVGL_MEM_OWNER_CORE     0     // LVGL internals, displays, timers
+
+typedef struct {
+    const char *name;
+    size_t cur_bytes;
+    size_t peak_bytes;
+    uint32_t allocs;
+    uint32_t frees;
+} lvgl_mem_owner_stats_t;
+
+typedef struct {
+    size_t pool_bytes;
+    size_t used_bytes;
+    size_t peak_bytes;          // high-water mark of the whole pool
+    size_t free_bytes;
+    size_t largest_free;
+    uint8_t frag_pct;           // 100 - largest_free / free_bytes
+    uint32_t allocs;
+    uint32_t failed;
+    size_t recommended_kb;      // peak + headroom, rounded up
+} lvgl_mem_stats_t;
+
+int lvgl_mem_register_owner(const char *name);
+int lvgl_mem_set_owner(int owner);
+void lvgl_mem_get_stats(lvgl_mem_stats_t *stats);
+int lvgl_mem_get_owner_stats(lvgl_mem_owner_stats_t *owners, int max);
+size_t lvgl_mem_owner_bytes(int owner);
+void lvgl_mem_log_stats(void);
@@ -0,0 +1,325 @@
+#include "lvgl_mem.h"
+
+#include <string.h>
+
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "lvgl.h"
+#include "multi_heap.h"
+
+#define BLOCK_MAGIC 0xA5
+
+// Prepended to every block. multi_heap only aligns blocks to 4 bytes, the
+// header is a multiple of that so the payload keeps the same alignment
+typedef struct {
+    uint32_t size;
+    uint8_t owner;
+    uint8_t magic;
+    uint16_t reserved;
+} block_hdr_t;
+
+#define HDR_SIZE sizeof(block_hdr_t)
+
+static const char *TAG = "lvgl_mem";
+
+static portMUX_TYPE s_heap_lock = portMUX_INITIALIZER_UNLOCKED;
+static portMUX_TYPE s_stats_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static void *s_pool = NULL;
+static multi_heap_handle_t s_heap = NULL;
+static esp_timer_handle_t s_log_timer = NULL;
+
+static lvgl_mem_owner_stats_t s_owners[LVGL_MEM_MAX_OWNERS] = {
+    [LVGL_MEM_OWNER_CORE] = {.name = "core"},
+};
+static int s_owner_count = 1;
+static int s_current_owner = LVGL_MEM_OWNER_CORE;
+
+static uint32_t s_allocs = 0;
+static uint32_t s_failed = 0;
+// Logger only, the rate it reports covers the time since its last report
+static uint32_t s_last_allocs = 0;
+static int64_t s_last_sample_us = 0;
+
+static void log_timer_cb(void *arg)
+{
+    lvgl_mem_log_stats();
+}
+
+static void account_alloc(int owner, size_t size)
+{
+    taskENTER_CRITICAL(&s_stats_lock);
+    lvgl_mem_owner_stats_t *o = &s_owners[owner];
+    o->cur_bytes += size;
+    o->allocs++;
+    if (o->cur_bytes > o->peak_bytes) {
+        o->peak_bytes = o->cur_bytes;
+    }
+    s_allocs++;
+    taskEXIT_CRITICAL(&s_stats_lock);
+}
+
+static void account_free(int owner, size_t size)
+{
+    taskENTER_CRITICAL(&s_stats_lock);
+    lvgl_mem_owner_stats_t *o = &s_owners[owner];
+    o->cur_bytes -= size;
+    o->frees++;
+    taskEXIT_CRITICAL(&s_stats_lock);
+}
+
+static void account_failed(void)
+{
+    taskENTER_CRITICAL(&s_stats_lock);
+    s_failed++;
+    taskEXIT_CRITICAL(&s_stats_lock);
+}
+
+/* LVGL custom allocator hooks (LV_STDLIB_CUSTOM) */
+
+void lv_mem_init(void)
+{
+    size_t bytes = LVGL_MEM_POOL_KB * 1024;
+    s_pool = heap_caps_malloc(bytes, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (s_pool == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate %d KB LVGL pool", LVGL_MEM_POOL_KB);
+        return;
+    }
+
+    s_heap = multi_heap_register(s_pool, bytes);
+    multi_heap_set_lock(s_heap, &s_heap_lock);
+    s_last_sample_us = esp_timer_get_time();
+
+    const esp_timer_create_args_t timer_args = {
+        .callback = log_timer_cb,
+        .name = "lvgl_mem_log",
+    };
+    if (esp_timer_create(&timer_args, &s_log_timer) == ESP_OK) {
+        esp_timer_start_periodic(s_log_timer, LVGL_MEM_LOG_PERIOD_S * 1000000ULL);
+    }
+
+    ESP_LOGI(TAG, "LVGL pool: %d KB at %p", LVGL_MEM_POOL_KB, s_pool);
+}
+
+void lv_mem_deinit(void)
+{
+    if (s_log_timer) {
+        esp_timer_stop(s_log_timer);
+        esp_timer_delete(s_log_timer);
+        s_log_timer = NULL;
+    }
+    s_heap = NULL;
+    heap_caps_free(s_pool);
+    s_pool = NULL;
+}
+
+lv_mem_pool_t lv_mem_add_pool(void *mem, size_t bytes)
+{
+    // Single fixed pool, size it with LVGL_MEM_POOL_KB instead
+    return NULL;
+}
+
+void lv_mem_remove_pool(lv_mem_pool_t pool)
+{
+}
+
+void *lv_malloc_core(size_t size)
+{
+    if (s_heap == NULL) {
+        return NULL;
+    }
+
+    block_hdr_t *hdr = multi_heap_malloc(s_heap, size + HDR_SIZE);
+    if (hdr == NULL) {
+        account_failed();
+        return NULL;
+    }
+
+    hdr->size = size;
+    hdr->owner = s_current_owner;
+    hdr->magic = BLOCK_MAGIC;
+    account_alloc(hdr->owner, size);
+    return hdr + 1;
+}
+
+void *lv_realloc_core(void *p, size_t new_size)
+{
+    if (p == NULL) {
+        return lv_malloc_core(new_size);
+    }
+
+    block_hdr_t *hdr = (block_hdr_t *)p - 1;
+    size_t old_size = hdr->size;
+    int owner = hdr->owner;
+
+    // Label texts keep the owner of the widget that first allocated them
+    block_hdr_t *new_hdr = multi_heap_realloc(s_heap, hdr, new_size + HDR_SIZE);
+    if (new_hdr == NULL) {
+        account_failed();
+        return NULL;
+    }
+
+    new_hdr->size = new_size;
+    account_free(owner, old_size);
+    account_alloc(owner, new_size);
+    return new_hdr + 1;
+}
+
+void lv_free_core(void *p)
+{
+    if (p == NULL) {
+        return;
+    }
+
+    block_hdr_t *hdr = (block_hdr_t *)p - 1;
+    if (hdr->magic != BLOCK_MAGIC) {
+        ESP_LOGE(TAG, "Free of untagged block %p", p);
+        return;
+    }
+    account_free(hdr->owner, hdr->size);
+    hdr->magic = 0;
+    multi_heap_free(s_heap, hdr);
+}
+
+void lv_mem_monitor_core(lv_mem_monitor_t *mon_p)
+{
+    memset(mon_p, 0, sizeof(*mon_p));
+    if (s_heap == NULL) {
+        return;
+    }
+
+    multi_heap_info_t info;
+    multi_heap_get_info(s_heap, &info);
+
+    mon_p->total_size = LVGL_MEM_POOL_KB * 1024;
+    mon_p->free_size = info.total_free_bytes;
+    mon_p->free_biggest_size = info.largest_free_block;
+    mon_p->free_cnt = info.free_blocks;
+    mon_p->used_cnt = info.allocated_blocks;
+    mon_p->max_used = mon_p->total_size - info.minimum_free_bytes;
+    mon_p->used_pct = 100 - (100 * info.total_free_bytes) / mon_p->total_size;
+    mon_p->frag_pct = info.total_free_bytes ?
+        100 - (100 * info.largest_free_block) / info.total_free_bytes : 0;
+}
+
+lv_result_t lv_mem_test_core(void)
+{
+    if (s_heap == NULL || !multi_heap_check(s_heap, true)) {
+        return LV_RESULT_INVALID;
+    }
+    return LV_RESULT_OK;
+}
+
+/* Accounting API */
+
+int lvgl_mem_register_owner(const char *name)
+{
+    int id = -1;
+
+    taskENTER_CRITICAL(&s_stats_lock);
+    for (int i = 0; i < s_owner_count; i++) {
+        if (strcmp(s_owners[i].name, name) == 0) {
+            id = i;
+            break;
+        }
+    }
+    if (id < 0 && s_owner_count < LVGL_MEM_MAX_OWNERS) {
+        id = s_owner_count++;
+        s_owners[id].name = name;
+    }
+    taskEXIT_CRITICAL(&s_stats_lock);
+
+    if (id < 0) {
+        ESP_LOGW(TAG, "No free owner slot for '%s', using core", name);
+        id = LVGL_MEM_OWNER_CORE;
+    }
+    return id;
+}
+
+// Must be called with the LVGL lock held; returns the previous owner
+int lvgl_mem_set_owner(int owner)
+{
+    int prev = s_current_owner;
+    if (owner >= 0 && owner < s_owner_count) {
+        s_current_owner = owner;
+    }
+    return prev;
+}
+
+void lvgl_mem_get_stats(lvgl_mem_stats_t *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    stats->pool_bytes = LVGL_MEM_POOL_KB * 1024;
+    if (s_heap == NULL) {
+        return;
+    }
+
+    multi_heap_info_t info;
+    multi_heap_get_info(s_heap, &info);
+
+    stats->free_bytes = info.total_free_bytes;
+    stats->used_bytes = stats->pool_bytes - info.total_free_bytes;
+    stats->peak_bytes = stats->pool_bytes - info.minimum_free_bytes;
+    stats->largest_free = info.largest_free_block;
+    stats->frag_pct = info.total_free_bytes ?
+        100 - (100 * info.largest_free_block) / info.total_free_bytes : 0;
+
+    taskENTER_CRITICAL(&s_stats_lock);
+    stats->allocs = s_allocs;
+    stats->failed = s_failed;
+    taskEXIT_CRITICAL(&s_stats_lock);
+
+    size_t recommended = stats->peak_bytes * (100 + LVGL_MEM_HEADROOM_PCT) / 100;
+    stats->recommended_kb = (recommended + 1023) / 1024;
+}
+
+int lvgl_mem_get_owner_stats(lvgl_mem_owner_stats_t *owners, int max)
+{
+    taskENTER_CRITICAL(&s_stats_lock);
+    int count = s_owner_count < max ? s_owner_count : max;
+    memcpy(owners, s_owners, count * sizeof(*owners));
+    taskEXIT_CRITICAL(&s_stats_lock);
+    return count;
+}
+
+size_t lvgl_mem_owner_bytes(int owner)
+{
+    if (owner < 0 || owner >= LVGL_MEM_MAX_OWNERS) {
+        return 0;
+    }
+    taskENTER_CRITICAL(&s_stats_lock);
+    size_t bytes = s_owners[owner].cur_bytes;
+    taskEXIT_CRITICAL(&s_stats_lock);
+    return bytes;
+}
+
+void lvgl_mem_log_stats(void)
+{
+    lvgl_mem_stats_t stats;
+    lvgl_mem_get_stats(&stats);
+
+    float alloc_rate = 0;
+    int64_t now = esp_timer_get_time();
+    taskENTER_CRITICAL(&s_stats_lock);
+    if (now > s_last_sample_us) {
+        alloc_rate = (stats.allocs - s_last_allocs) * 1e6f / (now - s_last_sample_us);
+    }
+    s_last_allocs = stats.allocs;
+    s_last_sample_us = now;
+    taskEXIT_CRITICAL(&s_stats_lock);
+
+    ESP_LOGI(TAG, "Pool %u/%u B used, peak %u B, largest free %u B, frag %u%%",
+             stats.used_bytes, stats.pool_bytes, stats.peak_bytes, stats.largest_free,
+             stats.frag_pct);
+    ESP_LOGI(TAG, "%lu allocs (%.1f/s), %lu failed, recommended pool %u KB",
+             stats.allocs, alloc_rate, stats.failed, stats.recommended_kb);
+
+    lvgl_mem_owner_stats_t owners[LVGL_MEM_MAX_OWNERS];
+    int count = lvgl_mem_get_owner_stats(owners, LVGL_MEM_MAX_OWNERS);
+    for (int i = 0; i < count; i++) {
+        ESP_LOGI(TAG, "  %-10s %6u B (peak %6u B), %lu allocs, %lu frees", owners[i].name,
+                 owners[i].cur_bytes, owners[i].peak_bytes, owners[i].allocs, owners[i].frees);
+    }
+}
@@ -0,0 +1,90 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+// Power management: dynamic frequency scaling between POWER_CPU_MIN_MHZ and
+// POWER_CPU_MAX_MHZ and automatic light sleep whenever every task is
+// blocked. Subsystems hold a power lock only while they work, so the chip
+// sleeps between flushes, sensor reads and HTTP sessions. With
+// POWER_PM_ENABLE 0 the locks only measure, which gives the baseline to
+// compare the held times against.
+
+#define POWER_PM_ENABLE     1
+#define POWER_CPU_MAX_MHZ   240
+#define POWER_CPU_MIN_MHZ   80     // lowest that keeps APB, and so SPI/I2C/UART timing, at 80 MHz
+#define POWER_LIGHT_SLEEP   1      // needs CONFIG_FREERTOS_USE_TICKLESS_IDLE
+#define POWER_UART_WAKE_EDGES 3    // console RX edges that wake from light sleep
+
+/* Battery mode: the device wakes on the timer or a button, samples, fetches
+ * when due, updates the panel and returns to deep sleep. The shared data,
+ * the history and the time state live in RTC slow memory. */
+#define POWER_DEEP_SLEEP        0
+#define POWER_SLEEP_PERIOD_S    300
+#define POWER_WEATHER_EVERY     6       // cycles per weather fetch
+#define POWER_TIME_SYNC_EVERY   288     // cycles per SNTP sync, a day at 5 min
+#define POWER_AWAKE_MAX_MS      20000   // sleeps anyway, e.g. without an AP
+#define POWER_BUTTON_AWAKE_MS   30000   // awake time after a button wake
+#define POWER_WAKE_EXT0_GPIO    32      // the buttons, active low
+#define POWER_WAKE_EXT1_GPIO    33
+
+// Battery life projection
+#define POWER_BATTERY_MAH       2000
+#define POWER_AWAKE_MA          110     // Wi-Fi, panel and backlight on
+#define POWER_SLEEP_UA          400     // deep sleep, regulator and the SCD41 powered down
+
+typedef enum {
+    POWER_LOCK_DISPLAY,     // LVGL refresh, render and SPI flush
+    POWER_LOCK_SENSOR,      // SCD41 I2C transaction
+    POWER_LOCK_NET,         // HTTP session
+    POWER_LOCK_COUNT,
+} power_lock_id_t;
+
+typedef struct {
+    uint32_t count;
+    uint32_t max_us;
+    uint64_t held_us;
+} power_lock_stats_t;
+
+typedef struct {
+    bool pm_enabled;
+    bool light_sleep;
+    uint32_t light_sleeps;      // entries that actually slept
+    uint64_t sleep_us;          // time spent in light sleep
+    uint64_t uptime_us;
+    power_lock_stats_t locks[POWER_LOCK_COUNT];
+} power_stats_t;
+
+typedef enum {
+    POWER_WAKE_COLD,        // power on or reset
+    POWER_WAKE_TIMER,
+    POWER_WAKE_BUTTON,
+} power_wake_t;
+
+typedef struct {
+    uint32_t cycles;            // deep sleeps since power on
+    uint32_t button_wakes;
+    uint32_t last_awake_ms;
+    uint32_t max_awake_ms;
+    uint64_t awake_ms;          // totals over the cycles
+    uint64_t slept_ms;
+    float avg_ma;               // from the totals and the POWER_*_MA figures
+    float projected_days;       // on a full POWER_BATTERY_MAH
+} power_cycle_stats_t;
+
+esp_err_t power_init(void);
+// Keeps the chip out of light sleep while held, nestable. The display and
+// network locks also hold the CPU at POWER_CPU_MAX_MHZ
+void power_lock(power_lock_id_t id);
+void power_unlock(power_lock_id_t id);
+const char *power_lock_name(power_lock_id_t id);
+void power_get_stats(power_stats_t *stats);
+
+power_wake_t power_wake_cause(void);
+// True on the first cycle after power on and on every nth after that
+bool power_cycle_due(uint32_t every);
+// Accounts the cycle, arms the timer and button wakeups, never returns
+void power_deep_sleep(void);
+void power_get_cycle_stats(power_cycle_stats_t *stats);
+// Milliseconds since power on, counting through deep sleep in battery mode
+uint64_t power_clock_ms(void);
@@ -0,0 +1,247 @@
+/* Power management.
+ *
+ * esp_pm scales the CPU between POWER_CPU_MIN_MHZ and POWER_CPU_MAX_MHZ and,
+ * with tickless idle, enters light sleep once every task is blocked for a
+ * few ticks. The display and network locks ask for the full CPU frequency,
+ * the sensor lock only keeps the chip awake, the I2C driver raises the APB
+ * itself. Everything else runs at the minimum or sleeps.
+ *
+ * Each lock accounts how often and how long it is held, with or without
+ * POWER_PM_ENABLE, so the added latency of a subsystem shows up as the
+ * difference in held time between the two builds. The light sleep
+ * callbacks count the sleeps and the time slept; time per frequency comes
+ * from the esp_pm profiler, printed by the "power" command.
+ */
+#include "power.h"
+
+#include <stdio.h>
+
+#include "diagnostics.h"
+#include "driver/uart.h"
+#include "esp_log.h"
+#include "esp_pm.h"
+#include "esp_sleep.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+
+typedef struct {
+    const char *name;
+    esp_pm_lock_type_t type;
+    esp_pm_lock_handle_t handle;
+    int depth;
+    int64_t since_us;
+} power_lock_t;
+
+static const char *TAG = "power";
+
+#if CONFIG_FREERTOS_USE_TICKLESS_IDLE
+#define LIGHT_SLEEP POWER_LIGHT_SLEEP
+#else
+#define LIGHT_SLEEP 0   // esp_pm only sleeps from the tickless idle hook
+#endif
+
+static power_lock_t s_locks[POWER_LOCK_COUNT] = {
+    [POWER_LOCK_DISPLAY] = {.name = "display", .type = ESP_PM_CPU_FREQ_MAX},
+    [POWER_LOCK_SENSOR] = {.name = "sensor", .type = ESP_PM_NO_LIGHT_SLEEP},
+    [POWER_LOCK_NET] = {.name = "net", .type = ESP_PM_CPU_FREQ_MAX},
+};
+
+static power_stats_t s_stats;
+static portMUX_TYPE s_stats_lock = portMUX_INITIALIZER_UNLOCKED;
+static DRAM_ATTR portMUX_TYPE s_sleep_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Previous "power" command, for the wake rate since then
+static uint32_t s_cmd_sleeps = 0;
+static int64_t s_cmd_us = 0;
+
+void power_lock(power_lock_id_t id)
+{
+    power_lock_t *lock = &s_locks[id];
+
+    if (lock->handle) {
+        esp_pm_lock_acquire(lock->handle);
+    }
+    portENTER_CRITICAL(&s_stats_lock);
+    if (lock->depth++ == 0) {
+        lock->since_us = esp_timer_get_time();
+    }
+    portEXIT_CRITICAL(&s_stats_lock);
+}
+
+void power_unlock(power_lock_id_t id)
+{
+    power_lock_t *lock = &s_locks[id];
+    int64_t now = esp_timer_get_time();
+
+    portENTER_CRITICAL(&s_stats_lock);
+    if (lock->depth > 0 && --lock->depth == 0) {
+        power_lock_stats_t *st = &s_stats.locks[id];
+        uint32_t held = now - lock->since_us;
+        st->count++;
+        st->held_us += held;
+        st->max_us = held > st->max_us ? held : st->max_us;
+    }
+    portEXIT_CRITICAL(&s_stats_lock);
+    if (lock->handle) {
+        esp_pm_lock_release(lock->handle);
+    }
+}
+
+const char *power_lock_name(power_lock_id_t id)
+{
+    return id < POWER_LOCK_COUNT ? s_locks[id].name : "?";
+}
+
+void power_get_stats(power_stats_t *stats)
+{
+    portENTER_CRITICAL(&s_stats_lock);
+    *stats = s_stats;
+    portEXIT_CRITICAL(&s_stats_lock);
+
+    portENTER_CRITICAL(&s_sleep_lock);
+    stats->light_sleeps = s_stats.light_sleeps;
+    stats->sleep_us = s_stats.sleep_us;
+    portEXIT_CRITICAL(&s_sleep_lock);
+    stats->uptime_us = esp_timer_get_time();
+}
+
+#if CONFIG_PM_LIGHT_SLEEP_CALLBACKS
+// Runs inside the sleep path with the scheduler stopped, sleep_us is the
+// time actually slept
+static IRAM_ATTR esp_err_t sleep_exit_cb(int64_t sleep_us, void *arg)
+{
+    portENTER_CRITICAL_ISR(&s_sleep_lock);
+    s_stats.light_sleeps++;
+    s_stats.sleep_us += sleep_us;
+    portEXIT_CRITICAL_ISR(&s_sleep_lock);
+    return ESP_OK;
+}
+#endif
+
+static int power_cmd(int argc, char **argv)
+{
+    power_stats_t s;
+    power_get_stats(&s);
+
+    float elapsed_s = (s.uptime_us - s_cmd_us) / 1e6f;
+    printf("pm %s, %d-%d MHz, light sleep %s\n", s.pm_enabled ? "on" : "off",
+           POWER_CPU_MIN_MHZ, POWER_CPU_MAX_MHZ, s.light_sleep ? "on" : "off");
+    printf("sleeps %lu (%.1f/s since boot, %.1f/s since last), slept %llu ms (%.1f%%)\n",
+           (unsigned long)s.light_sleeps, s.light_sleeps / (s.uptime_us / 1e6f),
+           elapsed_s > 0 ? (s.light_sleeps - s_cmd_sleeps) / elapsed_s : 0.0f,
+           s.sleep_us / 1000, 100.0f * s.sleep_us / s.uptime_us);
+    s_cmd_sleeps = s.light_sleeps;
+    s_cmd_us = s.uptime_us;
+
+    printf("lock       count    avg us    max us\n");
+    for (int i = 0; i < POWER_LOCK_COUNT; i++) {
+        const power_lock_stats_t *l = &s.locks[i];
+        printf("%-8s %7lu %9llu %9lu\n", power_lock_name(i), (unsigned long)l->count,
+               l->count ? l->held_us / l->count : 0, (unsigned long)l->max_us);
+    }
+
+#if POWER_DEEP_SLEEP
+    power_cycle_stats_t c;
+    power_get_cycle_stats(&c);
+    printf("cycles %lu (%lu button), awake last %lu max %lu avg %llu ms, %.2f mA, "
+           "%.0f days on %d mAh\n",
+           (unsigned long)c.cycles, (unsigned long)c.button_wakes,
+           (unsigned long)c.last_awake_ms, (unsigned long)c.max_awake_ms,
+           c.cycles ? c.awake_ms / c.cycles : 0, c.avg_ma, c.projected_days, POWER_BATTERY_MAH);
+#endif
+
+#if CONFIG_PM_PROFILING
+    // Time in each mode, that is at each CPU/APB frequency, and per lock
+    esp_pm_dump_locks(stdout);
+#endif
+    return 0;
+}
+
+static void power_metrics(diag_writer_t *w)
+{
+    power_stats_t s;
+    power_get_stats(&s);
+    diag_printf(w, "power_pm_enabled %d\n", s.pm_enabled);
+    diag_printf(w, "power_light_sleeps_total %lu\n", (unsigned long)s.light_sleeps);
+    diag_printf(w, "power_light_sleep_us_total %llu\n", s.sleep_us);
+#if POWER_DEEP_SLEEP
+    power_cycle_stats_t c;
+    power_get_cycle_stats(&c);
+    diag_printf(w, "power_cycles_total %lu\n", (unsigned long)c.cycles);
+    diag_printf(w, "power_cycle_awake_ms_total %llu\n", c.awake_ms);
+    diag_printf(w, "power_cycle_awake_last_ms %lu\n", (unsigned long)c.last_awake_ms);
+    diag_printf(w, "power_projected_days %.1f\n", c.projected_days);
+#endif
+    for (int i = 0; i < POWER_LOCK_COUNT; i++) {
+        const power_lock_stats_t *l = &s.locks[i];
+        diag_printf(w, "power_lock_total{lock=\"%s\"} %lu\n", power_lock_name(i),
+                    (unsigned long)l->count);
+        diag_printf(w, "power_lock_held_us_total{lock=\"%s\"} %llu\n", power_lock_name(i),
+                    l->held_us);
+        diag_printf(w, "power_lock_held_max_us{lock=\"%s\"} %lu\n", power_lock_name(i),
+                    (unsigned long)l->max_us);
+    }
+}
+
+static esp_err_t configure_pm(void)
+{
+#if CONFIG_PM_ENABLE
+    esp_pm_config_t pm_config = {
+        .max_freq_mhz = POWER_CPU_MAX_MHZ,
+        .min_freq_mhz = POWER_CPU_MIN_MHZ,
+        .light_sleep_enable = LIGHT_SLEEP,
+    };
+    esp_err_t err = esp_pm_configure(&pm_config);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    for (int i = 0; i < POWER_LOCK_COUNT; i++) {
+        err = esp_pm_lock_create(s_locks[i].type, 0, s_locks[i].name, &s_locks[i].handle);
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+
+#if CONFIG_PM_LIGHT_SLEEP_CALLBACKS
+    esp_pm_sleep_cbs_register_config_t cbs = {
+        .exit_cb = sleep_exit_cb,
+    };
+    err = esp_pm_light_sleep_register_cbs(&cbs);
+    if (err != ESP_OK) {
+        return err;
+    }
+#endif
+
+#if CONFIG_ESP_CONSOLE_UART
+    // Typing at the console wakes the chip, the first characters are lost
+    uart_set_wakeup_threshold(CONFIG_ESP_CONSOLE_UART_NUM, POWER_UART_WAKE_EDGES);
+    esp_sleep_enable_uart_wakeup(CONFIG_ESP_CONSOLE_UART_NUM);
+#endif
+
+    s_stats.pm_enabled = true;
+    s_stats.light_sleep = pm_config.light_sleep_enable;
+    return ESP_OK;
+#else
+    ESP_LOGW(TAG, "CONFIG_PM_ENABLE is off, running at a fixed frequency");
+    return ESP_OK;
+#endif
+}
+
+esp_err_t power_init(void)
+{
+    if (POWER_PM_ENABLE) {
+        esp_err_t err = configure_pm();
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Power management setup failed: %s", esp_err_to_name(err));
+            return err;
+        }
+    }
+
+    ESP_LOGI(TAG, "PM %s, %d-%d MHz, light sleep %s", s_stats.pm_enabled ? "on" : "off",
+             POWER_CPU_MIN_MHZ, POWER_CPU_MAX_MHZ, s_stats.light_sleep ? "on" : "off");
+
+    diagnostics_register_command("power", "Light sleep, frequency and PM lock stats", power_cmd);
+    diagnostics_register_metrics("power", power_metrics);
+    return ESP_OK;
+}
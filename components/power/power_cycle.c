@@ -0,0 +1,126 @@
+/* Deep sleep duty cycle.
+ *
+ * Only RTC slow memory survives deep sleep, so the cycle bookkeeping lives
+ * there next to the application state. The time awake is taken from the
+ * RTC timer, which keeps counting through the sleep: after a timer wake it
+ * is the time since the last sleep entry minus the programmed period, so
+ * ROM and bootloader are included. A button wake has no known start and
+ * counts from app start instead.
+ *
+ * ext0 and ext1 are both level wakeups on RTC pins. ext1 can only wait for
+ * all of its pins low on the ESP32, so each button gets its own source.
+ */
+#include "power.h"
+
+#include "driver/rtc_io.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_rtc_time.h"
+#include "esp_sleep.h"
+#include "esp_timer.h"
+
+typedef struct {
+    uint32_t cycles;
+    uint32_t button_wakes;
+    uint64_t sleep_rtc_us;      // RTC time at the last sleep entry
+    uint32_t last_awake_ms;
+    uint32_t max_awake_ms;
+    uint64_t awake_ms;
+    uint64_t slept_ms;
+} cycle_state_t;
+
+static const char *TAG = "power_cycle";
+
+// Zeroed on power on and reset, kept through deep sleep
+static RTC_DATA_ATTR cycle_state_t s_cycle;
+
+power_wake_t power_wake_cause(void)
+{
+    switch (esp_sleep_get_wakeup_cause()) {
+    case ESP_SLEEP_WAKEUP_TIMER:
+        return POWER_WAKE_TIMER;
+    case ESP_SLEEP_WAKEUP_EXT0:
+    case ESP_SLEEP_WAKEUP_EXT1:
+        return POWER_WAKE_BUTTON;
+    default:
+        return POWER_WAKE_COLD;
+    }
+}
+
+bool power_cycle_due(uint32_t every)
+{
+    return every == 0 || s_cycle.cycles % every == 0;
+}
+
+uint64_t power_clock_ms(void)
+{
+#if POWER_DEEP_SLEEP
+    return esp_rtc_get_time_us() / 1000;
+#else
+    return esp_timer_get_time() / 1000;
+#endif
+}
+
+void power_get_cycle_stats(power_cycle_stats_t *stats)
+{
+    *stats = (power_cycle_stats_t){
+        .cycles = s_cycle.cycles,
+        .button_wakes = s_cycle.button_wakes,
+        .last_awake_ms = s_cycle.last_awake_ms,
+        .max_awake_ms = s_cycle.max_awake_ms,
+        .awake_ms = s_cycle.awake_ms,
+        .slept_ms = s_cycle.slept_ms,
+    };
+
+    // Until a full cycle was measured, assume the nominal period
+    uint64_t awake = s_cycle.awake_ms ? s_cycle.awake_ms : 1;
+    uint64_t slept = s_cycle.slept_ms ? s_cycle.slept_ms : POWER_SLEEP_PERIOD_S * 1000ULL;
+    stats->avg_ma = (awake * (float)POWER_AWAKE_MA + slept * (POWER_SLEEP_UA / 1000.0f)) /
+                    (awake + slept);
+    stats->projected_days = POWER_BATTERY_MAH / stats->avg_ma / 24.0f;
+}
+
+static void arm_wakeups(void)
+{
+    esp_sleep_enable_timer_wakeup(POWER_SLEEP_PERIOD_S * 1000000ULL);
+
+    // The internal pull-ups need the RTC peripherals powered in sleep
+    const gpio_num_t pins[] = {POWER_WAKE_EXT0_GPIO, POWER_WAKE_EXT1_GPIO};
+    for (int i = 0; i < sizeof(pins) / sizeof(pins[0]); i++) {
+        rtc_gpio_pullup_en(pins[i]);
+        rtc_gpio_pulldown_dis(pins[i]);
+    }
+    esp_sleep_pd_config(ESP_PD_DOMAIN_RTC_PERIPH, ESP_PD_OPTION_ON);
+    esp_sleep_enable_ext0_wakeup(POWER_WAKE_EXT0_GPIO, 0);
+    esp_sleep_enable_ext1_wakeup_io(1ULL << POWER_WAKE_EXT1_GPIO, ESP_EXT1_WAKEUP_ALL_LOW);
+}
+
+void power_deep_sleep(void)
+{
+    uint64_t now = esp_rtc_get_time_us();
+    uint64_t period_us = POWER_SLEEP_PERIOD_S * 1000000ULL;
+    power_wake_t wake = power_wake_cause();
+
+    uint32_t awake_ms = esp_timer_get_time() / 1000;
+    if (wake == POWER_WAKE_TIMER && now - s_cycle.sleep_rtc_us > period_us) {
+        awake_ms = (now - s_cycle.sleep_rtc_us - period_us) / 1000;
+    }
+    if (wake != POWER_WAKE_COLD) {
+        s_cycle.slept_ms += (now - s_cycle.sleep_rtc_us) / 1000 - awake_ms;
+    }
+    s_cycle.button_wakes += wake == POWER_WAKE_BUTTON;
+    s_cycle.awake_ms += awake_ms;
+    s_cycle.last_awake_ms = awake_ms;
+    s_cycle.max_awake_ms = awake_ms > s_cycle.max_awake_ms ? awake_ms : s_cycle.max_awake_ms;
+    s_cycle.cycles++;
+    s_cycle.sleep_rtc_us = now;
+
+    power_cycle_stats_t s;
+    power_get_cycle_stats(&s);
+    ESP_LOGI(TAG, "Cycle %lu: awake %lu ms (max %lu), avg %.2f mA, %.0f days on %d mAh",
+             (unsigned long)s.cycles, (unsigned long)awake_ms, (unsigned long)s.max_awake_ms,
+             s.avg_ma, s.projected_days, POWER_BATTERY_MAH);
+
+    arm_wakeups();
+    esp_deep_sleep_start();
+}
@@ -0,0 +1,52 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "lvgl.h"
+
+#define SCREEN_MANAGER_MAX_SCREENS  8
+#define SCREEN_MANAGER_RAM_BUDGET   (24 * 1024)   // bytes of LVGL pool for built screens
+
+// Screen flags
+#define SCREEN_FLAG_CYCLE   (1 << 0)    // reachable with screen_manager_show_next()
+#define SCREEN_FLAG_PINNED  (1 << 1)    // never evicted once built
+#define SCREEN_FLAG_IDLE_COLORS (1 << 2) // still readable in the panel's 8-colour idle mode
+
+typedef struct {
+    const char *name;
+    uint32_t flags;
+    uint32_t bindings;                          // data event bits the screen shows
+    uint16_t content_y1, content_y2;            // rows in use, 0/0 for the whole panel
+    lv_obj_t *(*build)(void);                   // required, called with the LVGL lock held
+    void (*show)(lv_obj_t *screen);             // optional
+    void (*hide)(lv_obj_t *screen);             // optional
+    void (*destroy)(lv_obj_t *screen);          // optional, before the object is deleted
+    void (*update)(lv_obj_t *screen, uint32_t bits);
+    // Optional: invalidates what update() shows for bits, whether or not the
+    // value changed. For widgets that skip unchanged values, after an update
+    // made with invalidation off
+    void (*redraw)(lv_obj_t *screen, uint32_t bits);
+} screen_desc_t;
+
+typedef struct {
+    const char *name;
+    bool built;
+    bool visible;
+    uint32_t builds;
+    uint32_t evictions;
+    size_t ram_bytes;
+} screen_stats_t;
+
+// Called with the LVGL lock held whenever another screen is loaded
+typedef void (*screen_show_hook_t)(const screen_desc_t *desc);
+
+int screen_manager_register(const screen_desc_t *desc);
+void screen_manager_set_show_hook(screen_show_hook_t hook);
+esp_err_t screen_manager_show(int id);
+esp_err_t screen_manager_show_next(void);
+int screen_manager_peek_next(void);     // id show_next() would load, -1 if none
+void screen_manager_update(uint32_t bits);
+void screen_manager_redraw(uint32_t bits);
+int screen_manager_current(void);
+const screen_desc_t *screen_manager_get_desc(int id);
+int screen_manager_get_stats(screen_stats_t *stats, int max);
@@ -0,0 +1,224 @@
+#include "screen_manager.h"
+
+#include "esp_log.h"
+#include "esp_lvgl_port.h"
+#include "lvgl_mem.h"
+
+typedef struct {
+    const screen_desc_t *desc;
+    lv_obj_t *screen;
+    int mem_owner;
+    uint32_t last_used;
+    uint32_t builds;
+    uint32_t evictions;
+} screen_slot_t;
+
+static const char *TAG = "screen_manager";
+
+static screen_slot_t s_slots[SCREEN_MANAGER_MAX_SCREENS];
+static int s_count = 0;
+static int s_current = -1;
+static uint32_t s_use_seq = 0;
+static screen_show_hook_t s_show_hook = NULL;
+
+int screen_manager_register(const screen_desc_t *desc)
+{
+    if (s_count >= SCREEN_MANAGER_MAX_SCREENS || desc->build == NULL) {
+        ESP_LOGE(TAG, "Cannot register screen '%s'", desc->name);
+        return -1;
+    }
+
+    screen_slot_t *slot = &s_slots[s_count];
+    slot->desc = desc;
+    slot->screen = NULL;
+    slot->mem_owner = lvgl_mem_register_owner(desc->name);
+
+    ESP_LOGI(TAG, "Registered screen %d '%s'", s_count, desc->name);
+    return s_count++;
+}
+
+void screen_manager_set_show_hook(screen_show_hook_t hook)
+{
+    s_show_hook = hook;
+}
+
+// Called with the LVGL lock held
+static bool build_slot(screen_slot_t *slot)
+{
+    int prev_owner = lvgl_mem_set_owner(slot->mem_owner);
+    slot->screen = slot->desc->build();
+    lvgl_mem_set_owner(prev_owner);
+
+    if (slot->screen == NULL) {
+        ESP_LOGE(TAG, "Failed to build screen '%s'", slot->desc->name);
+        return false;
+    }
+    slot->builds++;
+    ESP_LOGI(TAG, "Built '%s' (%u B)", slot->desc->name,
+             (unsigned)lvgl_mem_owner_bytes(slot->mem_owner));
+    return true;
+}
+
+static void destroy_slot(screen_slot_t *slot)
+{
+    if (slot->desc->destroy) {
+        slot->desc->destroy(slot->screen);
+    }
+    lv_obj_delete(slot->screen);
+    slot->screen = NULL;
+    slot->evictions++;
+    ESP_LOGI(TAG, "Evicted '%s'", slot->desc->name);
+}
+
+// Drop least recently used screens until the built set fits the budget
+static void enforce_budget(void)
+{
+    while (1) {
+        size_t total = 0;
+        screen_slot_t *lru = NULL;
+
+        for (int i = 0; i < s_count; i++) {
+            screen_slot_t *slot = &s_slots[i];
+            if (slot->screen == NULL) {
+                continue;
+            }
+            total += lvgl_mem_owner_bytes(slot->mem_owner);
+            if (i == s_current || (slot->desc->flags & SCREEN_FLAG_PINNED)) {
+                continue;
+            }
+            if (lru == NULL || slot->last_used < lru->last_used) {
+                lru = slot;
+            }
+        }
+
+        if (total <= SCREEN_MANAGER_RAM_BUDGET || lru == NULL) {
+            return;
+        }
+        destroy_slot(lru);
+    }
+}
+
+esp_err_t screen_manager_show(int id)
+{
+    if (id < 0 || id >= s_count) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!lvgl_port_lock(0)) {
+        return ESP_ERR_TIMEOUT;
+    }
+
+    screen_slot_t *slot = &s_slots[id];
+    if (slot->screen == NULL && !build_slot(slot)) {
+        lvgl_port_unlock();
+        return ESP_FAIL;
+    }
+
+    // Bring the bound values up to date, updates were skipped while hidden
+    if (slot->desc->update) {
+        slot->desc->update(slot->screen, slot->desc->bindings);
+    }
+
+    if (s_current >= 0 && s_current != id) {
+        screen_slot_t *prev = &s_slots[s_current];
+        if (prev->desc->hide && prev->screen) {
+            prev->desc->hide(prev->screen);
+        }
+    }
+
+    if (s_show_hook && s_current != id) {
+        s_show_hook(slot->desc);
+    }
+    lv_screen_load(slot->screen);
+    if (slot->desc->show) {
+        slot->desc->show(slot->screen);
+    }
+    s_current = id;
+    slot->last_used = ++s_use_seq;
+
+    enforce_budget();
+    lvgl_port_unlock();
+
+    ESP_LOGI(TAG, "Showing '%s'", slot->desc->name);
+    return ESP_OK;
+}
+
+int screen_manager_peek_next(void)
+{
+    for (int step = 1; step <= s_count; step++) {
+        int id = (s_current + step) % s_count;
+        if (s_slots[id].desc->flags & SCREEN_FLAG_CYCLE) {
+            return id;
+        }
+    }
+    return -1;
+}
+
+esp_err_t screen_manager_show_next(void)
+{
+    int id = screen_manager_peek_next();
+    return id >= 0 ? screen_manager_show(id) : ESP_ERR_NOT_FOUND;
+}
+
+void screen_manager_update(uint32_t bits)
+{
+    if (s_current < 0) {
+        return;
+    }
+
+    screen_slot_t *slot = &s_slots[s_current];
+    uint32_t relevant = bits & slot->desc->bindings;
+    if (relevant == 0 || slot->desc->update == NULL) {
+        return;
+    }
+
+    if (lvgl_port_lock(0)) {
+        if (slot->screen) {
+            slot->desc->update(slot->screen, relevant);
+        }
+        lvgl_port_unlock();
+    }
+}
+
+void screen_manager_redraw(uint32_t bits)
+{
+    if (s_current < 0) {
+        return;
+    }
+
+    screen_slot_t *slot = &s_slots[s_current];
+    uint32_t relevant = bits & slot->desc->bindings;
+    if (relevant == 0 || slot->desc->redraw == NULL) {
+        return;
+    }
+
+    if (lvgl_port_lock(0)) {
+        if (slot->screen) {
+            slot->desc->redraw(slot->screen, relevant);
+        }
+        lvgl_port_unlock();
+    }
+}
+
+int screen_manager_current(void)
+{
+    return s_current;
+}
+
+const screen_desc_t *screen_manager_get_desc(int id)
+{
+    return (id >= 0 && id < s_count) ? s_slots[id].desc : NULL;
+}
+
+int screen_manager_get_stats(screen_stats_t *stats, int max)
+{
+    int count = s_count < max ? s_count : max;
+    for (int i = 0; i < count; i++) {
+        stats[i].name = s_slots[i].desc->name;
+        stats[i].built = s_slots[i].screen != NULL;
+        stats[i].visible = (i == s_current);
+        stats[i].builds = s_slots[i].builds;
+        stats[i].evictions = s_slots[i].evictions;
+        stats[i].ram_bytes = lvgl_mem_owner_bytes(s_slots[i].mem_owner);
+    }
+    return count;
+}
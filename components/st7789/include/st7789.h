@@ -3,8 +3,6 @@
 
 #define LCD_HOST           SPI2_HOST
 #define LCD_PIXEL_CLK_HZ   (40 * 1000 * 1000)
-#define LCD_BK_LIGHT_ON    1
-#define LCD_BK_LIGHT_OFF   0
 
 #define PIN_NUM_MOSI       23
 #define PIN_NUM_CLK        18
@@ -24,36 +22,107 @@
 #define LV_DISP_ROT_270    3
 
 // LVGL settings
-#define LVGL_TICK_PERIOD_MS 2
+#define LVGL_TICK_PERIOD_MS 1000 // port tick timer, unused: lv_tick reads esp_timer instead
 #define LVGL_BUFFER_HEIGHT  50
+#define LVGL_RENDER_CORE    1   // LVGL task, the draw threads float on both cores
+#define LCD_FLUSH_ISR_CORE  0   // SPI done interrupt that completes a flush
+#define LCD_BENCHMARK_FRAMES 20 // full-screen redraws timed at boot, 0 disables
+
+// Indexed rendering: LVGL draws palette indexes into an L8 band and the
+// flush expands them to RGB565 through a LUT into small DMA bounce buffers.
+// Needs much less DMA RAM, so the band can be taller.
+#define LCD_INDEXED_MODE        0
+#define LCD_INDEXED_BAND_HEIGHT 100
+#define LCD_BOUNCE_LINES        10
+
+// Static screens switch the panel to partial/idle mode after this long
+// without any redraw, see lcd_mode.c
+#define LCD_MODE_ENTER_MS       3000
+
+// RGB565 byte order: the ST7789 expects big-endian pixels on SPI while LVGL
+// stores them little-endian. By default RAMCTRL puts the panel in
+// little-endian mode and buffers are sent untouched; LCD_SWAP_BYTES falls
+// back to swapping every band in software for panels that ignore it.
+#define LCD_SWAP_BYTES 0
+
+// The next screen is rendered ahead into a run-length encoded cache and
+// streamed to the panel on a button press, see lcd_prerender.c. Band lines
+// must be even, the halves double as bounce buffers when streaming.
+#define LCD_PRERENDER                 1
+#define LCD_PRERENDER_CACHE_KB        24
+#define LCD_PRERENDER_BAND_LINES      20
+#define LCD_PRERENDER_MIN_INTERVAL_MS 2000 // re-render rate limit on new data
+
+// Frame profiler on the display events, exported to the console ("display")
+// and /metrics, see lcd_profiler.c. The overlay is a small label in the top
+// layer; its own once-a-second redraw shows up in the numbers.
+#define LCD_PROFILER         1
+#define LCD_PROFILER_OVERLAY 0
+#define LCD_PROFILE_BUCKETS  8 // render/flush time histogram, see lcd_profiler.c
+
+// Font pack font for localised text, see components/font_pack
+#define UI_CJK_FONT "jp20"
 
 // LVGL colors
-#define COLOR_DARK_PURPLE lv_color_make(30, 15, 39)
-#define COLOR_WHITE lv_color_make(31, 31, 63)
-#define COLOR_ORANGE lv_color_make(0, 27, 35)
-#define COLOR_BLACK lv_color_make(0, 0, 0)
-#define COLOR_PINK lv_color_make(15, 31, 30)
-#define COLOR_GREEN lv_color_make(7, 7, 30)
-#define COLOR_CYAN lv_color_make(31, 0, 63)
-
-extern lv_obj_t *label_co2;
-extern lv_obj_t *label_temp;
-extern lv_obj_t *label_humid;
-extern lv_obj_t *label_time;
-extern lv_obj_t *label_info;
-extern lv_obj_t *label_date;
-extern lv_obj_t *label_out_temp;
-extern lv_obj_t *label_out_feels;
-extern lv_obj_t *label_out_humidity;
-extern lv_obj_t *label_out_cond;
-extern lv_obj_t *label_out_wind;
-
-extern lv_obj_t *screen_sensor;
-extern lv_obj_t *screen_info;
-extern lv_obj_t *screen_weather;
-
-void create_sensor_screen();
-void create_info_screen();
+#define COLOR_DARK_PURPLE lv_color_hex(0x6281C5)
+#define COLOR_WHITE lv_color_hex(0xE6E2C5)
+#define COLOR_ORANGE lv_color_hex(0xC58100)
+#define COLOR_BLACK lv_color_hex(0x000000)
+#define COLOR_PINK lv_color_hex(0xE66141)
+#define COLOR_GREEN lv_color_hex(0x206100)
+#define COLOR_CYAN lv_color_hex(0x00E2C5)
+
+// Screen ids, in screen_manager registration order
+enum {
+  SCREEN_INFO,
+  SCREEN_SENSOR,
+  SCREEN_WEATHER,
+  SCREEN_HISTORY,
+  SCREEN_DIAG,
+};
+
+typedef struct {
+  uint32_t flushes;
+  uint64_t pixels;
+  int64_t expand_us; // time spent in the L8 -> RGB565 expansion
+} lcd_flush_stats_t;
+
+typedef struct {
+  uint32_t transitions;
+  uint64_t normal_ms;
+  uint64_t partial_ms; // partial mode, full colour
+  uint64_t idle_ms;    // idle mode, with or without partial mode
+} lcd_mode_stats_t;
+
+typedef struct {
+  uint32_t frames; // refreshes that flushed anything
+  uint64_t render_us;
+  uint64_t flush_us; // LVGL blocked in flush_cb or waiting for the SPI
+  uint32_t render_max_us;
+  uint32_t flush_max_us;
+  uint64_t bytes; // RGB565 pixel data sent to the panel
+  uint32_t bytes_max;
+  uint32_t areas; // invalidated areas, before LVGL joins them
+  uint32_t areas_max;
+  uint32_t render_hist[LCD_PROFILE_BUCKETS];
+  uint32_t flush_hist[LCD_PROFILE_BUCKETS];
+} lcd_profile_stats_t;
+
+void init_lcd(int rotation);
+void lcd_mode_set_caps(bool idle_ok, int content_y1, int content_y2);
+void lcd_mode_get_stats(lcd_mode_stats_t *stats);
+void lcd_get_flush_stats(lcd_flush_stats_t *stats);
+void lcd_benchmark(int frames);
+// Pushes the pending frame, then backlight off and the panel to sleep
+void lcd_sleep(void);
+void lcd_profiler_get_stats(lcd_profile_stats_t *stats);
+void lcd_profiler_reset(void);
+void lcd_prerender_update(uint32_t bits);
+bool lcd_prerender_show_next(int64_t press_us);
+void lcd_latency_track(int64_t press_us);
 void init_start_screen(void);
 void check_modules_state(void);
-void create_weather_screen();
+
+// Window of the history chart, a sensor_history_window_t
+void history_screen_set_window(int window);
+void history_screen_next_window(void);
@@ -0,0 +1,97 @@
+#include <stdint.h>
+
+#include "lvgl.h"
+
+// Palette of every colour the UI uses, indexes map to the COLOR_* values
+typedef enum {
+  UI_COLOR_BLACK,
+  UI_COLOR_WHITE,
+  UI_COLOR_ORANGE,
+  UI_COLOR_DARK_PURPLE,
+  UI_COLOR_PINK,
+  UI_COLOR_GREEN,
+  UI_COLOR_CYAN,
+  UI_COLOR_COUNT,
+} ui_color_t;
+
+// Grey level that stands for a palette entry in indexed (L8) rendering. No
+// blend of two levels at a 4 bpp glyph alpha lands on a third, so the flush
+// can tell glyph edges from palette pixels
+extern const uint8_t ui_index_levels[UI_COLOR_COUNT];
+#define UI_INDEX_LEVEL(color) (ui_index_levels[(color)])
+
+typedef enum {
+  UI_WIDGET_LABEL,
+  UI_WIDGET_LINE,
+  UI_WIDGET_CHART,
+  UI_WIDGET_SEGMENT,
+} ui_widget_type_t;
+
+#define UI_NO_BINDING -1
+
+// One widget of a layout table; tables are const and stay in flash
+typedef struct {
+  uint8_t type;    // ui_widget_type_t
+  uint8_t color;   // ui_color_t
+  int8_t binding;  // slot in the binding table, UI_NO_BINDING if static
+  int16_t x;
+  int16_t y;
+  const lv_font_t *font;        // label
+  const char *text;             // label and segment, initial text
+  lv_point_precise_t points[2]; // line, relative to x/y; chart, {0, 0}-{w, h};
+                                // segment, {0, 0}-{0, h}
+} ui_widget_t;
+
+typedef struct {
+  uint8_t background; // ui_color_t
+  uint8_t binding_count;
+  uint16_t widget_count;
+  const ui_widget_t *widgets;
+} ui_layout_t;
+
+#define UI_LABEL(_font, _color, _x, _y, _text, _binding)                       \
+  {.type = UI_WIDGET_LABEL,                                                    \
+   .color = (_color),                                                          \
+   .binding = (_binding),                                                      \
+   .x = (_x),                                                                  \
+   .y = (_y),                                                                  \
+   .font = (_font),                                                            \
+   .text = (_text)}
+
+#define UI_LINE(_color, _x, _y, _w, _h)                                        \
+  {.type = UI_WIDGET_LINE,                                                     \
+   .color = (_color),                                                          \
+   .binding = UI_NO_BINDING,                                                   \
+   .x = (_x),                                                                  \
+   .y = (_y),                                                                  \
+   .points = {{0, 0}, {(_w), (_h)}}}
+
+// Empty line chart, series and point count are set up by the screen
+#define UI_CHART(_color, _x, _y, _w, _h, _binding)                             \
+  {.type = UI_WIDGET_CHART,                                                    \
+   .color = (_color),                                                          \
+   .binding = (_binding),                                                      \
+   .x = (_x),                                                                  \
+   .y = (_y),                                                                  \
+   .points = {{0, 0}, {(_w), (_h)}}}
+
+// Seven-segment readout, see ui_segment.h
+#define UI_SEGMENT(_color, _x, _y, _height, _text, _binding)                   \
+  {.type = UI_WIDGET_SEGMENT,                                                  \
+   .color = (_color),                                                          \
+   .binding = (_binding),                                                      \
+   .x = (_x),                                                                  \
+   .y = (_y),                                                                  \
+   .text = (_text),                                                            \
+   .points = {{0, 0}, {0, (_height)}}}
+
+#define UI_LAYOUT(_bg, _widgets, _binding_count)                               \
+  {.background = (_bg),                                                        \
+   .binding_count = (_binding_count),                                          \
+   .widget_count = sizeof(_widgets) / sizeof((_widgets)[0]),                   \
+   .widgets = (_widgets)}
+
+lv_color_t ui_palette_color(ui_color_t color);
+lv_color_t ui_color(ui_color_t color);
+lv_obj_t *ui_layout_build(const ui_layout_t *layout);
+lv_obj_t **ui_layout_bindings(lv_obj_t *screen);
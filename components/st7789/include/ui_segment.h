@@ -0,0 +1,16 @@
+#include <stdint.h>
+
+#include "lvgl.h"
+
+// Seven-segment numeric readout drawn from rounded bars, no glyph bitmaps.
+// Shows 0-9, '-', ' ', ':' and '.' at any height; the width follows the
+// text. Changing the text only invalidates the segments that toggled.
+
+#define UI_SEGMENT_MAX_CELLS 8
+
+lv_obj_t *ui_segment_create(lv_obj_t *parent, int32_t height);
+void ui_segment_set_text(lv_obj_t *obj, const char *text);
+// Redraws every segment of the current text, for a readout whose last
+// change was made with invalidation off and so never reached the panel
+void ui_segment_invalidate(lv_obj_t *obj);
+int32_t ui_segment_text_width(int32_t height, const char *text);
@@ -0,0 +1,203 @@
+#include "lcd_indexed.h"
+
+#include <stdlib.h>
+
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "st7789.h"
+#include "ui_layout.h"
+
+#if LCD_INDEXED_MODE
+
+#define BOUNCE_COUNT 2
+#define BOUNCE_PIXELS (LCD_H_RES * LCD_BOUNCE_LINES)
+
+static const char *TAG = "lcd_indexed";
+
+static esp_lcd_panel_handle_t s_panel = NULL;
+static uint16_t s_lut[256];
+static bool s_exact[256]; // level of a palette entry, not a blend
+static uint16_t *s_bounce[BOUNCE_COUNT];
+static int s_next_bounce = 0;
+static SemaphoreHandle_t s_bounce_free = NULL;
+
+static lcd_flush_stats_t s_stats;
+
+// L8 level -> RGB565 of the nearest palette entry, for the blends that
+// snap_edges() could not resolve. A byte swap, if the panel needs one, is
+// folded into the table for free.
+static void build_lut(void) {
+  for (int color = 0; color < UI_COLOR_COUNT; color++) {
+    s_exact[UI_INDEX_LEVEL(color)] = true;
+  }
+  for (int level = 0; level < 256; level++) {
+    int index = 0;
+    for (int color = 1; color < UI_COLOR_COUNT; color++) {
+      if (abs(UI_INDEX_LEVEL(color) - level) <
+          abs(UI_INDEX_LEVEL(index) - level)) {
+        index = color;
+      }
+    }
+    uint16_t px = lv_color_to_u16(ui_palette_color(index));
+    s_lut[level] = LCD_SWAP_BYTES ? (uint16_t)((px << 8) | (px >> 8)) : px;
+  }
+}
+
+// Antialiasing off does not reach glyph alpha: the edges of 4 bpp fonts
+// blend the text and background levels into one between them, which the
+// LUT alone would map to an unrelated palette entry. The levels are chosen
+// so that a blend is never exact, and a blend is nearer to the colour that
+// weighs more in it, so each edge pixel takes the nearest exact level among
+// its four neighbours; left and above are already snapped. Without an
+// exact neighbour the LUT decides.
+static void snap_edges(uint8_t *px, int32_t width, int32_t lines) {
+  for (int32_t y = 0; y < lines; y++) {
+    uint8_t *row = px + y * width;
+    for (int32_t x = 0; x < width; x++) {
+      uint8_t level = row[x];
+      if (s_exact[level]) {
+        continue;
+      }
+
+      int best = -1, best_dist = 256;
+      const int n[4] = {
+          x > 0 ? row[x - 1] : -1,
+          y > 0 ? row[x - width] : -1,
+          x + 1 < width ? row[x + 1] : -1,
+          y + 1 < lines ? row[x + width] : -1,
+      };
+      for (int i = 0; i < 4; i++) {
+        if (n[i] >= 0 && s_exact[n[i]] && abs(n[i] - level) < best_dist) {
+          best = n[i];
+          best_dist = abs(n[i] - level);
+        }
+      }
+      if (best >= 0) {
+        row[x] = best;
+      }
+    }
+  }
+}
+
+// Four indexes per load, two RGB565 pixels per store
+static void expand(uint16_t *dst, const uint8_t *src, uint32_t count) {
+  const uint32_t *src32 = (const uint32_t *)src;
+  uint32_t *dst32 = (uint32_t *)dst;
+  uint32_t words = count / 4;
+
+  for (uint32_t i = 0; i < words; i++) {
+    uint32_t s = *src32++;
+    dst32[0] = s_lut[s & 0xff] | ((uint32_t)s_lut[(s >> 8) & 0xff] << 16);
+    dst32[1] = s_lut[(s >> 16) & 0xff] | ((uint32_t)s_lut[s >> 24] << 16);
+    dst32 += 2;
+  }
+
+  for (uint32_t i = words * 4; i < count; i++) {
+    dst[i] = s_lut[src[i]];
+  }
+}
+
+static bool bounce_done_cb(esp_lcd_panel_io_handle_t io,
+                           esp_lcd_panel_io_event_data_t *edata,
+                           void *user_ctx) {
+  BaseType_t woken = pdFALSE;
+  xSemaphoreGiveFromISR(s_bounce_free, &woken);
+  return woken == pdTRUE;
+}
+
+// Expands the band chunk by chunk into the bounce buffers. The L8 band is
+// no longer needed once the last chunk is expanded, so LVGL gets the buffer
+// back before the SPI transfers finish.
+static void flush_cb(lv_display_t *disp, const lv_area_t *area,
+                     uint8_t *px_map) {
+  int32_t width = lv_area_get_width(area);
+  int32_t chunk_lines = BOUNCE_PIXELS / width;
+  if (width % 4) {
+    // Keep every chunk word aligned in the band for expand()
+    chunk_lines &= ~3;
+  }
+  int64_t expand_us = 0;
+
+  for (int32_t y = area->y1; y <= area->y2; y += chunk_lines) {
+    int32_t lines = LV_MIN(chunk_lines, area->y2 - y + 1);
+    uint16_t *bounce = s_bounce[s_next_bounce];
+    s_next_bounce = (s_next_bounce + 1) % BOUNCE_COUNT;
+
+    xSemaphoreTake(s_bounce_free, portMAX_DELAY);
+
+    int64_t start = esp_timer_get_time();
+    snap_edges(px_map, width, lines);
+    expand(bounce, px_map, width * lines);
+    expand_us += esp_timer_get_time() - start;
+
+    esp_lcd_panel_draw_bitmap(s_panel, area->x1, y, area->x2 + 1, y + lines,
+                              bounce);
+    px_map += width * lines;
+  }
+
+  s_stats.flushes++;
+  s_stats.pixels += lv_area_get_size(area);
+  s_stats.expand_us += expand_us;
+  lv_display_flush_ready(disp);
+}
+
+lv_display_t *lcd_indexed_create(esp_lcd_panel_io_handle_t io_handle,
+                                 esp_lcd_panel_handle_t panel_handle) {
+  size_t band_bytes = LCD_H_RES * LCD_INDEXED_BAND_HEIGHT;
+  size_t bounce_bytes = BOUNCE_PIXELS * sizeof(uint16_t);
+
+  // Only the bounce buffers have to be DMA capable
+  uint8_t *band = heap_caps_malloc(band_bytes, MALLOC_CAP_INTERNAL |
+                                                   MALLOC_CAP_32BIT);
+  for (int i = 0; i < BOUNCE_COUNT; i++) {
+    s_bounce[i] = heap_caps_malloc(bounce_bytes, MALLOC_CAP_DMA);
+  }
+  s_bounce_free = xSemaphoreCreateCounting(BOUNCE_COUNT, BOUNCE_COUNT);
+  if (band == NULL || s_bounce[0] == NULL || s_bounce[1] == NULL ||
+      s_bounce_free == NULL) {
+    ESP_LOGE(TAG, "Failed to allocate indexed buffers");
+    return NULL;
+  }
+
+  s_panel = panel_handle;
+  build_lut();
+
+  const esp_lcd_panel_io_callbacks_t cbs = {
+      .on_color_trans_done = bounce_done_cb,
+  };
+  ESP_ERROR_CHECK(esp_lcd_panel_io_register_event_callbacks(io_handle, &cbs,
+                                                            NULL));
+
+  lv_display_t *disp = NULL;
+  if (lvgl_port_lock(0)) {
+    disp = lv_display_create(LCD_H_RES, LCD_V_RES);
+    lv_display_set_color_format(disp, LV_COLOR_FORMAT_L8);
+    lv_display_set_buffers(disp, band, NULL, band_bytes,
+                           LV_DISPLAY_RENDER_MODE_PARTIAL);
+    lv_display_set_flush_cb(disp, flush_cb);
+    // Blended shape edges would land between palette levels, glyph edges
+    // still do and are snapped in the flush
+    lv_display_set_antialiasing(disp, false);
+    lvgl_port_unlock();
+  }
+
+  ESP_LOGI(TAG,
+           "Indexed mode: %u B band + %u B DMA bounce, RGB565 double "
+           "buffers would take %u B DMA",
+           (unsigned)band_bytes, (unsigned)(BOUNCE_COUNT * bounce_bytes),
+           (unsigned)(2 * LCD_H_RES * LVGL_BUFFER_HEIGHT * sizeof(uint16_t)));
+  return disp;
+}
+
+void lcd_get_flush_stats(lcd_flush_stats_t *stats) { *stats = s_stats; }
+
+#else
+
+void lcd_get_flush_stats(lcd_flush_stats_t *stats) {
+  *stats = (lcd_flush_stats_t){0};
+}
+
+#endif
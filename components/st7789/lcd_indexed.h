@@ -0,0 +1,7 @@
+#include "esp_lcd_panel_io.h"
+#include "esp_lcd_panel_ops.h"
+#include "lvgl.h"
+
+// Creates the LVGL display for LCD_INDEXED_MODE, replaces lvgl_port_add_disp
+lv_display_t *lcd_indexed_create(esp_lcd_panel_io_handle_t io_handle,
+                                 esp_lcd_panel_handle_t panel_handle);
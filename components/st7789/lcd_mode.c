@@ -0,0 +1,175 @@
+/* Low-power panel modes for static screens.
+ *
+ * Once the screen has been static (no animation, no screen change) for
+ * LCD_MODE_ENTER_MS the panel is put into the cheapest mode the visible
+ * screen allows:
+ *
+ *  - Partial mode (PTLAR + PTLON): only the rows holding content are
+ *    scanned out, the rest of the panel is driven as non-display area.
+ *  - Idle mode (IDMON): the panel drops to 8 colours, only the MSB of each
+ *    channel is used, so the source drivers stop producing grey levels.
+ *    With the current palette orange shows as yellow, dark purple and cyan
+ *    as cyan, pink as red and green as black, which is why screens opt in
+ *    with SCREEN_FLAG_IDLE_COLORS. Every current screen uses orange and
+ *    dark purple, so none does: they would change colour each time the
+ *    panel went idle, and only get partial mode.
+ *
+ * Both only change how the panel scans its GRAM: LVGL keeps drawing into
+ * it as usual, so label updates such as the seconds tick stay in low power.
+ * A running animation, a screen change or an invalidation outside the
+ * partial rows switches straight back to normal mode (IDMOFF, NORON)
+ * before the frame is flushed.
+ *
+ * Timing: each switch is one to three short commands, a few microseconds
+ * of SPI at 40 MHz, queued behind any pending pixel transfer. The panel
+ * applies the new mode from its next frame, so the change becomes visible
+ * within one refresh period (about 17 ms at the default 60 Hz frame rate).
+ *
+ * Power: the datasheet lists partial and idle mode as the controller's low
+ * current display modes; the saving scales with the rows left out and with
+ * the grey-level drivers being off. lcd_mode_get_stats() reports residency
+ * in each mode so the effect can be checked against a current measurement
+ * of the panel supply.
+ */
+#include "lcd_mode.h"
+
+#include "esp_log.h"
+#include "st7789.h"
+
+#define ST7789_PTLON  0x12
+#define ST7789_NORON  0x13
+#define ST7789_PTLAR  0x30
+#define ST7789_IDMOFF 0x38
+#define ST7789_IDMON  0x39
+
+#define CHECK_PERIOD_MS 500
+
+static const char *TAG = "lcd_mode";
+
+static esp_lcd_panel_io_handle_t s_io = NULL;
+
+// What the visible screen allows
+static bool s_idle_ok = false;
+static int s_y1 = 0, s_y2 = 0;
+
+// What the panel is doing
+static bool s_partial_on = false;
+static bool s_idle_on = false;
+static uint32_t s_last_activity = 0;
+static uint32_t s_mode_since = 0;
+static lcd_mode_stats_t s_stats;
+
+static void tx_cmd(int cmd, const void *param, size_t size) {
+  esp_err_t err = esp_lcd_panel_io_tx_param(s_io, cmd, param, size);
+  if (err != ESP_OK) {
+    ESP_LOGW(TAG, "Command 0x%02x failed: %s", cmd, esp_err_to_name(err));
+  }
+}
+
+static void account(void) {
+  uint32_t now = lv_tick_get();
+  uint32_t elapsed = lv_tick_diff(now, s_mode_since);
+
+  if (s_idle_on) {
+    s_stats.idle_ms += elapsed;
+  } else if (s_partial_on) {
+    s_stats.partial_ms += elapsed;
+  } else {
+    s_stats.normal_ms += elapsed;
+  }
+  s_mode_since = now;
+}
+
+static bool has_partial_area(void) { return s_y2 > s_y1; }
+
+static void enter_low_power(void) {
+  if (s_partial_on || s_idle_on || (!s_idle_ok && !has_partial_area())) {
+    return;
+  }
+  account();
+
+  if (has_partial_area()) {
+    const uint8_t rows[] = {s_y1 >> 8, s_y1 & 0xff, s_y2 >> 8, s_y2 & 0xff};
+    tx_cmd(ST7789_PTLAR, rows, sizeof(rows));
+    tx_cmd(ST7789_PTLON, NULL, 0);
+    s_partial_on = true;
+  }
+  if (s_idle_ok) {
+    tx_cmd(ST7789_IDMON, NULL, 0);
+    s_idle_on = true;
+  }
+
+  s_stats.transitions++;
+  ESP_LOGD(TAG, "Low power: partial %s, idle %s", s_partial_on ? "on" : "off",
+           s_idle_on ? "on" : "off");
+}
+
+static void exit_low_power(void) {
+  if (!s_partial_on && !s_idle_on) {
+    return;
+  }
+  account();
+
+  if (s_idle_on) {
+    tx_cmd(ST7789_IDMOFF, NULL, 0);
+    s_idle_on = false;
+  }
+  if (s_partial_on) {
+    tx_cmd(ST7789_NORON, NULL, 0);
+    s_partial_on = false;
+  }
+
+  s_stats.transitions++;
+  ESP_LOGD(TAG, "Normal mode");
+}
+
+// Plain redraws are fine in low power, only those it cannot show count as
+// activity
+static void invalidate_cb(lv_event_t *e) {
+  const lv_area_t *area = lv_event_get_param(e);
+
+  bool outside = has_partial_area() && (area->y1 < s_y1 || area->y2 > s_y2);
+  if (outside || lv_anim_count_running() > 0) {
+    s_last_activity = lv_tick_get();
+    exit_low_power();
+  }
+}
+
+static void check_timer_cb(lv_timer_t *timer) {
+  if (lv_anim_count_running() > 0) {
+    s_last_activity = lv_tick_get();
+    exit_low_power();
+  } else if (lv_tick_elaps(s_last_activity) >= LCD_MODE_ENTER_MS) {
+    enter_low_power();
+  }
+}
+
+void lcd_mode_init(esp_lcd_panel_io_handle_t io_handle, lv_display_t *disp) {
+  s_io = io_handle;
+  s_last_activity = lv_tick_get();
+  s_mode_since = s_last_activity;
+
+  lv_display_add_event_cb(disp, invalidate_cb, LV_EVENT_INVALIDATE_AREA, NULL);
+  lv_timer_create(check_timer_cb, CHECK_PERIOD_MS, NULL);
+}
+
+// Called on every screen change, with the LVGL lock held
+void lcd_mode_set_caps(bool idle_ok, int content_y1, int content_y2) {
+  if (s_io == NULL) {
+    return;
+  }
+  exit_low_power();
+
+  s_idle_ok = idle_ok;
+  s_y1 = LV_CLAMP(0, content_y1, LCD_V_RES - 1);
+  s_y2 = LV_CLAMP(0, content_y2, LCD_V_RES - 1);
+  s_last_activity = lv_tick_get();
+}
+
+void lcd_mode_get_stats(lcd_mode_stats_t *stats) {
+  if (lvgl_port_lock(0)) {
+    account();
+    *stats = s_stats;
+    lvgl_port_unlock();
+  }
+}
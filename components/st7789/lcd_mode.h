@@ -0,0 +1,5 @@
+#include "esp_lcd_panel_io.h"
+#include "lvgl.h"
+
+// Hooks the low-power mode switching onto the display, LVGL lock held
+void lcd_mode_init(esp_lcd_panel_io_handle_t io_handle, lv_display_t *disp);
@@ -0,0 +1,297 @@
+/* Offscreen pre-render of the next screen.
+ *
+ * A second, invisible LVGL display renders a copy of the screen that the
+ * next-screen button would load. Its flush callback run-length encodes the
+ * bands into a small cache (the screens are mostly flat colour, a frame
+ * takes a few KB instead of 150 KB). On a button press the cache is
+ * decoded straight into the SPI transfers and the real screen is loaded
+ * with invalidation disabled, so LVGL does not render it again. Data that
+ * changed after the cache was rendered is redrawn afterwards, only the
+ * widgets bound to it.
+ */
+#include "lcd_prerender.h"
+
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "lvgl_mem.h"
+#include "openweather.h"
+#include "screen_manager.h"
+#include "st7789.h"
+
+static const char *TAG = "lcd_prerender";
+
+#if LCD_PRERENDER && !LCD_INDEXED_MODE
+
+#define ST7789_NOP 0x00
+
+#define RUN(count, color) (((uint32_t)(count) << 16) | (color))
+#define RUN_COUNT(run) ((run) >> 16)
+#define RUN_COLOR(run) ((uint16_t)(run))
+
+// Bits that change too often to re-render for, always applied after a show
+#define LIVE_BITS CLOCK_TICK
+
+#define BAND_PIXELS (LCD_H_RES * LCD_PRERENDER_BAND_LINES)
+#define MAX_RUNS (LCD_PRERENDER_CACHE_KB * 1024 / sizeof(uint32_t))
+
+static esp_lcd_panel_io_handle_t s_io = NULL;
+static esp_lcd_panel_handle_t s_panel = NULL;
+static lv_display_t *s_disp = NULL;     // the real display
+static lv_display_t *s_offscreen = NULL;
+static lv_obj_t *s_offscreen_blank = NULL;
+static uint16_t *s_band = NULL;         // render band, then stream bounce buffers
+static int s_mem_owner = LVGL_MEM_OWNER_CORE;
+
+static struct {
+  uint32_t *runs;
+  uint32_t count;
+  int id;              // screen in the cache, -1 if none
+  bool valid;
+  bool stale;          // data changed since it was rendered
+  uint32_t dirty_bits; // to apply after streaming it
+  uint32_t rendered_at;
+} s_cache = {.id = -1};
+
+// Run-length encoder state while the offscreen display flushes
+static struct {
+  bool ok;
+  int32_t next_y;
+  uint16_t color;
+  uint32_t count;
+} s_enc;
+
+static bool emit_run(void) {
+  if (s_cache.count >= MAX_RUNS) {
+    s_enc.ok = false;
+    return false;
+  }
+  s_cache.runs[s_cache.count++] = RUN(s_enc.count, s_enc.color);
+  return true;
+}
+
+// Bands arrive top to bottom, full width, for a full-screen refresh
+static void offscreen_flush_cb(lv_display_t *disp, const lv_area_t *area,
+                               uint8_t *px_map) {
+  if (area->x1 != 0 || area->x2 != LCD_H_RES - 1 || area->y1 != s_enc.next_y) {
+    s_enc.ok = false;
+  }
+
+  const uint16_t *px = (const uint16_t *)px_map;
+  uint32_t size = lv_area_get_size(area);
+  for (uint32_t i = 0; i < size && s_enc.ok; i++) {
+    if (px[i] == s_enc.color && s_enc.count < 0xffff) {
+      s_enc.count++;
+      continue;
+    }
+    if (s_enc.count > 0 && !emit_run()) {
+      break;
+    }
+    s_enc.color = px[i];
+    s_enc.count = 1;
+  }
+
+  s_enc.next_y = area->y2 + 1;
+  lv_display_flush_ready(disp);
+}
+
+// Called with the LVGL lock held
+static void render_cache(int id) {
+  const screen_desc_t *desc = screen_manager_get_desc(id);
+  int64_t start = esp_timer_get_time();
+
+  s_cache.valid = false;
+  s_cache.id = id;
+  s_cache.count = 0;
+  s_enc.ok = true;
+  s_enc.next_y = 0;
+  s_enc.color = 0;
+  s_enc.count = 0;
+
+  // Build a throwaway copy of the screen on the offscreen display
+  lv_display_t *prev_default = lv_display_get_default();
+  lv_display_set_default(s_offscreen);
+  int prev_owner = lvgl_mem_set_owner(s_mem_owner);
+  lv_obj_t *copy = desc->build();
+  if (copy) {
+    if (desc->update) {
+      desc->update(copy, desc->bindings & ~LIVE_BITS);
+    }
+    lv_screen_load(copy);
+    lv_refr_now(s_offscreen);
+    lv_screen_load(s_offscreen_blank);
+    lv_obj_delete(copy);
+    // Invalidating resumed the refresh timer, keep the blank screen unrendered
+    lv_timer_pause(lv_display_get_refr_timer(s_offscreen));
+  }
+  lvgl_mem_set_owner(prev_owner);
+  lv_display_set_default(prev_default);
+
+  if (copy && s_enc.ok && s_enc.count > 0) {
+    emit_run();
+  }
+  s_cache.valid = copy && s_enc.ok && s_enc.next_y == LCD_V_RES;
+  s_cache.stale = false;
+  s_cache.dirty_bits = LIVE_BITS;
+  s_cache.rendered_at = lv_tick_get();
+
+  ESP_LOGD(TAG, "Cached '%s': %s, %u runs (%u B) in %lld us", desc->name,
+           s_cache.valid ? "ok" : "too complex", (unsigned)s_cache.count,
+           (unsigned)(s_cache.count * sizeof(uint32_t)),
+           esp_timer_get_time() - start);
+}
+
+// Decodes the cache into the two halves of the band buffer. A NOP command
+// waits for every queued pixel transfer, which is how a half is known to be
+// free again without taking over the port's transfer-done callback.
+static void stream_cache(void) {
+  uint16_t *bounce[2] = {s_band, s_band + BAND_PIXELS / 2};
+  const int32_t chunk_lines = LCD_PRERENDER_BAND_LINES / 2;
+  uint32_t run = 0, left = 0;
+  uint16_t color = 0;
+
+  esp_lcd_panel_io_tx_param(s_io, ST7789_NOP, NULL, 0);
+
+  for (int32_t y = 0, chunk = 0; y < LCD_V_RES; y += chunk_lines, chunk++) {
+    int32_t lines = LV_MIN(chunk_lines, LCD_V_RES - y);
+    uint16_t *dst = bounce[chunk % 2];
+    if (chunk >= 2 && chunk % 2 == 0) {
+      esp_lcd_panel_io_tx_param(s_io, ST7789_NOP, NULL, 0);
+    }
+
+    for (uint32_t i = 0; i < (uint32_t)(LCD_H_RES * lines); i++) {
+      if (left == 0) {
+        left = RUN_COUNT(s_cache.runs[run]);
+        color = RUN_COLOR(s_cache.runs[run]);
+        if (LCD_SWAP_BYTES) {
+          color = (color << 8) | (color >> 8);
+        }
+        run++;
+      }
+      dst[i] = color;
+      left--;
+    }
+    esp_lcd_panel_draw_bitmap(s_panel, 0, y, LCD_H_RES, y + lines, dst);
+  }
+
+  esp_lcd_panel_io_tx_param(s_io, ST7789_NOP, NULL, 0);
+}
+
+static void prerender_init(esp_lcd_panel_io_handle_t io_handle,
+                           esp_lcd_panel_handle_t panel_handle,
+                           lv_display_t *disp) {
+  s_io = io_handle;
+  s_panel = panel_handle;
+  s_disp = disp;
+
+  // DMA capable, the stream reuses it as bounce buffers
+  s_band = heap_caps_malloc(BAND_PIXELS * sizeof(uint16_t), MALLOC_CAP_DMA);
+  s_cache.runs = heap_caps_malloc(MAX_RUNS * sizeof(uint32_t),
+                                  MALLOC_CAP_INTERNAL | MALLOC_CAP_32BIT);
+  if (s_band == NULL || s_cache.runs == NULL) {
+    ESP_LOGE(TAG, "Failed to allocate pre-render buffers");
+    return;
+  }
+  s_mem_owner = lvgl_mem_register_owner("prerender");
+
+  s_offscreen = lv_display_create(LCD_H_RES, LCD_V_RES);
+  lv_display_set_color_format(s_offscreen, LV_COLOR_FORMAT_RGB565);
+  lv_display_set_buffers(s_offscreen, s_band, NULL,
+                         BAND_PIXELS * sizeof(uint16_t),
+                         LV_DISPLAY_RENDER_MODE_PARTIAL);
+  lv_display_set_flush_cb(s_offscreen, offscreen_flush_cb);
+  // Only rendered on demand with lv_refr_now(), which needs the timer to
+  // exist: it refreshes through it and does nothing for a display without one
+  lv_timer_pause(lv_display_get_refr_timer(s_offscreen));
+  s_offscreen_blank = lv_display_get_screen_active(s_offscreen);
+  lv_display_set_default(disp);
+}
+
+void lcd_prerender_update(uint32_t bits) {
+  if (s_offscreen == NULL || !lvgl_port_lock(0)) {
+    return;
+  }
+
+  int id = screen_manager_peek_next();
+  const screen_desc_t *desc = screen_manager_get_desc(id);
+  if (desc != NULL) {
+    uint32_t relevant = bits & desc->bindings;
+    s_cache.dirty_bits |= relevant;
+    s_cache.stale |= (relevant & ~LIVE_BITS) != 0;
+
+    if (id != s_cache.id ||
+        (s_cache.stale && lv_tick_elaps(s_cache.rendered_at) >=
+                              LCD_PRERENDER_MIN_INTERVAL_MS)) {
+      render_cache(id);
+    }
+  }
+  lvgl_port_unlock();
+}
+
+bool lcd_prerender_show_next(int64_t press_us) {
+  if (s_offscreen == NULL || !lvgl_port_lock(0)) {
+    return false;
+  }
+
+  int id = screen_manager_peek_next();
+  if (!s_cache.valid || id != s_cache.id) {
+    lvgl_port_unlock();
+    return false;
+  }
+
+  stream_cache();
+  ESP_LOGI(TAG, "Button to photon: %lld us (pre-rendered)",
+           esp_timer_get_time() - press_us);
+
+  // The panel already shows the screen, load it without redrawing it
+  lv_display_enable_invalidation(s_disp, false);
+  esp_err_t err = screen_manager_show(id);
+  lv_obj_update_layout(lv_screen_active());
+  lv_display_enable_invalidation(s_disp, true);
+
+  // Whatever changed after the cache was rendered. The load already
+  // applied it without drawing, so the widgets that skip unchanged values
+  // are redrawn explicitly
+  screen_manager_redraw(s_cache.dirty_bits);
+  screen_manager_update(s_cache.dirty_bits);
+  s_cache.id = -1;
+  s_cache.valid = false;
+
+  lvgl_port_unlock();
+  return err == ESP_OK;
+}
+
+#else
+
+static void prerender_init(esp_lcd_panel_io_handle_t io_handle,
+                           esp_lcd_panel_handle_t panel_handle,
+                           lv_display_t *disp) {}
+
+void lcd_prerender_update(uint32_t bits) {}
+
+bool lcd_prerender_show_next(int64_t press_us) { return false; }
+
+#endif
+
+/* Button-to-photon latency of the normal path: the press is timed until the
+ * refresh that follows screen_manager_show_next() has been flushed. */
+
+static int64_t s_track_press_us = 0;
+
+static void refr_ready_cb(lv_event_t *e) {
+  if (s_track_press_us == 0) {
+    return;
+  }
+  ESP_LOGI(TAG, "Button to photon: %lld us (rendered)",
+           esp_timer_get_time() - s_track_press_us);
+  s_track_press_us = 0;
+}
+
+void lcd_latency_track(int64_t press_us) { s_track_press_us = press_us; }
+
+void lcd_prerender_init(esp_lcd_panel_io_handle_t io_handle,
+                        esp_lcd_panel_handle_t panel_handle,
+                        lv_display_t *disp) {
+  prerender_init(io_handle, panel_handle, disp);
+  lv_display_add_event_cb(disp, refr_ready_cb, LV_EVENT_REFR_READY, NULL);
+}
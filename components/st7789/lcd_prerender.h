@@ -0,0 +1,8 @@
+#include "esp_lcd_panel_io.h"
+#include "esp_lcd_panel_ops.h"
+#include "lvgl.h"
+
+// Sets up the offscreen display and the latency probe, LVGL lock held
+void lcd_prerender_init(esp_lcd_panel_io_handle_t io_handle,
+                        esp_lcd_panel_handle_t panel_handle,
+                        lv_display_t *disp);
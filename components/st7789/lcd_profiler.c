@@ -0,0 +1,247 @@
+/* Frame profiler.
+ *
+ * Timed from the display events LVGL sends around each refresh, so nothing
+ * in the port's driver is replaced:
+ *
+ *  - REFR_START .. REFR_READY is the whole refresh.
+ *  - FLUSH_START .. FLUSH_FINISH (the flush_cb call) plus FLUSH_WAIT_START
+ *    .. FLUSH_WAIT_FINISH (waiting for a band to be sent) is the flush
+ *    time: how long LVGL was held up by the panel. SPI transfers that
+ *    overlap with rendering into the other buffer cost nothing and are not
+ *    counted.
+ *  - Render time is the refresh minus the flush time.
+ *  - Bytes are the flushed areas at two bytes per pixel, what goes out on
+ *    SPI whatever the draw buffer format.
+ *
+ * Refreshes that flush nothing are ignored. Frames streamed by
+ * lcd_prerender bypass LVGL and are not seen here.
+ */
+#include "lcd_profiler.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "diagnostics.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "st7789.h"
+
+#if LCD_PROFILER
+
+// Upper bounds of the histogram buckets, the last one is open
+static const uint32_t s_bucket_ms[LCD_PROFILE_BUCKETS] = {1,  2,  4,  8,
+                                                          16, 33, 66, 0};
+
+// Frame being refreshed, only touched by the LVGL task
+static struct {
+  int64_t start;
+  int64_t call_start;
+  int64_t wait_start;
+  uint32_t flush_us;
+  uint32_t bytes;
+  uint32_t areas;
+} s_frame;
+
+static lcd_profile_stats_t s_stats;
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static int bucket(uint32_t us) {
+  for (int i = 0; i < LCD_PROFILE_BUCKETS - 1; i++) {
+    if (us <= s_bucket_ms[i] * 1000) {
+      return i;
+    }
+  }
+  return LCD_PROFILE_BUCKETS - 1;
+}
+
+static void event_cb(lv_event_t *e) {
+  int64_t now = esp_timer_get_time();
+
+  switch (lv_event_get_code(e)) {
+  case LV_EVENT_INVALIDATE_AREA:
+    s_frame.areas++;
+    break;
+  case LV_EVENT_REFR_START:
+    s_frame.start = now;
+    s_frame.flush_us = 0;
+    s_frame.bytes = 0;
+    break;
+  case LV_EVENT_FLUSH_START:
+    s_frame.call_start = now;
+    s_frame.bytes +=
+        lv_area_get_size(lv_event_get_param(e)) * sizeof(uint16_t);
+    break;
+  case LV_EVENT_FLUSH_FINISH:
+    s_frame.flush_us += now - s_frame.call_start;
+    break;
+  case LV_EVENT_FLUSH_WAIT_START:
+    s_frame.wait_start = now;
+    break;
+  case LV_EVENT_FLUSH_WAIT_FINISH:
+    s_frame.flush_us += now - s_frame.wait_start;
+    break;
+  case LV_EVENT_REFR_READY: {
+    if (s_frame.bytes > 0) {
+      uint32_t frame_us = now - s_frame.start;
+      uint32_t render_us =
+          frame_us > s_frame.flush_us ? frame_us - s_frame.flush_us : 0;
+
+      portENTER_CRITICAL(&s_lock);
+      s_stats.frames++;
+      s_stats.render_us += render_us;
+      s_stats.flush_us += s_frame.flush_us;
+      s_stats.render_max_us = LV_MAX(s_stats.render_max_us, render_us);
+      s_stats.flush_max_us = LV_MAX(s_stats.flush_max_us, s_frame.flush_us);
+      s_stats.bytes += s_frame.bytes;
+      s_stats.bytes_max = LV_MAX(s_stats.bytes_max, s_frame.bytes);
+      s_stats.areas += s_frame.areas;
+      s_stats.areas_max = LV_MAX(s_stats.areas_max, s_frame.areas);
+      s_stats.render_hist[bucket(render_us)]++;
+      s_stats.flush_hist[bucket(s_frame.flush_us)]++;
+      portEXIT_CRITICAL(&s_lock);
+    }
+    s_frame.areas = 0;
+    break;
+  }
+  default:
+    break;
+  }
+}
+
+void lcd_profiler_get_stats(lcd_profile_stats_t *stats) {
+  portENTER_CRITICAL(&s_lock);
+  *stats = s_stats;
+  portEXIT_CRITICAL(&s_lock);
+}
+
+void lcd_profiler_reset(void) {
+  portENTER_CRITICAL(&s_lock);
+  s_stats = (lcd_profile_stats_t){0};
+  portEXIT_CRITICAL(&s_lock);
+}
+
+#if LCD_PROFILER_OVERLAY
+
+#define OVERLAY_PERIOD_MS 1000
+
+// Last second: frames, average render and flush time, data sent
+static void overlay_timer_cb(lv_timer_t *timer) {
+  static lcd_profile_stats_t prev;
+  lv_obj_t *label = lv_timer_get_user_data(timer);
+  lcd_profile_stats_t now;
+  lcd_profiler_get_stats(&now);
+
+  uint32_t frames = now.frames - prev.frames;
+  uint32_t render_ms = 0, flush_ms = 0;
+  if (frames > 0) {
+    render_ms = (now.render_us - prev.render_us) / frames / 1000;
+    flush_ms = (now.flush_us - prev.flush_us) / frames / 1000;
+  }
+  lv_label_set_text_fmt(label, "%u fps R%u F%u ms %u KB", (unsigned)frames,
+                        (unsigned)render_ms, (unsigned)flush_ms,
+                        (unsigned)((now.bytes - prev.bytes) / 1024));
+  prev = now;
+}
+
+static void overlay_create(void) {
+  lv_obj_t *label = lv_label_create(lv_layer_top());
+  lv_obj_set_style_text_font(label, &lv_font_montserrat_14, 0);
+  lv_obj_set_style_text_color(label, lv_color_white(), 0);
+  lv_obj_set_style_bg_color(label, lv_color_black(), 0);
+  lv_obj_set_style_bg_opa(label, LV_OPA_COVER, 0);
+  lv_obj_align(label, LV_ALIGN_BOTTOM_RIGHT, 0, 0);
+  lv_label_set_text_static(label, "");
+  lv_timer_create(overlay_timer_cb, OVERLAY_PERIOD_MS, label);
+}
+
+#endif
+
+static void print_hist(const char *name, const uint32_t *hist) {
+  printf("%s:", name);
+  for (int i = 0; i < LCD_PROFILE_BUCKETS; i++) {
+    if (s_bucket_ms[i]) {
+      printf(" <=%lums %lu", (unsigned long)s_bucket_ms[i],
+             (unsigned long)hist[i]);
+    } else {
+      printf(" more %lu", (unsigned long)hist[i]);
+    }
+  }
+  printf("\n");
+}
+
+static int display_cmd(int argc, char **argv) {
+  if (argc > 1 && strcmp(argv[1], "reset") == 0) {
+    lcd_profiler_reset();
+    return 0;
+  }
+
+  lcd_profile_stats_t s;
+  lcd_profiler_get_stats(&s);
+  uint32_t frames = s.frames ? s.frames : 1;
+
+  printf("frames %lu, render avg %llu max %lu us, flush avg %llu max %lu us\n",
+         (unsigned long)s.frames, s.render_us / frames,
+         (unsigned long)s.render_max_us, s.flush_us / frames,
+         (unsigned long)s.flush_max_us);
+  printf("bytes avg %llu max %lu, dirty areas avg %lu max %lu\n",
+         s.bytes / frames, (unsigned long)s.bytes_max,
+         (unsigned long)(s.areas / frames), (unsigned long)s.areas_max);
+  print_hist("render", s.render_hist);
+  print_hist("flush", s.flush_hist);
+  return 0;
+}
+
+// Prometheus histogram, buckets are cumulative
+static void write_hist(diag_writer_t *w, const char *name,
+                       const uint32_t *hist, uint64_t sum_us, uint32_t count) {
+  uint32_t total = 0;
+  for (int i = 0; i < LCD_PROFILE_BUCKETS; i++) {
+    total += hist[i];
+    if (s_bucket_ms[i]) {
+      diag_printf(w, "%s_bucket{le=\"%lu\"} %lu\n", name,
+                  (unsigned long)s_bucket_ms[i], (unsigned long)total);
+    } else {
+      diag_printf(w, "%s_bucket{le=\"+Inf\"} %lu\n", name,
+                  (unsigned long)total);
+    }
+  }
+  diag_printf(w, "%s_sum %.3f\n", name, sum_us / 1000.0);
+  diag_printf(w, "%s_count %lu\n", name, (unsigned long)count);
+}
+
+static void display_metrics(diag_writer_t *w) {
+  lcd_profile_stats_t s;
+  lcd_profiler_get_stats(&s);
+
+  diag_printf(w, "display_frames_total %lu\n", (unsigned long)s.frames);
+  diag_printf(w, "display_bytes_total %llu\n", s.bytes);
+  diag_printf(w, "display_dirty_areas_total %lu\n", (unsigned long)s.areas);
+  diag_printf(w, "display_render_max_us %lu\n", (unsigned long)s.render_max_us);
+  diag_printf(w, "display_flush_max_us %lu\n", (unsigned long)s.flush_max_us);
+  write_hist(w, "display_render_ms", s.render_hist, s.render_us, s.frames);
+  write_hist(w, "display_flush_ms", s.flush_hist, s.flush_us, s.frames);
+}
+
+void lcd_profiler_init(lv_display_t *disp) {
+  lv_display_add_event_cb(disp, event_cb, LV_EVENT_ALL, NULL);
+#if LCD_PROFILER_OVERLAY
+  overlay_create();
+#endif
+
+  diagnostics_register_command(
+      "display", "Frame profiler stats, 'display reset' clears them",
+      display_cmd);
+  diagnostics_register_metrics("display", display_metrics);
+}
+
+#else
+
+void lcd_profiler_init(lv_display_t *disp) {}
+
+void lcd_profiler_get_stats(lcd_profile_stats_t *stats) {
+  *stats = (lcd_profile_stats_t){0};
+}
+
+void lcd_profiler_reset(void) {}
+
+#endif
@@ -0,0 +1,4 @@
+#include "lvgl.h"
+
+// Hooks the frame profiler onto the display events, LVGL lock held
+void lcd_profiler_init(lv_display_t *disp);
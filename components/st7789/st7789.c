@@ -1,4 +1,5 @@
 #include "st7789.h"
+#include "backlight.h"
 #include "driver/gpio.h"
 #include "driver/spi_master.h"
 #include "esp_err.h"
@@ -7,11 +8,41 @@
 #include "esp_lcd_panel_vendor.h"
 #include "esp_log.h"
 #include "esp_log_args.h"
-#include "openweather.h"
+#include "esp_timer.h"
+#include "lcd_indexed.h"
+#include "lcd_mode.h"
+#include "lcd_prerender.h"
+#include "lcd_profiler.h"
+#include "power.h"
+#include "task_plan.h"
 
 static const char *TAG = "st7789";
 
 static lv_disp_t *lvgl_disp = NULL;
+static esp_lcd_panel_handle_t lcd_panel = NULL;
+
+/* The port's periodic tick timer would wake the chip every few ms and keep
+ * it out of light sleep. LVGL reads the time from esp_timer instead and the
+ * port timer runs at LVGL_TICK_PERIOD_MS, doing nothing useful. */
+static uint32_t lvgl_tick_ms(void) { return esp_timer_get_time() / 1000; }
+
+// The display lock spans the refresh, render and SPI flushes included.
+// Tracked, so an unpaired event cannot leave the lock held.
+static bool display_locked = false;
+
+static void refr_start_cb(lv_event_t *e) {
+  if (!display_locked) {
+    power_lock(POWER_LOCK_DISPLAY);
+    display_locked = true;
+  }
+}
+
+static void refr_ready_cb(lv_event_t *e) {
+  if (display_locked) {
+    display_locked = false;
+    power_unlock(POWER_LOCK_DISPLAY);
+  }
+}
 
 void init_lcd(int rotation) {
   ESP_LOGI(TAG, "Initialize SPI bus");
@@ -22,6 +53,7 @@ void init_lcd(int rotation) {
       .quadwp_io_num = -1,
       .quadhd_io_num = -1,
       .max_transfer_sz = LCD_H_RES * LCD_V_RES * sizeof(uint16_t),
+      .isr_cpu_id = ESP_INTR_CPU_CORE_TO_AFFINITY(LCD_FLUSH_ISR_CORE),
   };
   ESP_ERROR_CHECK(spi_bus_initialize(LCD_HOST, &buscfg, SPI_DMA_CH_AUTO));
 
@@ -44,6 +76,9 @@ void init_lcd(int rotation) {
   const esp_lcd_panel_dev_config_t panel_config = {
       .reset_gpio_num = PIN_NUM_RST,
       .rgb_ele_order = LCD_RGB_ELEMENT_ORDER_RGB,
+      // Sets the ENDIAN bit of RAMCTRL, pixels then go out as LVGL stores them
+      .data_endian = LCD_SWAP_BYTES ? LCD_RGB_DATA_ENDIAN_BIG
+                                    : LCD_RGB_DATA_ENDIAN_LITTLE,
       .bits_per_pixel = 16,
   };
   ESP_ERROR_CHECK(
@@ -54,18 +89,24 @@ void init_lcd(int rotation) {
   ESP_ERROR_CHECK(esp_lcd_panel_invert_color(panel_handle, false));
   ESP_ERROR_CHECK(esp_lcd_panel_mirror(panel_handle, true, false));
   ESP_ERROR_CHECK(esp_lcd_panel_disp_on_off(panel_handle, true));
+  lcd_panel = panel_handle;
 
   // Configure backlight
   ESP_LOGI(TAG, "Turn on LCD backlight");
-  gpio_config_t bk_gpio_config = {.mode = GPIO_MODE_OUTPUT,
-                                  .pin_bit_mask = 1ULL << PIN_NUM_BK_LIGHT};
-  ESP_ERROR_CHECK(gpio_config(&bk_gpio_config));
-  gpio_set_level(PIN_NUM_BK_LIGHT, LCD_BK_LIGHT_ON);
+  ESP_ERROR_CHECK(backlight_init(PIN_NUM_BK_LIGHT));
 
   ESP_LOGI(TAG, "Initialize LVGL");
-  const lvgl_port_cfg_t lvgl_cfg = ESP_LVGL_PORT_INIT_CONFIG();
+  lvgl_port_cfg_t lvgl_cfg = ESP_LVGL_PORT_INIT_CONFIG();
+  lvgl_cfg.task_affinity = LVGL_RENDER_CORE;
+  lvgl_cfg.task_priority = TASK_LVGL_PRIORITY;
+  lvgl_cfg.task_stack = TASK_LVGL_STACK;
+  lvgl_cfg.timer_period_ms = LVGL_TICK_PERIOD_MS;
   ESP_ERROR_CHECK(lvgl_port_init(&lvgl_cfg));
+  lv_tick_set_cb(lvgl_tick_ms);
 
+#if LCD_INDEXED_MODE
+  lvgl_disp = lcd_indexed_create(io_handle, panel_handle);
+#else
   const lvgl_port_display_cfg_t disp_cfg = {
       .io_handle = io_handle,
       .panel_handle = panel_handle,
@@ -82,231 +123,97 @@ void init_lcd(int rotation) {
           },
       .flags = {
           .buff_dma = true,
+          .swap_bytes = LCD_SWAP_BYTES,
       }};
   lvgl_disp = lvgl_port_add_disp(&disp_cfg);
+#endif
 
   // Rotate display to portrait mode if needed
   lv_disp_set_rotation(lvgl_disp, rotation); // 0 - no rotation
 
-  ESP_LOGI(TAG, "Setup complete");
-}
-
-lv_obj_t *create_background(lv_color_t color) {
   if (lvgl_port_lock(0)) {
-    lv_obj_t *screen = lv_obj_create(NULL);
-    lv_obj_set_style_bg_color(screen, color, LV_PART_MAIN);
-    lv_obj_set_style_bg_opa(screen, LV_OPA_COVER, LV_PART_MAIN);
+    lcd_mode_init(io_handle, lvgl_disp);
+    lcd_prerender_init(io_handle, panel_handle, lvgl_disp);
+    lcd_profiler_init(lvgl_disp);
+    lv_display_add_event_cb(lvgl_disp, refr_start_cb, LV_EVENT_REFR_START, NULL);
+    lv_display_add_event_cb(lvgl_disp, refr_ready_cb, LV_EVENT_REFR_READY, NULL);
     lvgl_port_unlock();
-    return screen;
   }
-  return NULL;
-}
-
-lv_obj_t *create_label(lv_obj_t *display_label, const lv_font_t *font,
-                       lv_color_t color, int x, int y, const char *text) {
-  if (lvgl_port_lock(0)) {
-
-    lv_obj_t *value_label = lv_label_create(display_label);
-    lv_label_set_text(value_label, text);
-
-    lv_obj_set_style_text_font(value_label, font, 0);
 
-    lv_obj_set_style_text_color(value_label, color, 0);
-    lv_obj_set_style_text_opa(value_label, LV_OPA_COVER, 0);
-
-    lv_obj_set_pos(value_label, x, y);
-    lvgl_port_unlock();
-    return value_label;
-  }
-  return NULL;
+  ESP_LOGI(TAG, "Setup complete");
 }
 
-// in lv_color_make order is BRG with RGB565 notation
-// max values are: 31, 31, 63
-
-lv_obj_t *create_line(lv_point_precise_t *line_array, lv_obj_t *display_label,
-                      lv_color_t color, int x, int y) {
-  if (lvgl_port_lock(0)) {
-    lv_obj_t *line = lv_line_create(display_label);
-    lv_line_set_points(line, line_array, 2);
-
-    // Position the line
-    lv_obj_set_pos(line, x, y);
-
-    // Style the line
-    lv_obj_set_style_line_width(line, 2, 0);
-    lv_obj_set_style_line_color(line, color, 0);
-    lvgl_port_unlock();
-    return line;
+void lcd_sleep(void) {
+  if (lvgl_disp == NULL) {
+    return;
   }
-  return NULL;
-}
-
-void create_info_screen(void) {
-  screen_info = create_background(COLOR_BLACK);
-
-  label_info = create_label(screen_info, &lv_font_montserrat_14, COLOR_ORANGE,
-                            20, 20, "Start Initializing");
-}
-
-// Create the sensor screen
-void create_sensor_screen(void) {
-  extern lv_font_t jet_mono_light_32;
-  extern lv_font_t noto_sans_jp_24;
-  extern lv_font_t jb_mono_bold_48;
-  extern lv_font_t jb_mono_bold_64;
-  extern lv_font_t jb_mono_reg_20;
-
-  static lv_point_precise_t line_points1[] = {
-      {0, 0},  // Start point (x, y)
-      {240, 0} // End point (x, y)
-  };
-  static lv_point_precise_t line_points2[] = {
-      {0, 0}, // Start point (x, y)
-      {0, 80} // End point (x, y)
-  };
-
-  screen_sensor = create_background(COLOR_BLACK);
-
-  create_line(line_points1, screen_sensor, COLOR_ORANGE, 0, 160);
-  create_line(line_points1, screen_sensor, COLOR_ORANGE, 0, 240);
-  create_line(line_points2, screen_sensor, COLOR_ORANGE, 120, 160);
-
-  label_time = create_label(screen_sensor, &jb_mono_bold_64, COLOR_ORANGE, 20,
-                            30, "00:00");
-  label_date = create_label(screen_sensor, &lv_font_montserrat_14, COLOR_CYAN,
-                            80, 90, "YYYY/mm/dd");
-
-  label_co2 = create_label(screen_sensor, &jb_mono_reg_20, COLOR_DARK_PURPLE,
-                           10, 250, "CO2");
-  label_co2 = create_label(screen_sensor, &jb_mono_reg_20, COLOR_DARK_PURPLE,
-                           190, 250, "ppm");
-  label_co2 = create_label(screen_sensor, &jb_mono_bold_48, COLOR_ORANGE, 70,
-                           260, "--");
-
-  label_temp = create_label(screen_sensor, &noto_sans_jp_24, COLOR_DARK_PURPLE,
-                            10, 170, "湿度");
-  label_temp = create_label(screen_sensor, &jb_mono_reg_20, COLOR_DARK_PURPLE,
-                            80, 170, "°C");
-  label_temp = create_label(screen_sensor, &jet_mono_light_32, COLOR_ORANGE, 10,
-                            200, "--");
-
-  label_humid = create_label(screen_sensor, &noto_sans_jp_24, COLOR_DARK_PURPLE,
-                             130, 170, "温度");
-  label_humid = create_label(screen_sensor, &jb_mono_reg_20, COLOR_DARK_PURPLE,
-                             210, 170, "%");
-  label_humid = create_label(screen_sensor, &jet_mono_light_32, COLOR_ORANGE,
-                             130, 200, "--");
-}
-
-void create_weather_screen() {
-  extern lv_font_t jb_mono_reg_20;
-  extern lv_font_t jet_mono_light_32;
-  extern lv_font_t jb_mono_bold_64;
-
-  screen_weather = create_background(COLOR_BLACK);
-
   if (lvgl_port_lock(0)) {
-    // Temperature
-    label_out_temp = create_label(screen_weather, &jb_mono_reg_20,
-                                  COLOR_DARK_PURPLE, 90, 30, "°C");
-    label_out_temp = create_label(screen_weather, &jb_mono_bold_64,
-                                  COLOR_ORANGE, 20, 30, "--");
-
-    // Feels like
-    label_out_feels = create_label(screen_weather, &jb_mono_reg_20,
-                                   COLOR_DARK_PURPLE, 90, 50, "(-- °C)");
-
-    // Humidity
-    create_label(screen_weather, &jb_mono_reg_20, COLOR_DARK_PURPLE, 10, 150,
-                 "H:");
-    create_label(screen_weather, &jb_mono_reg_20, COLOR_DARK_PURPLE, 70, 150,
-                 "%");
-    label_out_humidity = create_label(screen_weather, &jb_mono_reg_20,
-                                      COLOR_ORANGE, 30, 150, "--");
-
-    // Condition
-    label_out_cond = create_label(screen_weather, &jb_mono_reg_20, COLOR_CYAN,
-                                  50, 120, "Loading...");
-
-    // Wind
-    create_label(screen_weather, &jb_mono_reg_20, COLOR_DARK_PURPLE, 10, 230,
-                 "W:");
-    create_label(screen_weather, &jb_mono_reg_20, COLOR_DARK_PURPLE, 70, 230,
-                 "km/h");
-    label_out_wind = create_label(screen_weather, &jb_mono_reg_20, COLOR_ORANGE,
-                                  30, 230, "--");
-
+    lv_refr_now(lvgl_disp);
     lvgl_port_unlock();
   }
+  // Straight to 0, a fade would not finish before the chip sleeps
+  backlight_set_percent(0, 0);
+  esp_lcd_panel_disp_on_off(lcd_panel, false);
+  esp_lcd_panel_disp_sleep(lcd_panel, true);
 }
 
-void check_modules_state(void) {
-  bool display_initialized = false;
-  char log_buffer[64];
-  lv_obj_t *log_sensor = NULL;
-  lv_obj_t *log_time = NULL;
-  lv_obj_t *log_weather = NULL;
-
-  lv_label_set_text(label_info, "Waiting modules...");
-
-  log_sensor = create_label(screen_info, &lv_font_montserrat_14, COLOR_ORANGE,
-                            20, 60, "  Sensor: ---");
-  log_time = create_label(screen_info, &lv_font_montserrat_14, COLOR_ORANGE, 20,
-                          80, "  Time: ---");
-  log_weather = create_label(screen_info, &lv_font_montserrat_14, COLOR_ORANGE,
-                             20, 100, "  Weather: ---");
-
-  while (!display_initialized) {
-    ESP_LOGI(TAG, "Waiting for all data sources...");
-
-    EventBits_t bits = xEventGroupWaitBits(
-        data_events, SENSOR_DATA_READY | TIME_DATA_READY | WEATHER_DATA_READY,
-        pdFALSE, pdTRUE, pdMS_TO_TICKS(5000));
-
-    if (lvgl_port_lock(0)) {
-      snprintf(log_buffer, sizeof(log_buffer), "  Sensor: %s",
-               (bits & SENSOR_DATA_READY) ? "READY" : "FAILED");
-      lv_label_set_text(log_sensor, log_buffer);
-
-      snprintf(log_buffer, sizeof(log_buffer), "  Time: %s",
-               (bits & TIME_DATA_READY) ? "READY" : "FAILED");
-      lv_label_set_text(log_time, log_buffer);
-
-      snprintf(log_buffer, sizeof(log_buffer), "  Weather: %s",
-               (bits & WEATHER_DATA_READY) ? "READY" : "FAILED");
-      lv_label_set_text(log_weather, log_buffer);
-
-      lvgl_port_unlock();
-    }
-    // Check if all ready
-    if ((bits & (SENSOR_DATA_READY | TIME_DATA_READY | WEATHER_DATA_READY)) ==
-        (SENSOR_DATA_READY | TIME_DATA_READY | WEATHER_DATA_READY)) {
-
-      xEventGroupClearBits(data_events, SENSOR_DATA_READY | TIME_DATA_READY |
-                                            WEATHER_DATA_READY);
+// Times full-screen redraws of the active screen, flush included
+void lcd_benchmark(int frames) {
+  if (frames <= 0 || lvgl_disp == NULL || !lvgl_port_lock(0)) {
+    return;
+  }
 
-      ESP_LOGI(TAG, "All data ready! Initializing display...");
+  lcd_flush_stats_t before, after;
+  lcd_get_flush_stats(&before);
 
-      if (lvgl_port_lock(0)) {
-        create_sensor_screen();
-        create_weather_screen();
-        lv_screen_load(screen_weather);
-        lvgl_port_unlock();
-      }
+  int64_t min = INT64_MAX, max = 0, total = 0;
+  for (int i = 0; i < frames; i++) {
+    lv_obj_invalidate(lv_screen_active());
+    int64_t start = esp_timer_get_time();
+    lv_refr_now(lvgl_disp);
+    int64_t elapsed = esp_timer_get_time() - start;
 
-      display_initialized = true;
-    }
+    min = elapsed < min ? elapsed : min;
+    max = elapsed > max ? elapsed : max;
+    total += elapsed;
+  }
+  lvgl_port_unlock();
+  lcd_get_flush_stats(&after);
+  // Keep the boot benchmark out of the field numbers
+  lcd_profiler_reset();
+
+  ESP_LOGI(TAG,
+           "Full-screen render: min %lld avg %lld max %lld us over %d frames "
+           "(%d draw units, %s)",
+           min, total / frames, max, frames, LV_DRAW_SW_DRAW_UNIT_CNT,
+           LV_USE_OS == LV_OS_NONE ? "no OS" : "RTOS");
+
+  uint32_t flushes = after.flushes - before.flushes;
+  uint64_t pixels = after.pixels - before.pixels;
+  int64_t expand_us = after.expand_us - before.expand_us;
+  if (flushes > 0 && pixels > 0) {
+    ESP_LOGI(TAG, "LUT expansion: %lld us per frame, %lld us per band, %u ns/px",
+             expand_us / frames, expand_us / flushes,
+             (unsigned)(expand_us * 1000 / pixels));
   }
-}
 
-void init_start_screen(void) {
-  init_lcd(0);
-  create_weather_screen();
-  // create_info_screen();
+#if LCD_SWAP_BYTES && !LCD_INDEXED_MODE
+  // The port swaps each band in place before sending it, time the same pass
+  // on the active draw buffer (swapped twice, it is redrawn anyway)
   if (lvgl_port_lock(0)) {
-    // lv_screen_load(screen_info);
-    lv_screen_load(screen_weather);
+    lv_draw_buf_t *buf = lv_display_get_buf_active(lvgl_disp);
+    uint32_t band_px = LCD_H_RES * LVGL_BUFFER_HEIGHT;
+    int64_t start = esp_timer_get_time();
+    for (int i = 0; i < frames * 2; i++) {
+      lv_draw_sw_rgb565_swap(buf->data, band_px);
+    }
+    int64_t per_band = (esp_timer_get_time() - start) / (frames * 2);
     lvgl_port_unlock();
+
+    ESP_LOGI(TAG, "Byte swap: %lld us per %d-line band, %lld us per frame",
+             per_band, LVGL_BUFFER_HEIGHT,
+             per_band * ((LCD_V_RES + LVGL_BUFFER_HEIGHT - 1) /
+                         LVGL_BUFFER_HEIGHT));
   }
+#endif
 }
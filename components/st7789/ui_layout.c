@@ -0,0 +1,151 @@
+#include "ui_layout.h"
+#include "esp_log.h"
+#include "esp_lvgl_port.h"
+#include "st7789.h"
+#include "ui_segment.h"
+
+static const char *TAG = "ui_layout";
+
+// Found by search: a blend is (a * alpha + b * (255 - alpha)) / 255 for
+// alpha = 17 * k, 0 < k < 15, whether LVGL rounds, truncates or shifts
+const uint8_t ui_index_levels[UI_COLOR_COUNT] = {
+    [UI_COLOR_BLACK] = 0,        [UI_COLOR_WHITE] = 16,
+    [UI_COLOR_ORANGE] = 32,      [UI_COLOR_DARK_PURPLE] = 71,
+    [UI_COLOR_PINK] = 93,        [UI_COLOR_GREEN] = 166,
+    [UI_COLOR_CYAN] = 195,
+};
+
+lv_color_t ui_palette_color(ui_color_t color) {
+  switch (color) {
+  case UI_COLOR_WHITE:
+    return COLOR_WHITE;
+  case UI_COLOR_ORANGE:
+    return COLOR_ORANGE;
+  case UI_COLOR_DARK_PURPLE:
+    return COLOR_DARK_PURPLE;
+  case UI_COLOR_PINK:
+    return COLOR_PINK;
+  case UI_COLOR_GREEN:
+    return COLOR_GREEN;
+  case UI_COLOR_CYAN:
+    return COLOR_CYAN;
+  case UI_COLOR_BLACK:
+  default:
+    return COLOR_BLACK;
+  }
+}
+
+lv_color_t ui_color(ui_color_t color) {
+#if LCD_INDEXED_MODE
+  // LVGL draws the palette index as a grey level, the flush maps it back
+  uint8_t level = UI_INDEX_LEVEL(color);
+  return lv_color_make(level, level, level);
+#else
+  return ui_palette_color(color);
+#endif
+}
+
+static void free_bindings_cb(lv_event_t *e) {
+  lv_obj_t *screen = lv_event_get_target(e);
+  lv_free(lv_obj_get_user_data(screen));
+  lv_obj_set_user_data(screen, NULL);
+}
+
+static lv_obj_t *create_widget(lv_obj_t *parent, const ui_widget_t *w) {
+  lv_obj_t *obj = NULL;
+
+  switch (w->type) {
+  case UI_WIDGET_LABEL:
+    obj = lv_label_create(parent);
+    lv_label_set_text_static(obj, w->text);
+    lv_obj_set_style_text_font(obj, w->font, 0);
+    lv_obj_set_style_text_color(obj, ui_color(w->color), 0);
+    break;
+  case UI_WIDGET_LINE:
+    obj = lv_line_create(parent);
+    lv_line_set_points(obj, w->points, 2);
+    lv_obj_set_style_line_width(obj, 2, 0);
+    lv_obj_set_style_line_color(obj, ui_color(w->color), 0);
+    break;
+  case UI_WIDGET_CHART:
+    obj = lv_chart_create(parent);
+    lv_obj_set_size(obj, w->points[1].x, w->points[1].y);
+    lv_chart_set_type(obj, LV_CHART_TYPE_LINE);
+    // Circular mode only invalidates the columns around a new point, shift
+    // mode would redraw the whole chart on every append
+    lv_chart_set_update_mode(obj, LV_CHART_UPDATE_MODE_CIRCULAR);
+    lv_chart_set_div_line_count(obj, 5, 0);
+    lv_obj_set_style_bg_opa(obj, LV_OPA_TRANSP, LV_PART_MAIN);
+    lv_obj_set_style_radius(obj, 0, LV_PART_MAIN);
+    lv_obj_set_style_pad_all(obj, 0, LV_PART_MAIN);
+    lv_obj_set_style_border_width(obj, 1, LV_PART_MAIN);
+    lv_obj_set_style_border_color(obj, ui_color(w->color), LV_PART_MAIN);
+    lv_obj_set_style_line_color(obj, ui_color(w->color), LV_PART_MAIN);
+    lv_obj_set_style_line_width(obj, 2, LV_PART_ITEMS);
+    lv_obj_set_style_width(obj, 0, LV_PART_INDICATOR);
+    lv_obj_set_style_height(obj, 0, LV_PART_INDICATOR);
+    break;
+  case UI_WIDGET_SEGMENT:
+    obj = ui_segment_create(parent, w->points[1].y);
+    if (obj == NULL) {
+      return NULL;
+    }
+    lv_obj_set_style_text_color(obj, ui_color(w->color), 0);
+    ui_segment_set_text(obj, w->text);
+    break;
+  default:
+    ESP_LOGE(TAG, "Unknown widget type %d", w->type);
+    return NULL;
+  }
+
+  lv_obj_set_pos(obj, w->x, w->y);
+  return obj;
+}
+
+// Builds a whole screen from a layout table in a single locked pass
+lv_obj_t *ui_layout_build(const ui_layout_t *layout) {
+  if (!lvgl_port_lock(0)) {
+    return NULL;
+  }
+
+  lv_obj_t *screen = lv_obj_create(NULL);
+  lv_obj_set_style_bg_color(screen, ui_color(layout->background), LV_PART_MAIN);
+  lv_obj_set_style_bg_opa(screen, LV_OPA_COVER, LV_PART_MAIN);
+
+  bool ok = true;
+  lv_obj_t **bindings = NULL;
+  if (layout->binding_count > 0) {
+    bindings = lv_zalloc(layout->binding_count * sizeof(lv_obj_t *));
+    ok = bindings != NULL;
+  }
+  if (bindings) {
+    lv_obj_set_user_data(screen, bindings);
+    lv_obj_add_event_cb(screen, free_bindings_cb, LV_EVENT_DELETE, NULL);
+  }
+
+  // The update callbacks use every binding unchecked, a screen missing a
+  // widget is not built at all
+  for (int i = 0; ok && i < layout->widget_count; i++) {
+    const ui_widget_t *w = &layout->widgets[i];
+    lv_obj_t *obj = create_widget(screen, w);
+    ok = obj != NULL;
+
+    if (obj && bindings && w->binding != UI_NO_BINDING &&
+        w->binding < layout->binding_count) {
+      bindings[w->binding] = obj;
+    }
+  }
+
+  if (!ok) {
+    ESP_LOGE(TAG, "Out of memory building a screen");
+    lv_obj_delete(screen);
+    screen = NULL;
+  }
+
+  lvgl_port_unlock();
+  return screen;
+}
+
+lv_obj_t **ui_layout_bindings(lv_obj_t *screen) {
+  return screen ? lv_obj_get_user_data(screen) : NULL;
+}
@@ -0,0 +1,740 @@
+#include <string.h>
+
+#include "boot.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "font_pack.h"
+#include "lvgl_mem.h"
+#include "openweather.h"
+#include "screen_manager.h"
+#include "sensor_history.h"
+#include "st7789.h"
+#include "sysmon.h"
+#include "ui_layout.h"
+#include "ui_segment.h"
+
+static const char *TAG = "ui_screens";
+
+LV_FONT_DECLARE(jet_mono_light_32);
+LV_FONT_DECLARE(noto_sans_jp_24);
+LV_FONT_DECLARE(jb_mono_reg_20);
+
+/* Info screen */
+
+enum {
+  INFO_BIND_TITLE,
+  INFO_BIND_SENSOR,
+  INFO_BIND_TIME,
+  INFO_BIND_WEATHER,
+  INFO_BIND_COUNT,
+};
+
+static const ui_widget_t info_widgets[] = {
+    UI_LABEL(&lv_font_montserrat_14, UI_COLOR_ORANGE, 20, 20,
+             "Start Initializing", INFO_BIND_TITLE),
+    UI_LABEL(&lv_font_montserrat_14, UI_COLOR_ORANGE, 20, 60, "  Sensor: ---",
+             INFO_BIND_SENSOR),
+    UI_LABEL(&lv_font_montserrat_14, UI_COLOR_ORANGE, 20, 80, "  Time: ---",
+             INFO_BIND_TIME),
+    UI_LABEL(&lv_font_montserrat_14, UI_COLOR_ORANGE, 20, 100,
+             "  Weather: ---", INFO_BIND_WEATHER),
+};
+
+static const ui_layout_t info_layout =
+    UI_LAYOUT(UI_COLOR_BLACK, info_widgets, INFO_BIND_COUNT);
+
+static lv_obj_t *build_info_screen(void) {
+  return ui_layout_build(&info_layout);
+}
+
+/* Sensor screen */
+
+enum {
+  SENSOR_BIND_TIME,
+  SENSOR_BIND_SECONDS,
+  SENSOR_BIND_DATE,
+  SENSOR_BIND_CO2,
+  SENSOR_BIND_TEMP,
+  SENSOR_BIND_HUMID,
+  SENSOR_BIND_COUNT,
+};
+
+// CO2 readout, centred on this x between its captions
+#define CO2_DIGIT_HEIGHT 40
+#define CO2_CENTER_X     130
+
+static const ui_widget_t sensor_widgets[] = {
+    UI_LINE(UI_COLOR_ORANGE, 0, 160, 240, 0),
+    UI_LINE(UI_COLOR_ORANGE, 0, 240, 240, 0),
+    UI_LINE(UI_COLOR_ORANGE, 120, 160, 0, 80),
+
+    UI_SEGMENT(UI_COLOR_ORANGE, 20, 32, 56, "00:00", SENSOR_BIND_TIME),
+    // Monospaced, so every tick invalidates the same two-digit box
+    UI_LABEL(&jb_mono_reg_20, UI_COLOR_DARK_PURPLE, 212, 68, "",
+             SENSOR_BIND_SECONDS),
+    UI_LABEL(&lv_font_montserrat_14, UI_COLOR_CYAN, 80, 90, "YYYY/mm/dd",
+             SENSOR_BIND_DATE),
+
+    UI_LABEL(&jb_mono_reg_20, UI_COLOR_DARK_PURPLE, 10, 250, "CO2",
+             UI_NO_BINDING),
+    UI_LABEL(&jb_mono_reg_20, UI_COLOR_DARK_PURPLE, 190, 250, "ppm",
+             UI_NO_BINDING),
+    UI_SEGMENT(UI_COLOR_ORANGE, 108, 266, CO2_DIGIT_HEIGHT, "--",
+               SENSOR_BIND_CO2),
+
+    UI_LABEL(&noto_sans_jp_24, UI_COLOR_DARK_PURPLE, 10, 170, "温度",
+             UI_NO_BINDING),
+    UI_LABEL(&jb_mono_reg_20, UI_COLOR_DARK_PURPLE, 80, 170, "°C",
+             UI_NO_BINDING),
+    UI_LABEL(&jet_mono_light_32, UI_COLOR_ORANGE, 10, 200, "--",
+             SENSOR_BIND_TEMP),
+
+    UI_LABEL(&noto_sans_jp_24, UI_COLOR_DARK_PURPLE, 130, 170, "湿度",
+             UI_NO_BINDING),
+    UI_LABEL(&jb_mono_reg_20, UI_COLOR_DARK_PURPLE, 210, 170, "%",
+             UI_NO_BINDING),
+    UI_LABEL(&jet_mono_light_32, UI_COLOR_ORANGE, 130, 200, "--",
+             SENSOR_BIND_HUMID),
+};
+
+static const ui_layout_t sensor_layout =
+    UI_LAYOUT(UI_COLOR_BLACK, sensor_widgets, SENSOR_BIND_COUNT);
+
+// Cost of a seconds tick, from the label update to the end of the refresh
+// that redraws it
+#define CLOCK_STATS_TICKS 60
+
+static struct {
+  bool tick_pending;  // a tick is waiting for its refresh
+  int64_t update_us;  // label update of that tick
+  int64_t refr_start;
+  uint32_t ticks;
+  int64_t total_us;
+  int64_t max_us;
+} s_clock;
+
+static void clock_refr_cb(lv_event_t *e) {
+  int64_t now = esp_timer_get_time();
+
+  if (lv_event_get_code(e) == LV_EVENT_REFR_START) {
+    s_clock.refr_start = now;
+    return;
+  }
+  if (!s_clock.tick_pending) {
+    return;
+  }
+
+  // Label update plus the redraw itself, the wait for the LVGL task is not
+  // part of the cost
+  int64_t cost = (now - s_clock.refr_start) + s_clock.update_us;
+  s_clock.tick_pending = false;
+  s_clock.total_us += cost;
+  s_clock.max_us = cost > s_clock.max_us ? cost : s_clock.max_us;
+
+  if (++s_clock.ticks == CLOCK_STATS_TICKS) {
+    ESP_LOGI(TAG, "Seconds tick: avg %lld us, max %lld us",
+             s_clock.total_us / s_clock.ticks, s_clock.max_us);
+    s_clock.ticks = 0;
+    s_clock.total_us = 0;
+    s_clock.max_us = 0;
+  }
+}
+
+// The minute on the HH:MM readout lives in the date label's user data, so
+// every copy of the screen tracks its own
+#define SHOWN_MIN_NONE ((void *)(intptr_t)-1)
+
+static lv_obj_t *build_sensor_screen(void) {
+  lv_obj_t *screen = ui_layout_build(&sensor_layout);
+  if (screen) {
+    lv_obj_set_user_data(ui_layout_bindings(screen)[SENSOR_BIND_DATE],
+                         SHOWN_MIN_NONE);
+  }
+  return screen;
+}
+
+static void set_clock_labels(lv_obj_t **bind, const struct tm *timeinfo) {
+  char buffer[32];
+
+  strftime(buffer, sizeof(buffer), "%I:%M", timeinfo);
+  ui_segment_set_text(bind[SENSOR_BIND_TIME], buffer);
+
+  strftime(buffer, sizeof(buffer), "%Y/%m/%d", timeinfo);
+  lv_label_set_text(bind[SENSOR_BIND_DATE], buffer);
+
+  lv_obj_set_user_data(bind[SENSOR_BIND_DATE],
+                       (void *)(intptr_t)timeinfo->tm_min);
+}
+
+static void update_sensor_screen(lv_obj_t *screen, uint32_t bits) {
+  lv_obj_t **bind = ui_layout_bindings(screen);
+  char buffer[64];
+
+  if (bits & SENSOR_DATA_READY) {
+    sensor_data_t data = {0};
+    if (xSemaphoreTake(sensor_mutex, pdMS_TO_TICKS(100)) == pdTRUE) {
+      data = g_sensor_data;
+      xSemaphoreGive(sensor_mutex);
+    }
+
+    snprintf(buffer, sizeof(buffer), "%d", data.co2_ppm);
+    lv_obj_set_x(bind[SENSOR_BIND_CO2],
+                 CO2_CENTER_X -
+                     ui_segment_text_width(CO2_DIGIT_HEIGHT, buffer) / 2);
+    ui_segment_set_text(bind[SENSOR_BIND_CO2], buffer);
+
+    snprintf(buffer, sizeof(buffer), "%.1f", data.temperature);
+    lv_label_set_text(bind[SENSOR_BIND_TEMP], buffer);
+
+    snprintf(buffer, sizeof(buffer), "%.1f", data.humidity);
+    lv_label_set_text(bind[SENSOR_BIND_HUMID], buffer);
+  }
+
+  if (bits & (TIME_DATA_READY | CLOCK_TICK)) {
+    int64_t start = esp_timer_get_time();
+    time_data_t data = {0};
+    if (xSemaphoreTake(time_mutex, pdMS_TO_TICKS(100)) == pdTRUE) {
+      data = g_time_data;
+      xSemaphoreGive(time_mutex);
+    }
+
+    // The HH:MM readout and the date are only touched when the minute
+    // changes
+    intptr_t shown_min = (intptr_t)lv_obj_get_user_data(bind[SENSOR_BIND_DATE]);
+    if ((bits & TIME_DATA_READY) || data.timeinfo.tm_min != shown_min) {
+      set_clock_labels(bind, &data.timeinfo);
+    }
+
+    if (bits & CLOCK_TICK) {
+      snprintf(buffer, sizeof(buffer), "%02d", data.timeinfo.tm_sec);
+      lv_label_set_text(bind[SENSOR_BIND_SECONDS], buffer);
+      s_clock.update_us = esp_timer_get_time() - start;
+      s_clock.tick_pending = true;
+    }
+  }
+}
+
+// The readouts and the minute skip unchanged values, a first update made
+// with invalidation off leaves them recorded but not drawn
+static void redraw_sensor_screen(lv_obj_t *screen, uint32_t bits) {
+  lv_obj_t **bind = ui_layout_bindings(screen);
+
+  if (bits & SENSOR_DATA_READY) {
+    // Centred, the old position is covered by the full row
+    lv_area_t row;
+    ui_segment_invalidate(bind[SENSOR_BIND_CO2]);
+    lv_obj_get_coords(bind[SENSOR_BIND_CO2], &row);
+    row.x1 = 0;
+    row.x2 = LCD_H_RES - 1;
+    lv_obj_invalidate_area(screen, &row);
+    lv_obj_invalidate(bind[SENSOR_BIND_TEMP]);
+    lv_obj_invalidate(bind[SENSOR_BIND_HUMID]);
+  }
+  if (bits & (TIME_DATA_READY | CLOCK_TICK)) {
+    ui_segment_invalidate(bind[SENSOR_BIND_TIME]);
+    lv_obj_invalidate(bind[SENSOR_BIND_DATE]);
+    lv_obj_invalidate(bind[SENSOR_BIND_SECONDS]);
+  }
+}
+
+/* Weather screen */
+
+enum {
+  WEATHER_BIND_TEMP,
+  WEATHER_BIND_FEELS,
+  WEATHER_BIND_HUMIDITY,
+  WEATHER_BIND_COND,
+  WEATHER_BIND_WIND,
+  WEATHER_BIND_COUNT,
+};
+
+static const ui_widget_t weather_widgets[] = {
+    // Temperature
+    UI_LABEL(&jb_mono_reg_20, UI_COLOR_DARK_PURPLE, 90, 30, "°C",
+             UI_NO_BINDING),
+    UI_SEGMENT(UI_COLOR_ORANGE, 20, 32, 56, "--", WEATHER_BIND_TEMP),
+
+    // Feels like
+    UI_LABEL(&jb_mono_reg_20, UI_COLOR_DARK_PURPLE, 90, 50, "(-- °C)",
+             WEATHER_BIND_FEELS),
+
+    // Humidity
+    UI_LABEL(&jb_mono_reg_20, UI_COLOR_DARK_PURPLE, 10, 150, "H:",
+             UI_NO_BINDING),
+    UI_LABEL(&jb_mono_reg_20, UI_COLOR_DARK_PURPLE, 70, 150, "%",
+             UI_NO_BINDING),
+    UI_LABEL(&jb_mono_reg_20, UI_COLOR_ORANGE, 30, 150, "--",
+             WEATHER_BIND_HUMIDITY),
+
+    // Condition
+    UI_LABEL(&jb_mono_reg_20, UI_COLOR_CYAN, 50, 120, "Loading...",
+             WEATHER_BIND_COND),
+
+    // Wind
+    UI_LABEL(&jb_mono_reg_20, UI_COLOR_DARK_PURPLE, 10, 230, "W:",
+             UI_NO_BINDING),
+    UI_LABEL(&jb_mono_reg_20, UI_COLOR_DARK_PURPLE, 70, 230, "km/h",
+             UI_NO_BINDING),
+    UI_LABEL(&jb_mono_reg_20, UI_COLOR_ORANGE, 30, 230, "--",
+             WEATHER_BIND_WIND),
+};
+
+static const ui_layout_t weather_layout =
+    UI_LAYOUT(UI_COLOR_BLACK, weather_widgets, WEATHER_BIND_COUNT);
+
+static lv_obj_t *build_weather_screen(void) {
+  lv_obj_t *screen = ui_layout_build(&weather_layout);
+
+  // Localised condition text, Latin glyphs come from the layout font
+  const lv_font_t *font = font_pack_get(UI_CJK_FONT, &jb_mono_reg_20);
+  if (screen && font) {
+    lv_obj_set_style_text_font(ui_layout_bindings(screen)[WEATHER_BIND_COND],
+                               font, 0);
+  }
+  return screen;
+}
+
+static void update_weather_screen(lv_obj_t *screen, uint32_t bits) {
+  lv_obj_t **bind = ui_layout_bindings(screen);
+  char buffer[128];
+  weather_data_t data;
+
+  if (xSemaphoreTake(weather_mutex, pdMS_TO_TICKS(100)) != pdTRUE) {
+    return;
+  }
+  data = g_weather_data;
+  xSemaphoreGive(weather_mutex);
+
+  if (data.updated_at == 0) {
+    return;
+  }
+
+  snprintf(buffer, sizeof(buffer), "%d", (int)data.temperature);
+  ui_segment_set_text(bind[WEATHER_BIND_TEMP], buffer);
+
+  snprintf(buffer, sizeof(buffer), "(%d°C)", (int)data.feels_like);
+  lv_label_set_text(bind[WEATHER_BIND_FEELS], buffer);
+
+  snprintf(buffer, sizeof(buffer), "%d", data.humidity);
+  lv_label_set_text(bind[WEATHER_BIND_HUMIDITY], buffer);
+
+  lv_label_set_text(bind[WEATHER_BIND_COND], data.condition);
+
+  snprintf(buffer, sizeof(buffer), "%.1f", data.wind_speed);
+  lv_label_set_text(bind[WEATHER_BIND_WIND], buffer);
+}
+
+static void redraw_weather_screen(lv_obj_t *screen, uint32_t bits) {
+  ui_segment_invalidate(ui_layout_bindings(screen)[WEATHER_BIND_TEMP]);
+}
+
+/* History screen */
+
+enum {
+  HISTORY_BIND_WINDOW,
+  HISTORY_BIND_CHART,
+  HISTORY_BIND_COUNT,
+};
+
+enum {
+  HISTORY_SERIES_CO2,
+  HISTORY_SERIES_TEMP,
+  HISTORY_SERIES_HUMID,
+  HISTORY_SERIES_COUNT,
+};
+
+// Every series is scaled onto the same 0..HISTORY_CHART_RANGE axis
+#define HISTORY_CHART_RANGE 1000
+
+static const ui_widget_t history_widgets[] = {
+    UI_LABEL(&jb_mono_reg_20, UI_COLOR_DARK_PURPLE, 10, 10, "History",
+             UI_NO_BINDING),
+    UI_LABEL(&jb_mono_reg_20, UI_COLOR_ORANGE, 180, 10, "1h",
+             HISTORY_BIND_WINDOW),
+
+    UI_CHART(UI_COLOR_DARK_PURPLE, 10, 45, 220, 200, HISTORY_BIND_CHART),
+
+    UI_LABEL(&lv_font_montserrat_14, UI_COLOR_ORANGE, 10, 258,
+             "CO2 400-2000 ppm", UI_NO_BINDING),
+    UI_LABEL(&lv_font_montserrat_14, UI_COLOR_PINK, 10, 278, "Temp 0-40 °C",
+             UI_NO_BINDING),
+    UI_LABEL(&lv_font_montserrat_14, UI_COLOR_CYAN, 10, 298,
+             "Humidity 0-100 %", UI_NO_BINDING),
+};
+
+static const ui_layout_t history_layout =
+    UI_LAYOUT(UI_COLOR_BLACK, history_widgets, HISTORY_BIND_COUNT);
+
+// Selected sensor_history_window_t, shared by every copy of the screen
+static volatile uint8_t s_history_window = SENSOR_HISTORY_1H;
+
+// Per chart, kept in its user data
+typedef struct {
+  int8_t loaded; // window currently in the chart, -1 if none
+  uint32_t seq;  // last history point appended to the chart
+  lv_chart_series_t *series[HISTORY_SERIES_COUNT];
+} history_state_t;
+
+static void free_history_state_cb(lv_event_t *e) {
+  lv_obj_t *chart = lv_event_get_target(e);
+  lv_free(lv_obj_get_user_data(chart));
+  lv_obj_set_user_data(chart, NULL);
+}
+
+static int32_t history_scale(int32_t value, int32_t min, int32_t max) {
+  value = LV_CLAMP(min, value, max);
+  return (value - min) * HISTORY_CHART_RANGE / (max - min);
+}
+
+static lv_obj_t *build_history_screen(void) {
+  lv_obj_t *screen = ui_layout_build(&history_layout);
+  if (screen == NULL) {
+    return NULL;
+  }
+
+  lv_obj_t *chart = ui_layout_bindings(screen)[HISTORY_BIND_CHART];
+  history_state_t *state = lv_zalloc(sizeof(history_state_t));
+  if (state == NULL) {
+    lv_obj_delete(screen);
+    return NULL;
+  }
+  lv_obj_set_user_data(chart, state);
+  lv_obj_add_event_cb(chart, free_history_state_cb, LV_EVENT_DELETE, NULL);
+
+  lv_chart_set_point_count(chart, SENSOR_HISTORY_POINTS);
+  lv_chart_set_axis_range(chart, LV_CHART_AXIS_PRIMARY_Y, 0,
+                          HISTORY_CHART_RANGE);
+  state->series[HISTORY_SERIES_CO2] = lv_chart_add_series(
+      chart, ui_color(UI_COLOR_ORANGE), LV_CHART_AXIS_PRIMARY_Y);
+  state->series[HISTORY_SERIES_TEMP] = lv_chart_add_series(
+      chart, ui_color(UI_COLOR_PINK), LV_CHART_AXIS_PRIMARY_Y);
+  state->series[HISTORY_SERIES_HUMID] = lv_chart_add_series(
+      chart, ui_color(UI_COLOR_CYAN), LV_CHART_AXIS_PRIMARY_Y);
+  state->loaded = -1;
+
+  return screen;
+}
+
+// Writes one column; LVGL only invalidates the area around that point
+static void history_append(lv_obj_t *chart, history_state_t *state,
+                           const sensor_history_point_t *p) {
+  int32_t values[HISTORY_SERIES_COUNT] = {
+      [HISTORY_SERIES_CO2] = history_scale(p->co2_ppm, 400, 2000),
+      [HISTORY_SERIES_TEMP] = history_scale(p->temperature_x10, 0, 400),
+      [HISTORY_SERIES_HUMID] = history_scale(p->humidity_x10, 0, 1000),
+  };
+
+  for (int i = 0; i < HISTORY_SERIES_COUNT; i++) {
+    lv_chart_series_t *ser = state->series[i];
+    lv_chart_set_next_value(chart, ser, values[i]);
+    // Blank the oldest point so the sweep shows a gap, not a jump
+    lv_chart_set_value_by_id(chart, ser, lv_chart_get_x_start_point(chart, ser),
+                             LV_CHART_POINT_NONE);
+  }
+}
+
+static void update_history_screen(lv_obj_t *screen, uint32_t bits) {
+  lv_obj_t **bind = ui_layout_bindings(screen);
+  lv_obj_t *chart = bind[HISTORY_BIND_CHART];
+  history_state_t *state = lv_obj_get_user_data(chart);
+  sensor_history_window_t window = s_history_window;
+  sensor_history_point_t points[16];
+  int count;
+
+  if (state->loaded != window) {
+    // Fresh build or another window: refill from the start of the window
+    for (int i = 0; i < HISTORY_SERIES_COUNT; i++) {
+      lv_chart_set_all_values(chart, state->series[i], LV_CHART_POINT_NONE);
+    }
+    lv_label_set_text_static(bind[HISTORY_BIND_WINDOW],
+                             sensor_history_window_name(window));
+    state->seq = 0;
+    state->loaded = window;
+  }
+
+  while ((count = sensor_history_read(window, &state->seq, points,
+                                      sizeof(points) / sizeof(points[0]))) >
+         0) {
+    for (int i = 0; i < count; i++) {
+      history_append(chart, state, &points[i]);
+    }
+  }
+}
+
+// Points are only read once, the next update has nothing to redraw with
+static void redraw_history_screen(lv_obj_t *screen, uint32_t bits) {
+  lv_obj_invalidate(ui_layout_bindings(screen)[HISTORY_BIND_CHART]);
+}
+
+/* Diagnostics screen, reached with the two-button chord */
+
+enum {
+  DIAG_BIND_UPTIME,
+  DIAG_BIND_HEAP,
+  DIAG_BIND_LVGL,
+  DIAG_BIND_FRAMES,
+  DIAG_BIND_CPU,
+  DIAG_BIND_TOP,
+  DIAG_BIND_STACK,
+  DIAG_BIND_DMA,
+  DIAG_BIND_COUNT,
+};
+
+static const ui_widget_t diag_widgets[] = {
+    UI_LABEL(&lv_font_montserrat_14, UI_COLOR_CYAN, 20, 20, "Diagnostics",
+             UI_NO_BINDING),
+    UI_LABEL(&lv_font_montserrat_14, UI_COLOR_ORANGE, 20, 60, "Uptime: ---",
+             DIAG_BIND_UPTIME),
+    UI_LABEL(&lv_font_montserrat_14, UI_COLOR_ORANGE, 20, 80, "Heap: ---",
+             DIAG_BIND_HEAP),
+    UI_LABEL(&lv_font_montserrat_14, UI_COLOR_ORANGE, 20, 100, "LVGL: ---",
+             DIAG_BIND_LVGL),
+    UI_LABEL(&lv_font_montserrat_14, UI_COLOR_ORANGE, 20, 120, "Frames: ---",
+             DIAG_BIND_FRAMES),
+    UI_LABEL(&lv_font_montserrat_14, UI_COLOR_ORANGE, 20, 160, "CPU: ---",
+             DIAG_BIND_CPU),
+    UI_LABEL(&lv_font_montserrat_14, UI_COLOR_ORANGE, 20, 180, "Top: ---",
+             DIAG_BIND_TOP),
+    UI_LABEL(&lv_font_montserrat_14, UI_COLOR_ORANGE, 20, 200, "Stack: ---",
+             DIAG_BIND_STACK),
+    UI_LABEL(&lv_font_montserrat_14, UI_COLOR_ORANGE, 20, 220, "DMA: ---",
+             DIAG_BIND_DMA),
+};
+
+static const ui_layout_t diag_layout =
+    UI_LAYOUT(UI_COLOR_BLACK, diag_widgets, DIAG_BIND_COUNT);
+
+static lv_obj_t *build_diag_screen(void) {
+  return ui_layout_build(&diag_layout);
+}
+
+static void update_diag_screen(lv_obj_t *screen, uint32_t bits) {
+  lv_obj_t **bind = ui_layout_bindings(screen);
+  char buffer[48];
+
+  uint32_t uptime_s = esp_timer_get_time() / 1000000;
+  snprintf(buffer, sizeof(buffer), "Uptime: %lud %02lu:%02lu:%02lu",
+           (unsigned long)(uptime_s / 86400),
+           (unsigned long)(uptime_s / 3600 % 24),
+           (unsigned long)(uptime_s / 60 % 60), (unsigned long)(uptime_s % 60));
+  lv_label_set_text(bind[DIAG_BIND_UPTIME], buffer);
+
+  snprintf(buffer, sizeof(buffer), "Heap: %lu KB free, %lu KB min",
+           (unsigned long)(esp_get_free_heap_size() / 1024),
+           (unsigned long)(esp_get_minimum_free_heap_size() / 1024));
+  lv_label_set_text(bind[DIAG_BIND_HEAP], buffer);
+
+  lvgl_mem_stats_t mem;
+  lvgl_mem_get_stats(&mem);
+  snprintf(buffer, sizeof(buffer), "LVGL: %u / %u KB, peak %u KB",
+           (unsigned)(mem.used_bytes / 1024), (unsigned)(mem.pool_bytes / 1024),
+           (unsigned)(mem.peak_bytes / 1024));
+  lv_label_set_text(bind[DIAG_BIND_LVGL], buffer);
+
+  lcd_profile_stats_t prof;
+  lcd_profiler_get_stats(&prof);
+  snprintf(buffer, sizeof(buffer), "Frames: %lu, render %lu us max",
+           (unsigned long)prof.frames, (unsigned long)prof.render_max_us);
+  lv_label_set_text(bind[DIAG_BIND_FRAMES], buffer);
+
+  // Too big for the callers' stacks. Updates run from several tasks, but
+  // always with the LVGL lock held, which also guards this buffer
+  static sysmon_sample_t sample;
+  if (!sysmon_get_sample(0, &sample)) {
+    return;
+  }
+
+  snprintf(buffer, sizeof(buffer), "CPU: core 0 %u%%, core 1 %u%%",
+           (unsigned)(sample.core_permille[0] / 10),
+           (unsigned)(sample.core_permille[1] / 10));
+  lv_label_set_text(bind[DIAG_BIND_CPU], buffer);
+
+  // The busiest task that is not an idle task, the list is sorted
+  const sysmon_task_t *top = NULL;
+  const sysmon_task_t *tight = NULL;
+  for (int i = 0; i < sample.task_count; i++) {
+    const sysmon_task_t *t = &sample.tasks[i];
+    if (top == NULL && strncmp(t->name, "IDLE", 4) != 0) {
+      top = t;
+    }
+    if (tight == NULL || t->stack_free < tight->stack_free) {
+      tight = t;
+    }
+  }
+  if (top) {
+    snprintf(buffer, sizeof(buffer), "Top: %s %u.%u%%", top->name,
+             (unsigned)(top->cpu_permille / 10),
+             (unsigned)(top->cpu_permille % 10));
+    lv_label_set_text(bind[DIAG_BIND_TOP], buffer);
+  }
+  if (tight) {
+    snprintf(buffer, sizeof(buffer), "Stack: %s %lu B free", tight->name,
+             (unsigned long)tight->stack_free);
+    lv_label_set_text(bind[DIAG_BIND_STACK], buffer);
+  }
+
+  const sysmon_heap_t *dma = &sample.heap[SYSMON_HEAP_DMA];
+  snprintf(buffer, sizeof(buffer), "DMA: %lu KB free, %lu KB block",
+           (unsigned long)(dma->free / 1024),
+           (unsigned long)(dma->largest_block / 1024));
+  lv_label_set_text(bind[DIAG_BIND_DMA], buffer);
+}
+
+void history_screen_set_window(int window) {
+  if (window < 0 || window >= SENSOR_HISTORY_WINDOW_COUNT) {
+    return;
+  }
+  s_history_window = window;
+  // Reloads now if the chart is visible, otherwise on the next show
+  screen_manager_update(HISTORY_DATA_READY);
+}
+
+void history_screen_next_window(void) {
+  history_screen_set_window((s_history_window + 1) %
+                            SENSOR_HISTORY_WINDOW_COUNT);
+}
+
+static const screen_desc_t screens[] = {
+    [SCREEN_INFO] =
+        {
+            .name = "info",
+            .content_y1 = 15,
+            .content_y2 = 125,
+            .build = build_info_screen,
+        },
+    [SCREEN_SENSOR] =
+        {
+            .name = "sensor",
+            .flags = SCREEN_FLAG_CYCLE,
+            .bindings = SENSOR_DATA_READY | TIME_DATA_READY | CLOCK_TICK,
+            .build = build_sensor_screen,
+            .update = update_sensor_screen,
+            .redraw = redraw_sensor_screen,
+        },
+    [SCREEN_WEATHER] =
+        {
+            .name = "weather",
+            .flags = SCREEN_FLAG_CYCLE,
+            .content_y1 = 20,
+            .content_y2 = 265,
+            .bindings = WEATHER_DATA_READY,
+            .build = build_weather_screen,
+            .update = update_weather_screen,
+            .redraw = redraw_weather_screen,
+        },
+    [SCREEN_HISTORY] =
+        {
+            .name = "history",
+            .flags = SCREEN_FLAG_CYCLE,
+            .bindings = HISTORY_DATA_READY,
+            .build = build_history_screen,
+            .update = update_history_screen,
+            .redraw = redraw_history_screen,
+        },
+    [SCREEN_DIAG] =
+        {
+            .name = "diag",
+            .bindings = CLOCK_TICK,
+            .build = build_diag_screen,
+            .update = update_diag_screen,
+        },
+};
+
+// Called with the LVGL lock held. The buttons are live already and the info
+// screen is not pinned: once another screen is shown it can be evicted, so
+// the bindings are only valid while it is the current one
+static lv_obj_t **info_bindings(void) {
+  if (screen_manager_current() != SCREEN_INFO) {
+    return NULL;
+  }
+  return ui_layout_bindings(lv_screen_active());
+}
+
+void check_modules_state(void) {
+  bool display_initialized = false;
+  char log_buffer[64];
+
+  screen_manager_show(SCREEN_INFO);
+  if (lvgl_port_lock(0)) {
+    lv_obj_t **bind = info_bindings();
+    if (bind) {
+      lv_label_set_text(bind[INFO_BIND_TITLE], "Waiting modules...");
+    }
+    lvgl_port_unlock();
+  }
+
+  while (!display_initialized) {
+    ESP_LOGI(TAG, "Waiting for all data sources...");
+
+    EventBits_t bits = xEventGroupWaitBits(
+        data_events, SENSOR_DATA_READY | TIME_DATA_READY | WEATHER_DATA_READY,
+        pdFALSE, pdTRUE, pdMS_TO_TICKS(5000));
+
+    if (lvgl_port_lock(0)) {
+      lv_obj_t **bind = info_bindings();
+      if (bind) {
+        snprintf(log_buffer, sizeof(log_buffer), "  Sensor: %s",
+                 (bits & SENSOR_DATA_READY) ? "READY" : "FAILED");
+        lv_label_set_text(bind[INFO_BIND_SENSOR], log_buffer);
+
+        snprintf(log_buffer, sizeof(log_buffer), "  Time: %s",
+                 (bits & TIME_DATA_READY) ? "READY" : "FAILED");
+        lv_label_set_text(bind[INFO_BIND_TIME], log_buffer);
+
+        snprintf(log_buffer, sizeof(log_buffer), "  Weather: %s",
+                 (bits & WEATHER_DATA_READY) ? "READY" : "FAILED");
+        lv_label_set_text(bind[INFO_BIND_WEATHER], log_buffer);
+      }
+      lvgl_port_unlock();
+    }
+    // Check if all ready
+    if ((bits & (SENSOR_DATA_READY | TIME_DATA_READY | WEATHER_DATA_READY)) ==
+        (SENSOR_DATA_READY | TIME_DATA_READY | WEATHER_DATA_READY)) {
+
+      xEventGroupClearBits(data_events, SENSOR_DATA_READY | TIME_DATA_READY |
+                                            WEATHER_DATA_READY);
+
+      ESP_LOGI(TAG, "All data ready! Initializing display...");
+      boot_mark("populated");
+
+      // Screens are built on first show, the rest stay unbuilt until needed
+      screen_manager_show(SCREEN_WEATHER);
+      lvgl_mem_log_stats();
+
+      display_initialized = true;
+    }
+  }
+}
+
+// Time to first frame, only the first refresh after boot
+static void first_frame_cb(lv_event_t *e) {
+  boot_mark("first_frame");
+  lv_display_remove_event_cb_with_user_data(lv_event_get_target(e),
+                                            first_frame_cb, NULL);
+}
+
+// Tells the panel which low-power modes the new screen can live with
+static void screen_show_hook(const screen_desc_t *desc) {
+  lcd_mode_set_caps(desc->flags & SCREEN_FLAG_IDLE_COLORS, desc->content_y1,
+                    desc->content_y2);
+}
+
+void init_start_screen(void) {
+  init_lcd(0);
+  screen_manager_set_show_hook(screen_show_hook);
+
+  if (lvgl_port_lock(0)) {
+    lv_display_t *disp = lv_display_get_default();
+    lv_display_add_event_cb(disp, clock_refr_cb, LV_EVENT_REFR_START, NULL);
+    lv_display_add_event_cb(disp, clock_refr_cb, LV_EVENT_REFR_READY, NULL);
+    lv_display_add_event_cb(disp, first_frame_cb, LV_EVENT_REFR_READY, NULL);
+    lvgl_port_unlock();
+  }
+
+  // Registration order must match the SCREEN_* ids
+  for (int i = 0; i < sizeof(screens) / sizeof(screens[0]); i++) {
+    screen_manager_register(&screens[i]);
+  }
+  screen_manager_show(SCREEN_WEATHER);
+}
@@ -0,0 +1,256 @@
+/* Seven-segment readout widget.
+ *
+ * A digit cell is h high and h / 2 wide, segments are h / 8 thick rounded
+ * bars with a small gap where they meet:
+ *
+ *      aaa
+ *     f   b
+ *      ggg
+ *     e   c
+ *      ddd
+ *
+ * ':' and '.' take a narrow cell one segment wide. The whole geometry is
+ * derived from the height, so the only stored data is one mask per
+ * character. On a text change with the same cell layout the old and new
+ * masks are XORed and only the segments that toggled are invalidated; a
+ * different layout (more digits, a sign) redraws the widget. The diff is
+ * against the stored masks, not the panel: a change made while the display
+ * does not invalidate needs ui_segment_invalidate() afterwards.
+ */
+#include "ui_segment.h"
+
+#include <string.h>
+
+#define SEG_A (1 << 0)
+#define SEG_B (1 << 1)
+#define SEG_C (1 << 2)
+#define SEG_D (1 << 3)
+#define SEG_E (1 << 4)
+#define SEG_F (1 << 5)
+#define SEG_G (1 << 6)
+#define DIGIT_SEGMENTS 7
+
+// Narrow cells
+#define DOT_UPPER (1 << 0)
+#define DOT_LOWER (1 << 1)
+#define DOT_BASE (1 << 2)
+#define DOT_SEGMENTS 3
+
+static const uint8_t s_digits[10] = {
+    SEG_A | SEG_B | SEG_C | SEG_D | SEG_E | SEG_F,         // 0
+    SEG_B | SEG_C,                                         // 1
+    SEG_A | SEG_B | SEG_D | SEG_E | SEG_G,                 // 2
+    SEG_A | SEG_B | SEG_C | SEG_D | SEG_G,                 // 3
+    SEG_B | SEG_C | SEG_F | SEG_G,                         // 4
+    SEG_A | SEG_C | SEG_D | SEG_F | SEG_G,                 // 5
+    SEG_A | SEG_C | SEG_D | SEG_E | SEG_F | SEG_G,         // 6
+    SEG_A | SEG_B | SEG_C,                                 // 7
+    SEG_A | SEG_B | SEG_C | SEG_D | SEG_E | SEG_F | SEG_G, // 8
+    SEG_A | SEG_B | SEG_C | SEG_D | SEG_F | SEG_G,         // 9
+};
+
+typedef struct {
+  int16_t height;
+  uint8_t count;
+  uint8_t narrow; // bit per cell
+  uint8_t masks[UI_SEGMENT_MAX_CELLS];
+} segment_state_t;
+
+static int32_t thickness(int32_t h) { return LV_MAX(2, h / 8); }
+
+static bool is_narrow(char c) { return c == ':' || c == '.'; }
+
+static uint8_t char_mask(char c) {
+  if (c >= '0' && c <= '9') {
+    return s_digits[c - '0'];
+  }
+  switch (c) {
+  case '-':
+    return SEG_G;
+  case ':':
+    return DOT_UPPER | DOT_LOWER;
+  case '.':
+    return DOT_BASE;
+  default:
+    return 0;
+  }
+}
+
+static int32_t cell_width(int32_t h, bool narrow) {
+  return narrow ? thickness(h) : h / 2;
+}
+
+int32_t ui_segment_text_width(int32_t h, const char *text) {
+  int32_t width = 0;
+  int count = 0;
+  for (; *text && count < UI_SEGMENT_MAX_CELLS; text++, count++) {
+    width += cell_width(h, is_narrow(*text)) + thickness(h);
+  }
+  // No gap after the last cell
+  return count ? width - thickness(h) : 0;
+}
+
+// Box of one segment of the cell at (x, y), screen coordinates
+static void segment_area(int seg, bool narrow, int32_t x, int32_t y,
+                         int32_t h, lv_area_t *a) {
+  int32_t t = thickness(h);
+  int32_t w = cell_width(h, narrow);
+  int32_t half = t / 2;
+  int32_t gap = LV_MAX(1, t / 4);
+
+  if (narrow) {
+    int32_t top = seg == 0 ? y + h / 3 - half
+                  : seg == 1 ? y + 2 * h / 3 - half
+                             : y + h - t;
+    lv_area_set(a, x, top, x + t - 1, top + t - 1);
+    return;
+  }
+
+  int32_t left = x, right = x + w - t;
+  int32_t row_x1 = x + half + gap, row_x2 = x + w - 1 - half - gap;
+  int32_t mid = y + h / 2;
+
+  switch (1 << seg) {
+  case SEG_A:
+    lv_area_set(a, row_x1, y, row_x2, y + t - 1);
+    break;
+  case SEG_G:
+    lv_area_set(a, row_x1, mid - half, row_x2, mid - half + t - 1);
+    break;
+  case SEG_D:
+    lv_area_set(a, row_x1, y + h - t, row_x2, y + h - 1);
+    break;
+  case SEG_F:
+    lv_area_set(a, left, y + half + gap, left + t - 1, mid - 1 - gap);
+    break;
+  case SEG_B:
+    lv_area_set(a, right, y + half + gap, right + t - 1, mid - 1 - gap);
+    break;
+  case SEG_E:
+    lv_area_set(a, left, mid + gap, left + t - 1, y + h - 1 - half - gap);
+    break;
+  case SEG_C:
+  default:
+    lv_area_set(a, right, mid + gap, right + t - 1, y + h - 1 - half - gap);
+    break;
+  }
+}
+
+// Calls fn for every segment set in masks, or in the XOR of two states
+typedef void (*segment_fn_t)(lv_obj_t *obj, const lv_area_t *area, void *arg);
+
+static void for_each_segment(lv_obj_t *obj, const segment_state_t *state,
+                             const uint8_t *masks, segment_fn_t fn,
+                             void *arg) {
+  lv_area_t coords, area;
+  lv_obj_get_coords(obj, &coords);
+  int32_t x = coords.x1;
+
+  for (int i = 0; i < state->count; i++) {
+    bool narrow = state->narrow & (1 << i);
+    int segments = narrow ? DOT_SEGMENTS : DIGIT_SEGMENTS;
+    for (int seg = 0; seg < segments; seg++) {
+      if (masks[i] & (1 << seg)) {
+        segment_area(seg, narrow, x, coords.y1, state->height, &area);
+        fn(obj, &area, arg);
+      }
+    }
+    x += cell_width(state->height, narrow) + thickness(state->height);
+  }
+}
+
+static void draw_segment(lv_obj_t *obj, const lv_area_t *area, void *arg) {
+  lv_layer_t *layer = lv_event_get_layer(arg);
+  lv_area_t clipped;
+  if (!lv_area_intersect(&clipped, area, &layer->_clip_area)) {
+    return;
+  }
+
+  lv_draw_rect_dsc_t dsc;
+  lv_draw_rect_dsc_init(&dsc);
+  dsc.bg_color = lv_obj_get_style_text_color(obj, LV_PART_MAIN);
+  dsc.radius = LV_RADIUS_CIRCLE;
+  lv_draw_rect(layer, &dsc, area);
+}
+
+static void invalidate_segment(lv_obj_t *obj, const lv_area_t *area,
+                               void *arg) {
+  lv_obj_invalidate_area(obj, area);
+}
+
+static void event_cb(lv_event_t *e) {
+  lv_obj_t *obj = lv_event_get_target(e);
+  segment_state_t *state = lv_obj_get_user_data(obj);
+
+  switch (lv_event_get_code(e)) {
+  case LV_EVENT_DRAW_MAIN:
+    for_each_segment(obj, state, state->masks, draw_segment, e);
+    break;
+  case LV_EVENT_DELETE:
+    lv_free(state);
+    lv_obj_set_user_data(obj, NULL);
+    break;
+  default:
+    break;
+  }
+}
+
+lv_obj_t *ui_segment_create(lv_obj_t *parent, int32_t height) {
+  segment_state_t *state = lv_zalloc(sizeof(segment_state_t));
+  if (state == NULL) {
+    return NULL;
+  }
+  state->height = height;
+
+  lv_obj_t *obj = lv_obj_create(parent);
+  lv_obj_remove_style_all(obj);
+  lv_obj_remove_flag(obj, LV_OBJ_FLAG_CLICKABLE | LV_OBJ_FLAG_SCROLLABLE);
+  lv_obj_set_size(obj, 0, height);
+  lv_obj_set_user_data(obj, state);
+  lv_obj_add_event_cb(obj, event_cb, LV_EVENT_DRAW_MAIN, NULL);
+  lv_obj_add_event_cb(obj, event_cb, LV_EVENT_DELETE, NULL);
+  return obj;
+}
+
+void ui_segment_set_text(lv_obj_t *obj, const char *text) {
+  segment_state_t *state = lv_obj_get_user_data(obj);
+  uint8_t masks[UI_SEGMENT_MAX_CELLS] = {0};
+  uint8_t narrow = 0;
+  int count = 0;
+
+  for (; text[count] && count < UI_SEGMENT_MAX_CELLS; count++) {
+    masks[count] = char_mask(text[count]);
+    narrow |= is_narrow(text[count]) << count;
+  }
+
+  if (count != state->count || narrow != state->narrow) {
+    // Another cell layout, the width changes and everything moves
+    state->count = count;
+    state->narrow = narrow;
+    memcpy(state->masks, masks, sizeof(masks));
+    lv_obj_set_width(obj, ui_segment_text_width(state->height, text));
+    lv_obj_invalidate(obj);
+    return;
+  }
+
+  uint8_t toggled[UI_SEGMENT_MAX_CELLS];
+  bool changed = false;
+  for (int i = 0; i < count; i++) {
+    toggled[i] = state->masks[i] ^ masks[i];
+    changed |= toggled[i] != 0;
+  }
+  if (!changed) {
+    return;
+  }
+
+  // Pending moves would make the coordinates stale
+  lv_obj_update_layout(obj);
+  // A segment turning off is erased by redrawing its box with the new masks
+  memcpy(state->masks, masks, sizeof(masks));
+  for_each_segment(obj, state, toggled, invalidate_segment, NULL);
+}
+
+void ui_segment_invalidate(lv_obj_t *obj) {
+  lv_obj_update_layout(obj);
+  lv_obj_invalidate(obj);
+}
@@ -0,0 +1,56 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+// Runtime monitor: every period the sampler records CPU use and stack
+// high-water per task and the free, minimum and largest block of the
+// internal and DMA heaps, keeping the last SYSMON_HISTORY samples. Shown on
+// the diag screen, by the "sysmon" command and on /metrics.
+
+#define SYSMON_PERIOD_MS    5000    // default, "sysmon <ms>" changes it
+#define SYSMON_MIN_PERIOD_MS 500
+#define SYSMON_HISTORY      6
+#define SYSMON_MAX_TASKS    24      // tasks beyond this are counted, not kept
+#define SYSMON_NAME_LEN     16      // CONFIG_FREERTOS_MAX_TASK_NAME_LEN
+#define SYSMON_CORES        2
+#define SYSMON_CORE_ANY     (-1)
+
+typedef enum {
+    SYSMON_HEAP_INTERNAL,
+    SYSMON_HEAP_DMA,
+    SYSMON_HEAP_COUNT,
+} sysmon_heap_id_t;
+
+typedef struct {
+    char name[SYSMON_NAME_LEN];
+    int8_t core;                // SYSMON_CORE_ANY when not pinned
+    uint8_t priority;
+    uint16_t cpu_permille;      // of one core over the period
+    uint32_t stack_free;        // bytes never touched since the task started
+} sysmon_task_t;
+
+typedef struct {
+    uint32_t free;
+    uint32_t min_free;          // since boot
+    uint32_t largest_block;
+} sysmon_heap_t;
+
+typedef struct {
+    uint32_t seq;
+    int64_t time_us;
+    uint32_t period_us;         // run time covered by the CPU figures
+    uint16_t core_permille[SYSMON_CORES];   // busy, that is not idle
+    uint8_t task_count;
+    uint8_t dropped;
+    sysmon_heap_t heap[SYSMON_HEAP_COUNT];
+    sysmon_task_t tasks[SYSMON_MAX_TASKS];  // busiest first
+} sysmon_sample_t;
+
+esp_err_t sysmon_init(void);
+void sysmon_set_period(uint32_t period_ms);
+// age 0 is the latest sample, false until that many were taken
+bool sysmon_get_sample(int age, sysmon_sample_t *sample);
+const char *sysmon_heap_name(sysmon_heap_id_t id);
+
+void sysmon_task(void *pvParameters);
@@ -0,0 +1,301 @@
+/* Runtime monitor.
+ *
+ * uxTaskGetSystemState gives the run time of every task since it started;
+ * the CPU figure of a sample is the difference to the previous one over the
+ * run time counter, which is esp_timer time, so 100% is one core busy for
+ * the whole period whatever the frequency esp_pm chose. Tasks are matched
+ * across samples by their task number, which is never reused. The busy
+ * time of a core is what its idle task did not get.
+ *
+ * The stack figure is FreeRTOS's high-water mark, in bytes on ESP-IDF: the
+ * part of the stack never written since the task started. The heap minimum
+ * is the low-water mark since boot, the largest block is what a single
+ * allocation can get right now.
+ */
+#include "sysmon.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "diagnostics.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#if !CONFIG_FREERTOS_USE_TRACE_FACILITY || !CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+#error "sysmon needs CONFIG_FREERTOS_USE_TRACE_FACILITY and CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS"
+#endif
+
+// Short-lived tasks (boot stages, benchmark load) come on top of the kept ones
+#define SCAN_TASKS (SYSMON_MAX_TASKS + 8)
+
+typedef struct {
+    UBaseType_t number;
+    configRUN_TIME_COUNTER_TYPE run_time;
+} task_run_t;
+
+static const char *TAG = "sysmon";
+
+static const struct {
+    const char *name;
+    uint32_t caps;
+} s_heaps[SYSMON_HEAP_COUNT] = {
+    [SYSMON_HEAP_INTERNAL] = {"internal", MALLOC_CAP_INTERNAL},
+    [SYSMON_HEAP_DMA] = {"dma", MALLOC_CAP_DMA},
+};
+
+// Sampler only
+static TaskStatus_t s_status[SCAN_TASKS];
+static sysmon_task_t s_scan[SCAN_TASKS];
+static task_run_t s_prev[SCAN_TASKS];
+static int s_prev_count = 0;
+static configRUN_TIME_COUNTER_TYPE s_prev_total = 0;
+static sysmon_sample_t s_next;
+
+static sysmon_sample_t s_ring[SYSMON_HISTORY];
+static int s_head = 0;      // next slot written
+static int s_count = 0;
+static uint32_t s_seq = 0;
+static portMUX_TYPE s_ring_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static volatile uint32_t s_period_ms = SYSMON_PERIOD_MS;
+
+// Readers of the history, one each
+static sysmon_sample_t s_cmd_sample;
+static sysmon_sample_t s_cmd_old;
+static sysmon_sample_t s_metrics_sample;
+
+const char *sysmon_heap_name(sysmon_heap_id_t id)
+{
+    return id < SYSMON_HEAP_COUNT ? s_heaps[id].name : "?";
+}
+
+void sysmon_set_period(uint32_t period_ms)
+{
+    s_period_ms = period_ms < SYSMON_MIN_PERIOD_MS ? SYSMON_MIN_PERIOD_MS : period_ms;
+}
+
+bool sysmon_get_sample(int age, sysmon_sample_t *sample)
+{
+    bool found = false;
+
+    portENTER_CRITICAL(&s_ring_lock);
+    if (age >= 0 && age < s_count) {
+        *sample = s_ring[(s_head - 1 - age + SYSMON_HISTORY) % SYSMON_HISTORY];
+        found = true;
+    }
+    portEXIT_CRITICAL(&s_ring_lock);
+    return found;
+}
+
+static configRUN_TIME_COUNTER_TYPE prev_run_time(UBaseType_t number)
+{
+    for (int i = 0; i < s_prev_count; i++) {
+        if (s_prev[i].number == number) {
+            return s_prev[i].run_time;
+        }
+    }
+    // Started since the last sample, all of its run time is new
+    return 0;
+}
+
+static int by_cpu(const void *a, const void *b)
+{
+    return ((const sysmon_task_t *)b)->cpu_permille - ((const sysmon_task_t *)a)->cpu_permille;
+}
+
+static bool take_sample(sysmon_sample_t *s)
+{
+    configRUN_TIME_COUNTER_TYPE total = 0;
+    UBaseType_t n = uxTaskGetSystemState(s_status, SCAN_TASKS, &total);
+    if (n == 0) {
+        ESP_LOGW(TAG, "More than %d tasks, sample skipped", SCAN_TASKS);
+        return false;
+    }
+
+    // Unsigned differences stay right across a counter wrap
+    configRUN_TIME_COUNTER_TYPE period = total - s_prev_total;
+    if (period == 0) {
+        period = 1;
+    }
+
+    memset(s, 0, sizeof(*s));
+    s->time_us = esp_timer_get_time();
+    s->period_us = period;
+
+    for (int i = 0; i < n; i++) {
+        const TaskStatus_t *st = &s_status[i];
+        sysmon_task_t *t = &s_scan[i];
+        uint64_t permille = (uint64_t)(st->ulRunTimeCounter - prev_run_time(st->xTaskNumber)) *
+                            1000 / period;
+
+        strncpy(t->name, st->pcTaskName, sizeof(t->name) - 1);
+        t->name[sizeof(t->name) - 1] = '\0';
+        t->priority = st->uxCurrentPriority;
+        t->cpu_permille = permille > 1000 ? 1000 : permille;
+        t->stack_free = st->usStackHighWaterMark;
+#if CONFIG_FREERTOS_VTASKLIST_INCLUDE_COREID
+        t->core = st->xCoreID == tskNO_AFFINITY ? SYSMON_CORE_ANY : st->xCoreID;
+#else
+        t->core = SYSMON_CORE_ANY;
+#endif
+        for (int core = 0; core < SYSMON_CORES; core++) {
+            if (st->xHandle == xTaskGetIdleTaskHandleForCore(core)) {
+                s->core_permille[core] = 1000 - t->cpu_permille;
+            }
+        }
+
+        s_prev[i] = (task_run_t){.number = st->xTaskNumber, .run_time = st->ulRunTimeCounter};
+    }
+    s_prev_count = n;
+    s_prev_total = total;
+
+    qsort(s_scan, n, sizeof(s_scan[0]), by_cpu);
+    s->task_count = n < SYSMON_MAX_TASKS ? n : SYSMON_MAX_TASKS;
+    s->dropped = n - s->task_count;
+    memcpy(s->tasks, s_scan, s->task_count * sizeof(s->tasks[0]));
+
+    for (int i = 0; i < SYSMON_HEAP_COUNT; i++) {
+        s->heap[i] = (sysmon_heap_t){
+            .free = heap_caps_get_free_size(s_heaps[i].caps),
+            .min_free = heap_caps_get_minimum_free_size(s_heaps[i].caps),
+            .largest_block = heap_caps_get_largest_free_block(s_heaps[i].caps),
+        };
+    }
+    return true;
+}
+
+void sysmon_task(void *pvParameters)
+{
+    while (1) {
+        if (take_sample(&s_next)) {
+            portENTER_CRITICAL(&s_ring_lock);
+            s_next.seq = ++s_seq;
+            s_ring[s_head] = s_next;
+            s_head = (s_head + 1) % SYSMON_HISTORY;
+            s_count += s_count < SYSMON_HISTORY;
+            portEXIT_CRITICAL(&s_ring_lock);
+        }
+        vTaskDelay(pdMS_TO_TICKS(s_period_ms));
+    }
+}
+
+// Highest CPU of a task over the kept history, the current sample included
+static uint16_t peak_permille(const sysmon_task_t *task)
+{
+    uint16_t peak = task->cpu_permille;
+
+    for (int age = 1; sysmon_get_sample(age, &s_cmd_old); age++) {
+        for (int i = 0; i < s_cmd_old.task_count; i++) {
+            const sysmon_task_t *t = &s_cmd_old.tasks[i];
+            if (strcmp(t->name, task->name) == 0 && t->cpu_permille > peak) {
+                peak = t->cpu_permille;
+            }
+        }
+    }
+    return peak;
+}
+
+static int sysmon_cmd(int argc, char **argv)
+{
+    if (argc > 1) {
+        int period_ms = atoi(argv[1]);
+        if (period_ms <= 0) {
+            printf("usage: sysmon [period_ms]\n");
+            return 1;
+        }
+        sysmon_set_period(period_ms);
+        printf("Sampling every %lu ms\n", (unsigned long)s_period_ms);
+        return 0;
+    }
+
+    sysmon_sample_t *s = &s_cmd_sample;
+    if (!sysmon_get_sample(0, s)) {
+        printf("No sample yet\n");
+        return 1;
+    }
+
+    printf("sample %lu, %lu ms, every %lu ms, %d tasks", (unsigned long)s->seq,
+           (unsigned long)(s->period_us / 1000), (unsigned long)s_period_ms,
+           s->task_count + s->dropped);
+    for (int core = 0; core < SYSMON_CORES; core++) {
+        printf(", core %d %.1f%%", core, s->core_permille[core] / 10.0f);
+    }
+    printf("\n");
+
+    printf("task             core prio   cpu%%  peak%%  stack free\n");
+    for (int i = 0; i < s->task_count; i++) {
+        const sysmon_task_t *t = &s->tasks[i];
+        char core[4] = "any";
+        if (t->core != SYSMON_CORE_ANY) {
+            snprintf(core, sizeof(core), "%d", t->core);
+        }
+        printf("%-16s %4s %4u %6.1f %6.1f %11lu\n", t->name, core, (unsigned)t->priority,
+               t->cpu_permille / 10.0f, peak_permille(t) / 10.0f,
+               (unsigned long)t->stack_free);
+    }
+    if (s->dropped) {
+        printf("(%u least busy tasks not kept)\n", (unsigned)s->dropped);
+    }
+
+    printf("heap          free    min free   largest\n");
+    for (int i = 0; i < SYSMON_HEAP_COUNT; i++) {
+        const sysmon_heap_t *h = &s->heap[i];
+        printf("%-8s %9lu %11lu %9lu\n", sysmon_heap_name(i), (unsigned long)h->free,
+               (unsigned long)h->min_free, (unsigned long)h->largest_block);
+    }
+
+    // Oldest first, to see a trend
+    printf("history  core 0%%  core 1%%  internal free  dma largest\n");
+    for (int age = SYSMON_HISTORY - 1; age >= 0; age--) {
+        if (sysmon_get_sample(age, &s_cmd_old)) {
+            printf("%7lu %8.1f %8.1f %14lu %12lu\n", (unsigned long)s_cmd_old.seq,
+                   s_cmd_old.core_permille[0] / 10.0f, s_cmd_old.core_permille[1] / 10.0f,
+                   (unsigned long)s_cmd_old.heap[SYSMON_HEAP_INTERNAL].free,
+                   (unsigned long)s_cmd_old.heap[SYSMON_HEAP_DMA].largest_block);
+        }
+    }
+    return 0;
+}
+
+static void sysmon_metrics(diag_writer_t *w)
+{
+    sysmon_sample_t *s = &s_metrics_sample;
+    if (!sysmon_get_sample(0, s)) {
+        return;
+    }
+
+    diag_printf(w, "sysmon_samples_total %lu\n", (unsigned long)s->seq);
+    diag_printf(w, "sysmon_tasks %u\n", (unsigned)(s->task_count + s->dropped));
+    for (int core = 0; core < SYSMON_CORES; core++) {
+        diag_printf(w, "sysmon_core_busy_percent{core=\"%d\"} %.1f\n", core,
+                    s->core_permille[core] / 10.0f);
+    }
+    for (int i = 0; i < s->task_count; i++) {
+        const sysmon_task_t *t = &s->tasks[i];
+        diag_printf(w, "sysmon_task_cpu_percent{task=\"%s\"} %.1f\n", t->name,
+                    t->cpu_permille / 10.0f);
+        diag_printf(w, "sysmon_task_stack_free_bytes{task=\"%s\"} %lu\n", t->name,
+                    (unsigned long)t->stack_free);
+    }
+    for (int i = 0; i < SYSMON_HEAP_COUNT; i++) {
+        const sysmon_heap_t *h = &s->heap[i];
+        diag_printf(w, "sysmon_heap_free_bytes{cap=\"%s\"} %lu\n", sysmon_heap_name(i),
+                    (unsigned long)h->free);
+        diag_printf(w, "sysmon_heap_min_free_bytes{cap=\"%s\"} %lu\n", sysmon_heap_name(i),
+                    (unsigned long)h->min_free);
+        diag_printf(w, "sysmon_heap_largest_block_bytes{cap=\"%s\"} %lu\n",
+                    sysmon_heap_name(i), (unsigned long)h->largest_block);
+    }
+}
+
+esp_err_t sysmon_init(void)
+{
+    diagnostics_register_command("sysmon", "Per-task CPU and stack headroom, heap, history",
+                                 sysmon_cmd);
+    diagnostics_register_metrics("sysmon", sysmon_metrics);
+    return ESP_OK;
+}
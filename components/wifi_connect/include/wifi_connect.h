@@ -8,11 +8,74 @@
 #define WIFI_PASSWORD "pass"
 #define WIFI_AUTHMODE WIFI_AUTH_WPA2_PSK
 
+// Reconnect to the cached BSSID/channel, full scan if that AP fails
+#define WIFI_FAST_CONNECT 1
+// Also reuse the cached lease instead of DHCP. Only safe with a DHCP
+// reservation for this device, the address is not checked for conflicts
+#define WIFI_FAST_STATIC_IP 0
+
+// Reconnect backoff, doubled after every failed attempt
+#define WIFI_BACKOFF_MIN_MS 1000
+#define WIFI_BACKOFF_MAX_MS 60000
+
+// Radio power policy, can be switched at runtime with wifi_power_set_policy()
+typedef enum {
+    WIFI_POWER_PERFORMANCE,     // radio always awake, lowest latency
+    WIFI_POWER_MODEM_SLEEP,     // radio wakes every WIFI_LISTEN_INTERVAL beacons
+    WIFI_POWER_DUTY_CYCLE,      // Wi-Fi stopped between fetches, fast reconnect for each
+    WIFI_POWER_POLICY_COUNT,
+} wifi_power_policy_t;
+
+#define WIFI_POWER_POLICY       WIFI_POWER_MODEM_SLEEP
+#define WIFI_LISTEN_INTERVAL    3       // beacons (~100 ms each)
+#define WIFI_DUTY_LINGER_MS     2000    // kept up after the last release
+#define WIFI_ACQUIRE_TIMEOUT_MS 15000   // link bring-up for a fetch
+
 #define WIFI_CONNECTED_BIT BIT0
-#define WIFI_FAIL_BIT BIT1
+
+typedef enum {
+    WIFI_LINK_DOWN,
+    WIFI_LINK_CONNECTING,
+    WIFI_LINK_UP,
+    WIFI_LINK_BACKOFF,
+    WIFI_LINK_OFF,              // stopped on purpose
+} wifi_link_state_t;
+
+typedef struct {
+    wifi_link_state_t state;
+    int64_t up_since_us;
+    uint32_t downs;             // up -> down transitions
+    uint32_t reconnects;        // down -> up transitions
+    uint32_t attempts;          // esp_wifi_connect() after a backoff
+    uint32_t last_reconnect_ms;
+    uint32_t max_reconnect_ms;
+    uint64_t downtime_ms;       // since the first connect, includes an ongoing outage
+} wifi_link_stats_t;
+
+typedef struct {
+    uint64_t active_ms;         // time the policy was selected
+    uint64_t radio_on_ms;       // Wi-Fi started; modem sleep still dozes between beacons
+    uint32_t fetches;
+    uint64_t fetch_ms;          // acquire to release, total
+    uint32_t fetch_max_ms;
+} wifi_power_stats_t;
 
 esp_err_t w_init(void);
 esp_err_t w_connect(char* wifi_ssid, char* wifi_password);
 esp_err_t w_disconnect(void);
 esp_err_t w_deinit(void);
+// Stops Wi-Fi without the supervisor reconnecting, w_resume() reconnects
+esp_err_t w_suspend(void);
+esp_err_t w_resume(void);
+void wifi_get_link_stats(wifi_link_stats_t *stats);
+const char *wifi_link_state_name(wifi_link_state_t state);
+
+// Network users hold the radio around a fetch. Waits for the link, bringing
+// Wi-Fi back first under the duty-cycle policy. Release even on a timeout.
+esp_err_t wifi_power_acquire(TickType_t timeout);
+void wifi_power_release(void);
+void wifi_power_set_policy(wifi_power_policy_t policy);
+wifi_power_policy_t wifi_power_get_policy(void);
+void wifi_power_get_stats(wifi_power_policy_t policy, wifi_power_stats_t *stats);
+const char *wifi_power_policy_name(wifi_power_policy_t policy);
 void wifi_connection_task();
@@ -0,0 +1,61 @@
+#include "wifi_cache.h"
+
+#include <string.h>
+
+#include "esp_log.h"
+#include "nvs.h"
+
+#define WIFI_CACHE_NAMESPACE "wifi_cache"
+#define WIFI_CACHE_KEY       "ap"
+#define WIFI_CACHE_VERSION   1
+
+typedef struct {
+    uint8_t version;
+    char ssid[33];
+    wifi_cache_t cache;
+} wifi_cache_blob_t;
+
+static const char *TAG = "wifi_cache";
+
+esp_err_t wifi_cache_load(const char *ssid, wifi_cache_t *cache)
+{
+    wifi_cache_blob_t blob;
+    size_t size = sizeof(blob);
+    nvs_handle_t nvs;
+
+    memset(cache, 0, sizeof(*cache));
+    esp_err_t err = nvs_open(WIFI_CACHE_NAMESPACE, NVS_READONLY, &nvs);
+    if (err != ESP_OK) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    err = nvs_get_blob(nvs, WIFI_CACHE_KEY, &blob, &size);
+    nvs_close(nvs);
+
+    // Another layout or another network, start over
+    if (err != ESP_OK || size != sizeof(blob) || blob.version != WIFI_CACHE_VERSION ||
+        strncmp(blob.ssid, ssid, sizeof(blob.ssid)) != 0) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    *cache = blob.cache;
+    return ESP_OK;
+}
+
+esp_err_t wifi_cache_save(const char *ssid, const wifi_cache_t *cache)
+{
+    wifi_cache_blob_t blob = {.version = WIFI_CACHE_VERSION, .cache = *cache};
+    strncpy(blob.ssid, ssid, sizeof(blob.ssid) - 1);
+
+    nvs_handle_t nvs;
+    esp_err_t err = nvs_open(WIFI_CACHE_NAMESPACE, NVS_READWRITE, &nvs);
+    if (err == ESP_OK) {
+        err = nvs_set_blob(nvs, WIFI_CACHE_KEY, &blob, sizeof(blob));
+        if (err == ESP_OK) {
+            err = nvs_commit(nvs);
+        }
+        nvs_close(nvs);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to save: %s", esp_err_to_name(err));
+    }
+    return err;
+}
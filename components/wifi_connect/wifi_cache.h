@@ -0,0 +1,20 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_netif_types.h"
+
+// Last good association, kept in NVS for the fast connect path
+typedef struct {
+    uint8_t bssid[6];
+    uint8_t channel;            // 0: nothing cached, do a full scan
+    bool has_ip;
+    esp_netif_ip_info_t ip;
+    uint32_t dns;               // main DNS server, network order
+    int64_t fast_us;            // last boot to IP through the cache, 0 if never
+    int64_t scan_us;            // last boot to IP with a full scan, 0 if never
+} wifi_cache_t;
+
+// Zeroes *cache and returns ESP_ERR_NOT_FOUND if nothing is stored for ssid
+esp_err_t wifi_cache_load(const char *ssid, wifi_cache_t *cache);
+esp_err_t wifi_cache_save(const char *ssid, const wifi_cache_t *cache);
@@ -1,9 +1,12 @@
 #include <stdio.h>
+#include <string.h>
 #include "wifi_connect.h"
 #include "openweather.h"
-
-const int WIFI_RETRY_ATTEMPT = 3;
-int wifi_retry_count = 0;
+#include "wifi_cache.h"
+#include "wifi_power.h"
+#include "diagnostics.h"
+#include "esp_random.h"
+#include "esp_timer.h"
 
 esp_netif_t *w_netif = NULL;
 esp_event_handler_instance_t ip_event_handler;
@@ -13,6 +16,271 @@ EventGroupHandle_t s_wifi_event_group = NULL;
 
 const char *TAG = "WIFI_connect";
 
+/* Fast connect: the BSSID and channel of the last association (and with
+ * WIFI_FAST_STATIC_IP its lease) come from NVS, so the driver probes one
+ * channel and DHCP is skipped. If that AP does not answer, the cache is
+ * dropped and the normal full scan takes over. */
+static wifi_config_t s_wifi_config;
+static wifi_cache_t s_cache;
+static bool s_fast = false;             // fast attempt in progress
+static bool s_static_ip = false;        // cached lease applied instead of DHCP
+static bool s_cache_saved = false;      // timings of this boot are in NVS
+
+static struct {
+    int64_t start_us;                   // esp_wifi_start()
+    int64_t boot_to_ip_us;
+    int64_t connect_us;
+    bool fast;                          // path that got the IP
+    uint32_t fallbacks;
+} s_stats;
+
+/* Link supervisor: reconnects forever, waiting an exponential backoff with
+ * jitter between attempts so a dead AP costs a wakeup every minute at most
+ * instead of a retry storm. Consumers follow NET_LINK_UP in data_events and
+ * pause while it is clear. */
+static const char *s_link_state_names[] = {
+    [WIFI_LINK_DOWN] = "down",
+    [WIFI_LINK_CONNECTING] = "connecting",
+    [WIFI_LINK_UP] = "up",
+    [WIFI_LINK_BACKOFF] = "backoff",
+    [WIFI_LINK_OFF] = "off",
+};
+
+static wifi_link_stats_t s_link = {.state = WIFI_LINK_DOWN};
+static bool s_supervise = false;        // false after w_disconnect() or w_suspend()
+static uint32_t s_backoff_ms = WIFI_BACKOFF_MIN_MS;
+static int64_t s_down_since = 0;        // 0 until the link was up once
+static esp_timer_handle_t s_reconnect_timer = NULL;
+static portMUX_TYPE s_link_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static void set_link_state(wifi_link_state_t state)
+{
+    portENTER_CRITICAL(&s_link_lock);
+    s_link.state = state;
+    portEXIT_CRITICAL(&s_link_lock);
+}
+
+static void reconnect_timer_cb(void *arg)
+{
+    if (!s_supervise) {
+        return;
+    }
+    portENTER_CRITICAL(&s_link_lock);
+    s_link.state = WIFI_LINK_CONNECTING;
+    s_link.attempts++;
+    portEXIT_CRITICAL(&s_link_lock);
+    esp_wifi_connect();
+}
+
+static void schedule_reconnect(void)
+{
+    // Half the backoff plus a random part, so devices rebooted by the same
+    // power cut do not hit the AP in lockstep
+    uint32_t delay_ms = s_backoff_ms / 2 + esp_random() % (s_backoff_ms / 2 + 1);
+    s_backoff_ms = s_backoff_ms * 2 > WIFI_BACKOFF_MAX_MS ? WIFI_BACKOFF_MAX_MS
+                                                          : s_backoff_ms * 2;
+    set_link_state(WIFI_LINK_BACKOFF);
+    ESP_LOGI(TAG, "Reconnecting in %lu ms", (unsigned long)delay_ms);
+    esp_timer_stop(s_reconnect_timer);
+    esp_timer_start_once(s_reconnect_timer, (uint64_t)delay_ms * 1000);
+}
+
+static void link_up(void)
+{
+    int64_t now = esp_timer_get_time();
+
+    portENTER_CRITICAL(&s_link_lock);
+    if (s_link.state != WIFI_LINK_UP && s_down_since != 0) {
+        uint32_t down_ms = (now - s_down_since) / 1000;
+        s_link.downtime_ms += down_ms;
+        s_link.last_reconnect_ms = down_ms;
+        s_link.max_reconnect_ms = down_ms > s_link.max_reconnect_ms ? down_ms
+                                                                     : s_link.max_reconnect_ms;
+        s_link.reconnects++;
+    }
+    s_link.state = WIFI_LINK_UP;
+    s_link.up_since_us = now;
+    portEXIT_CRITICAL(&s_link_lock);
+
+    s_backoff_ms = WIFI_BACKOFF_MIN_MS;
+    xEventGroupSetBits(data_events, NET_LINK_UP);
+}
+
+static void link_down(const char *why)
+{
+    portENTER_CRITICAL(&s_link_lock);
+    bool was_up = s_link.state == WIFI_LINK_UP;
+    if (was_up) {
+        s_down_since = esp_timer_get_time();
+        s_link.downs++;
+        s_link.state = WIFI_LINK_DOWN;
+    }
+    portEXIT_CRITICAL(&s_link_lock);
+
+    if (was_up) {
+        ESP_LOGW(TAG, "Link down: %s", why);
+        xEventGroupClearBits(data_events, NET_LINK_UP);
+    }
+}
+
+// Taken down on purpose, neither an outage nor a reason to reconnect
+static void link_off(void)
+{
+    s_supervise = false;
+    esp_timer_stop(s_reconnect_timer);
+
+    portENTER_CRITICAL(&s_link_lock);
+    s_link.state = WIFI_LINK_OFF;
+    s_down_since = 0;
+    portEXIT_CRITICAL(&s_link_lock);
+    xEventGroupClearBits(data_events, NET_LINK_UP);
+}
+
+void wifi_get_link_stats(wifi_link_stats_t *stats)
+{
+    portENTER_CRITICAL(&s_link_lock);
+    *stats = s_link;
+    if (s_link.state != WIFI_LINK_UP && s_down_since != 0) {
+        stats->downtime_ms += (esp_timer_get_time() - s_down_since) / 1000;
+    }
+    portEXIT_CRITICAL(&s_link_lock);
+}
+
+const char *wifi_link_state_name(wifi_link_state_t state)
+{
+    return state < sizeof(s_link_state_names) / sizeof(s_link_state_names[0])
+               ? s_link_state_names[state] : "?";
+}
+
+// Back to the scan config and DHCP, any AP of the network will do
+static void unpin_ap(void)
+{
+    if (s_static_ip) {
+        s_static_ip = false;
+        esp_netif_dhcpc_start(w_netif);
+    }
+    s_wifi_config.sta.bssid_set = false;
+    s_wifi_config.sta.channel = 0;
+    esp_wifi_set_config(WIFI_IF_STA, &s_wifi_config);
+}
+
+static void fall_back_to_scan(void)
+{
+    ESP_LOGW(TAG, "Cached AP did not answer, scanning");
+    s_fast = false;
+    s_stats.fallbacks++;
+    s_cache.channel = 0;
+
+    unpin_ap();
+    esp_wifi_connect();
+}
+
+static void apply_static_ip(void)
+{
+    esp_netif_dns_info_t dns = {0};
+    dns.ip.type = ESP_IPADDR_TYPE_V4;
+    dns.ip.u_addr.ip4.addr = s_cache.dns;
+
+    // Posts IP_EVENT_STA_GOT_IP, so only once associated
+    esp_netif_set_ip_info(w_netif, &s_cache.ip);
+    if (s_cache.dns) {
+        esp_netif_set_dns_info(w_netif, ESP_NETIF_DNS_MAIN, &dns);
+    }
+}
+
+// Event loop task, on every IP
+static void update_cache(void)
+{
+    wifi_ap_record_t ap;
+    esp_netif_ip_info_t ip;
+    esp_netif_dns_info_t dns;
+
+    if (esp_wifi_sta_get_ap_info(&ap) != ESP_OK || esp_netif_get_ip_info(w_netif, &ip) != ESP_OK) {
+        return;
+    }
+
+    wifi_cache_t cache = s_cache;
+    memcpy(cache.bssid, ap.bssid, sizeof(cache.bssid));
+    cache.channel = ap.primary;
+    cache.has_ip = true;
+    cache.ip = ip;
+    cache.dns = esp_netif_get_dns_info(w_netif, ESP_NETIF_DNS_MAIN, &dns) == ESP_OK
+                    ? dns.ip.u_addr.ip4.addr : 0;
+    if (!s_cache_saved && s_stats.fast) {
+        cache.fast_us = s_stats.boot_to_ip_us;
+    } else if (!s_cache_saved) {
+        cache.scan_us = s_stats.boot_to_ip_us;
+    }
+
+    // One write per boot for the timings, more only if the AP or lease moved
+    if (!s_cache_saved || memcmp(&cache, &s_cache, sizeof(cache)) != 0) {
+        s_cache = cache;
+        s_cache_saved = wifi_cache_save((char *)s_wifi_config.sta.ssid, &s_cache) == ESP_OK;
+    }
+}
+
+static void record_got_ip(void)
+{
+    if (s_stats.boot_to_ip_us != 0) {
+        return;     // reconnect
+    }
+    int64_t now = esp_timer_get_time();
+    s_stats.boot_to_ip_us = now;
+    s_stats.connect_us = now - s_stats.start_us;
+    s_stats.fast = s_fast;
+    ESP_LOGI(TAG, "Boot to IP: %lld ms (%s, %lld ms after start)", now / 1000,
+             s_fast ? "cached AP" : "full scan", s_stats.connect_us / 1000);
+}
+
+static int wifi_cmd(int argc, char **argv)
+{
+    wifi_ap_record_t ap;
+
+    if (argc >= 2 && strcmp(argv[1], "power") == 0) {
+        return wifi_power_cmd(argc - 1, argv + 1);
+    }
+
+    printf("boot to IP %lld ms via %s, connect %lld ms, fallbacks %lu\n",
+           s_stats.boot_to_ip_us / 1000, s_stats.fast ? "cached AP" : "full scan",
+           s_stats.connect_us / 1000, (unsigned long)s_stats.fallbacks);
+    printf("last boot to IP: cached AP %lld ms, full scan %lld ms\n",
+           s_cache.fast_us / 1000, s_cache.scan_us / 1000);
+
+    wifi_link_stats_t link;
+    wifi_get_link_stats(&link);
+    printf("link %s, %lu downs, %lu reconnects (last %lu ms, max %lu ms), "
+           "%lu attempts, down %lu s in total\n",
+           wifi_link_state_name(link.state), (unsigned long)link.downs,
+           (unsigned long)link.reconnects, (unsigned long)link.last_reconnect_ms,
+           (unsigned long)link.max_reconnect_ms, (unsigned long)link.attempts,
+           (unsigned long)(link.downtime_ms / 1000));
+    if (esp_wifi_sta_get_ap_info(&ap) == ESP_OK) {
+        printf("AP " MACSTR " channel %d rssi %d\n", MAC2STR(ap.bssid), ap.primary, ap.rssi);
+    }
+    wifi_power_cmd(1, argv);
+    return 0;
+}
+
+static void wifi_metrics(diag_writer_t *w)
+{
+    diag_printf(w, "wifi_boot_to_ip_ms{path=\"%s\"} %lld\n",
+                s_stats.fast ? "cached" : "scan", s_stats.boot_to_ip_us / 1000);
+    diag_printf(w, "wifi_last_boot_to_ip_ms{path=\"cached\"} %lld\n", s_cache.fast_us / 1000);
+    diag_printf(w, "wifi_last_boot_to_ip_ms{path=\"scan\"} %lld\n", s_cache.scan_us / 1000);
+    diag_printf(w, "wifi_fast_fallbacks_total %lu\n", (unsigned long)s_stats.fallbacks);
+
+    wifi_link_stats_t link;
+    wifi_get_link_stats(&link);
+    diag_printf(w, "wifi_link_up %d\n", link.state == WIFI_LINK_UP);
+    diag_printf(w, "wifi_link_downs_total %lu\n", (unsigned long)link.downs);
+    diag_printf(w, "wifi_reconnects_total %lu\n", (unsigned long)link.reconnects);
+    diag_printf(w, "wifi_reconnect_attempts_total %lu\n", (unsigned long)link.attempts);
+    diag_printf(w, "wifi_reconnect_last_ms %lu\n", (unsigned long)link.last_reconnect_ms);
+    diag_printf(w, "wifi_reconnect_max_ms %lu\n", (unsigned long)link.max_reconnect_ms);
+    diag_printf(w, "wifi_downtime_ms_total %llu\n", (unsigned long long)link.downtime_ms);
+    wifi_power_metrics(w);
+}
+
 static void ip_event_cb(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data)
 {
     ESP_LOGI(TAG, "Handling IP event, event code 0x%" PRIx32, event_id);
@@ -21,16 +289,21 @@ static void ip_event_cb(void *arg, esp_event_base_t event_base, int32_t event_id
     case (IP_EVENT_STA_GOT_IP):
         ip_event_got_ip_t *event_ip = (ip_event_got_ip_t *)event_data;
         ESP_LOGI(TAG, "Got IP: " IPSTR, IP2STR(&event_ip->ip_info.ip));
-        wifi_retry_count = 0;
+        record_got_ip();
+        s_fast = false;
+        update_cache();
+        link_up();
         xEventGroupSetBits(s_wifi_event_group, WIFI_CONNECTED_BIT);
         break;
     case (IP_EVENT_STA_LOST_IP):
         ESP_LOGI(TAG, "Lost IP");
+        // Still associated, the DHCP client keeps trying on its own
+        link_down("lost IP");
         break;
     case (IP_EVENT_GOT_IP6):
         ip_event_got_ip6_t *event_ip6 = (ip_event_got_ip6_t *)event_data;
         ESP_LOGI(TAG, "Got IPv6: " IPV6STR, IPV62STR(event_ip6->ip6_info.ip));
-        wifi_retry_count = 0;
+        link_up();
         xEventGroupSetBits(s_wifi_event_group, WIFI_CONNECTED_BIT);
         break;
     default:
@@ -53,6 +326,7 @@ static void wifi_event_cb(void *arg, esp_event_base_t event_base, int32_t event_
         break;
     case (WIFI_EVENT_STA_START):
         ESP_LOGI(TAG, "Wi-Fi started, connecting to AP...");
+        set_link_state(WIFI_LINK_CONNECTING);
         esp_wifi_connect();
         break;
     case (WIFI_EVENT_STA_STOP):
@@ -60,16 +334,27 @@ static void wifi_event_cb(void *arg, esp_event_base_t event_base, int32_t event_
         break;
     case (WIFI_EVENT_STA_CONNECTED):
         ESP_LOGI(TAG, "Wi-Fi connected");
+        if (s_static_ip) {
+            apply_static_ip();
+        }
         break;
     case (WIFI_EVENT_STA_DISCONNECTED):
-        ESP_LOGI(TAG, "Wi-Fi disconnected");
-        if (wifi_retry_count < WIFI_RETRY_ATTEMPT) {
-            ESP_LOGI(TAG, "Retrying to connect to Wi-Fi network...");
-            esp_wifi_connect();
-            wifi_retry_count++;
+        wifi_event_sta_disconnected_t *event_disc = (wifi_event_sta_disconnected_t *)event_data;
+        ESP_LOGI(TAG, "Wi-Fi disconnected, reason %d", event_disc->reason);
+        link_down("disconnected");
+        if (!s_supervise) {
+            break;
+        } else if (s_fast) {
+            fall_back_to_scan();
         } else {
-            ESP_LOGI(TAG, "Failed to connect to Wi-Fi network");
-            xEventGroupSetBits(s_wifi_event_group, WIFI_FAIL_BIT);
+            // The cached AP was reached at boot but the link to it dropped.
+            // It may be gone for good in a multi-AP network, so the
+            // supervisor scans rather than asking for that BSSID forever
+            if (s_wifi_config.sta.bssid_set) {
+                ESP_LOGI(TAG, "Lost the cached AP, reconnecting with a scan");
+                unpin_ap();
+            }
+            schedule_reconnect();
         }
         break;
     case (WIFI_EVENT_STA_AUTHMODE_CHANGE):
@@ -120,6 +405,7 @@ esp_err_t w_init(void)
     // Wi-Fi stack configuration parameters
     wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
     ESP_ERROR_CHECK(esp_wifi_init(&cfg));
+    wifi_power_init();
 
     ESP_ERROR_CHECK(esp_event_handler_instance_register(WIFI_EVENT,
                                                         ESP_EVENT_ANY_ID,
@@ -131,9 +417,40 @@ esp_err_t w_init(void)
                                                         &ip_event_cb,
                                                         NULL,
                                                         &ip_event_handler));
+
+    const esp_timer_create_args_t timer_args = {
+        .callback = reconnect_timer_cb,
+        .name = "wifi_reconnect",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&timer_args, &s_reconnect_timer));
+
+    diagnostics_register_command("wifi",
+                                 "Link state, reconnects and boot to IP times. "
+                                 "'wifi power <performance|modem|duty>' sets the power policy",
+                                 wifi_cmd);
+    diagnostics_register_metrics("wifi", wifi_metrics);
     return ret;
 }
 
+static void use_cached_ap(wifi_config_t *config)
+{
+    if (s_cache.channel == 0) {
+        return;
+    }
+
+    // Straight to the last AP, the driver only probes its channel
+    config->sta.bssid_set = true;
+    memcpy(config->sta.bssid, s_cache.bssid, sizeof(s_cache.bssid));
+    config->sta.channel = s_cache.channel;
+    s_fast = true;
+
+    if (WIFI_FAST_STATIC_IP && s_cache.has_ip) {
+        s_static_ip = esp_netif_dhcpc_stop(w_netif) == ESP_OK;
+    }
+    ESP_LOGI(TAG, "Fast connect to " MACSTR " on channel %d%s", MAC2STR(s_cache.bssid),
+             s_cache.channel, s_static_ip ? ", cached IP" : "");
+}
+
 esp_err_t w_connect(char* wifi_ssid, char* wifi_password)
 {
     wifi_config_t wifi_config = {
@@ -146,32 +463,59 @@ esp_err_t w_connect(char* wifi_ssid, char* wifi_password)
     strncpy((char*)wifi_config.sta.ssid, wifi_ssid, sizeof(wifi_config.sta.ssid));
     strncpy((char*)wifi_config.sta.password, wifi_password, sizeof(wifi_config.sta.password));
 
-    ESP_ERROR_CHECK(esp_wifi_set_ps(WIFI_PS_NONE)); // default is WIFI_PS_MIN_MODEM
+    // Only used by modem sleep, the AP buffers frames for this many beacons
+    wifi_config.sta.listen_interval = WIFI_LISTEN_INTERVAL;
+
+    if (WIFI_FAST_CONNECT && wifi_cache_load(wifi_ssid, &s_cache) == ESP_OK) {
+        use_cached_ap(&wifi_config);
+    }
+    s_wifi_config = wifi_config;
+
     ESP_ERROR_CHECK(esp_wifi_set_storage(WIFI_STORAGE_RAM)); // default is WIFI_STORAGE_FLASH
 
     ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
     ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config));
 
     ESP_LOGI(TAG, "Connecting to Wi-Fi network: %s", wifi_config.sta.ssid);
+    s_stats.start_us = esp_timer_get_time();
+    s_supervise = true;
     ESP_ERROR_CHECK(esp_wifi_start());
 
-    EventBits_t bits = xEventGroupWaitBits(s_wifi_event_group, WIFI_CONNECTED_BIT | WIFI_FAIL_BIT,
+    // The supervisor never gives up, this returns once the link is up
+    EventBits_t bits = xEventGroupWaitBits(s_wifi_event_group, WIFI_CONNECTED_BIT,
         pdFALSE, pdFALSE, portMAX_DELAY);
 
     if (bits & WIFI_CONNECTED_BIT) {
         ESP_LOGI(TAG, "Connected to Wi-Fi network: %s", wifi_config.sta.ssid);
         return ESP_OK;
-    } else if (bits & WIFI_FAIL_BIT) {
-        ESP_LOGE(TAG, "Failed to connect to Wi-Fi network: %s", wifi_config.sta.ssid);
-        return ESP_FAIL;
     }
 
     ESP_LOGE(TAG, "Unexpected Wi-Fi error");
     return ESP_FAIL;
 }
 
+esp_err_t w_suspend(void)
+{
+    link_off();
+    return esp_wifi_stop();
+}
+
+esp_err_t w_resume(void)
+{
+    // The cache holds the AP of the last connection, a fast reconnect
+    if (WIFI_FAST_CONNECT) {
+        use_cached_ap(&s_wifi_config);
+        esp_wifi_set_config(WIFI_IF_STA, &s_wifi_config);
+    }
+    s_supervise = true;
+    set_link_state(WIFI_LINK_CONNECTING);
+    return esp_wifi_start();
+}
+
 esp_err_t w_disconnect(void)
 {
+    link_off();
+
     if (s_wifi_event_group) {
         vEventGroupDelete(s_wifi_event_group);
     }
@@ -232,7 +576,6 @@ void wifi_connection_task()
         ESP_LOGI(TAG, "--------------------------------");
     }
 
-    vTaskDelay(2000 / portTICK_PERIOD_MS);
     ESP_LOGI(TAG, "Wifi was initiated");
     xEventGroupSetBits(data_events, WIFI_READY);
     vTaskDelete(NULL);
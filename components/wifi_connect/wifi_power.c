@@ -0,0 +1,244 @@
+/* Radio power policy.
+ *
+ * Performance keeps the radio awake, modem sleep lets it doze between
+ * beacons and wake every WIFI_LISTEN_INTERVAL of them. The duty cycle
+ * policy stops Wi-Fi entirely once the last user released the radio and
+ * restarts it, through the cached AP, on the next wifi_power_acquire().
+ * /metrics and SNTP are unreachable while it is off.
+ *
+ * Time spent under each policy, time with Wi-Fi started and the duration
+ * of every acquire-to-release session are accounted per policy, so the
+ * policies can be compared on the same device.
+ */
+#include "wifi_power.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_event.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
+#include "freertos/semphr.h"
+#include "openweather.h"
+#include "wifi_connect.h"
+
+static const char *TAG = "wifi_power";
+
+ESP_EVENT_DEFINE_BASE(WIFI_POWER_EVENT);
+
+enum {
+    WIFI_POWER_EVENT_LINGER_DONE,
+};
+
+static const char *s_policy_names[] = {
+    [WIFI_POWER_PERFORMANCE] = "performance",
+    [WIFI_POWER_MODEM_SLEEP] = "modem",
+    [WIFI_POWER_DUTY_CYCLE] = "duty",
+};
+
+static SemaphoreHandle_t s_lock = NULL;
+static esp_timer_handle_t s_linger_timer = NULL;
+static wifi_power_policy_t s_policy = WIFI_POWER_POLICY;
+static int s_users = 0;
+static bool s_radio_on = false;
+static int64_t s_accounted_us = 0;
+static int64_t s_session_us = 0;        // first acquire of the running session
+static wifi_power_stats_t s_stats[WIFI_POWER_POLICY_COUNT];
+
+// Called with s_lock held
+static void account(void)
+{
+    int64_t now = esp_timer_get_time();
+    uint64_t ms = (now - s_accounted_us) / 1000;
+
+    s_stats[s_policy].active_ms += ms;
+    if (s_radio_on) {
+        s_stats[s_policy].radio_on_ms += ms;
+    }
+    // Keep the remainder, so frequent calls do not lose time
+    s_accounted_us += ms * 1000;
+}
+
+static void set_radio(bool on)
+{
+    if (on == s_radio_on) {
+        return;
+    }
+    account();
+    s_radio_on = on;
+    ESP_LOGI(TAG, "Radio %s", on ? "on" : "off");
+    if (on) {
+        w_resume();
+    } else {
+        w_suspend();
+    }
+}
+
+static void apply_ps(void)
+{
+    esp_wifi_set_ps(s_policy == WIFI_POWER_PERFORMANCE ? WIFI_PS_NONE : WIFI_PS_MAX_MODEM);
+}
+
+// esp_wifi_stop() takes tens of ms, too long for the esp_timer task and the
+// clock tick that shares it. The suspend runs in the event loop task with
+// the Wi-Fi event handlers instead.
+static void linger_event_cb(void *arg, esp_event_base_t base, int32_t id, void *data)
+{
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    // An acquire may have come in since the timer fired
+    if (s_users == 0 && s_policy == WIFI_POWER_DUTY_CYCLE) {
+        set_radio(false);
+    }
+    xSemaphoreGive(s_lock);
+}
+
+static void linger_cb(void *arg)
+{
+    if (esp_event_post(WIFI_POWER_EVENT, WIFI_POWER_EVENT_LINGER_DONE, NULL, 0, 0) != ESP_OK) {
+        // Event queue full, try again after another linger
+        esp_timer_start_once(s_linger_timer, WIFI_DUTY_LINGER_MS * 1000);
+    }
+}
+
+esp_err_t wifi_power_acquire(TickType_t timeout)
+{
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    if (s_users++ == 0) {
+        s_session_us = esp_timer_get_time();
+        esp_timer_stop(s_linger_timer);
+    }
+    set_radio(true);
+    xSemaphoreGive(s_lock);
+
+    EventBits_t bits = xEventGroupWaitBits(data_events, NET_LINK_UP, pdFALSE, pdTRUE, timeout);
+    return (bits & NET_LINK_UP) ? ESP_OK : ESP_ERR_TIMEOUT;
+}
+
+void wifi_power_release(void)
+{
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    if (s_users > 0 && --s_users == 0) {
+        wifi_power_stats_t *stats = &s_stats[s_policy];
+        uint32_t ms = (esp_timer_get_time() - s_session_us) / 1000;
+        stats->fetches++;
+        stats->fetch_ms += ms;
+        stats->fetch_max_ms = ms > stats->fetch_max_ms ? ms : stats->fetch_max_ms;
+
+        if (s_policy == WIFI_POWER_DUTY_CYCLE) {
+            esp_timer_start_once(s_linger_timer, WIFI_DUTY_LINGER_MS * 1000);
+        }
+    }
+    xSemaphoreGive(s_lock);
+}
+
+void wifi_power_set_policy(wifi_power_policy_t policy)
+{
+    if (policy >= WIFI_POWER_POLICY_COUNT) {
+        return;
+    }
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    account();
+    s_policy = policy;
+    apply_ps();
+    if (policy != WIFI_POWER_DUTY_CYCLE) {
+        esp_timer_stop(s_linger_timer);
+        set_radio(true);
+    } else if (s_users == 0) {
+        esp_timer_start_once(s_linger_timer, WIFI_DUTY_LINGER_MS * 1000);
+    }
+    xSemaphoreGive(s_lock);
+
+    ESP_LOGI(TAG, "Policy: %s", s_policy_names[policy]);
+}
+
+wifi_power_policy_t wifi_power_get_policy(void)
+{
+    return s_policy;
+}
+
+void wifi_power_get_stats(wifi_power_policy_t policy, wifi_power_stats_t *stats)
+{
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    account();
+    *stats = s_stats[policy];
+    xSemaphoreGive(s_lock);
+}
+
+const char *wifi_power_policy_name(wifi_power_policy_t policy)
+{
+    return policy < WIFI_POWER_POLICY_COUNT ? s_policy_names[policy] : "?";
+}
+
+static uint32_t radio_ms_per_hour(const wifi_power_stats_t *stats)
+{
+    return stats->active_ms ? stats->radio_on_ms * 3600000 / stats->active_ms : 0;
+}
+
+int wifi_power_cmd(int argc, char **argv)
+{
+    if (argc >= 2) {
+        for (int i = 0; i < WIFI_POWER_POLICY_COUNT; i++) {
+            if (strcmp(argv[1], s_policy_names[i]) == 0) {
+                wifi_power_set_policy(i);
+                break;
+            }
+        }
+    }
+
+    printf("power policy %s\n", s_policy_names[s_policy]);
+    for (int i = 0; i < WIFI_POWER_POLICY_COUNT; i++) {
+        wifi_power_stats_t s;
+        wifi_power_get_stats(i, &s);
+        if (s.active_ms == 0) {
+            continue;
+        }
+        printf("  %-11s %6llu s, radio on %4lu s/h, %lu fetches avg %llu max %lu ms\n",
+               s_policy_names[i], (unsigned long long)(s.active_ms / 1000),
+               (unsigned long)(radio_ms_per_hour(&s) / 1000), (unsigned long)s.fetches,
+               (unsigned long long)(s.fetches ? s.fetch_ms / s.fetches : 0),
+               (unsigned long)s.fetch_max_ms);
+    }
+    return 0;
+}
+
+void wifi_power_metrics(diag_writer_t *w)
+{
+    for (int i = 0; i < WIFI_POWER_POLICY_COUNT; i++) {
+        wifi_power_stats_t s;
+        wifi_power_get_stats(i, &s);
+        const char *name = s_policy_names[i];
+        diag_printf(w, "wifi_power_active{policy=\"%s\"} %d\n", name, i == s_policy);
+        diag_printf(w, "wifi_power_active_ms_total{policy=\"%s\"} %llu\n", name,
+                    (unsigned long long)s.active_ms);
+        diag_printf(w, "wifi_radio_on_ms_total{policy=\"%s\"} %llu\n", name,
+                    (unsigned long long)s.radio_on_ms);
+        diag_printf(w, "wifi_radio_on_ms_per_hour{policy=\"%s\"} %lu\n", name,
+                    (unsigned long)radio_ms_per_hour(&s));
+        diag_printf(w, "wifi_fetches_total{policy=\"%s\"} %lu\n", name,
+                    (unsigned long)s.fetches);
+        diag_printf(w, "wifi_fetch_ms_total{policy=\"%s\"} %llu\n", name,
+                    (unsigned long long)s.fetch_ms);
+        diag_printf(w, "wifi_fetch_max_ms{policy=\"%s\"} %lu\n", name,
+                    (unsigned long)s.fetch_max_ms);
+    }
+}
+
+void wifi_power_init(void)
+{
+    const esp_timer_create_args_t timer_args = {
+        .callback = linger_cb,
+        .name = "wifi_linger",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&timer_args, &s_linger_timer));
+    ESP_ERROR_CHECK(esp_event_handler_register(WIFI_POWER_EVENT, WIFI_POWER_EVENT_LINGER_DONE,
+                                               linger_event_cb, NULL));
+    s_lock = xSemaphoreCreateMutex();
+
+    // Wi-Fi is started by w_connect() right after
+    s_accounted_us = esp_timer_get_time();
+    s_radio_on = true;
+    apply_ps();
+    ESP_LOGI(TAG, "Policy: %s", s_policy_names[s_policy]);
+}
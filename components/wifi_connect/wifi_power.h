@@ -0,0 +1,7 @@
+#include "diagnostics.h"
+
+// Sets the power save mode of the configured policy, after esp_wifi_init()
+void wifi_power_init(void);
+// "power [policy]" part of the wifi command, and its metrics
+int wifi_power_cmd(int argc, char **argv);
+void wifi_power_metrics(diag_writer_t *w);
@@ -3,12 +3,23 @@
 
 #include "openweather.h"
 
+#include "backlight.h"
+#include "boot.h"
 #include "buttons.h"
+#include "diagnostics.h"
+#include "esp_attr.h"
+#include "font_pack.h"
 #include "freertos/idf_additions.h"
 #include "get_sensor_data.h"
 #include "get_time.h"
 #include "get_weather.h"
+#include "nvs_flash.h"
+#include "power.h"
+#include "screen_manager.h"
+#include "sched_bench.h"
 #include "st7789.h"
+#include "sysmon.h"
+#include "task_plan.h"
 #include "wifi_connect.h"
 
 static const char* TAG = "main";
@@ -19,26 +30,194 @@ SemaphoreHandle_t sensor_mutex;
 SemaphoreHandle_t time_mutex;
 SemaphoreHandle_t weather_mutex;
 
-sensor_data_t g_sensor_data = {0};
-time_data_t g_time_data = {0};
-weather_data_t g_weather_data = {0};
+// RTC slow memory: a deep sleep wake shows the last data right away
+RTC_DATA_ATTR sensor_data_t g_sensor_data = {0};
+RTC_DATA_ATTR time_data_t g_time_data = {0};
+RTC_DATA_ATTR weather_data_t g_weather_data = {0};
+
+/* Boot stages, see components/boot. The data stages end with the first
+ * sample, so the timeline shows when each source became available. */
+
+enum {
+    STAGE_NVS,
+    STAGE_FONTS,
+    STAGE_LCD,
+    STAGE_CONSOLE,
+    STAGE_SENSOR,
+    STAGE_WIFI,
+    STAGE_HTTP,
+    STAGE_SNTP,
+    STAGE_FETCH,
+    STAGE_INPUT,
+};
+
+static esp_err_t wait_data(EventBits_t bit) {
+    xEventGroupWaitBits(data_events, bit, pdFALSE, pdTRUE, portMAX_DELAY);
+    return ESP_OK;
+}
 
-lv_obj_t* label_co2 = NULL;
-lv_obj_t* label_temp = NULL;
-lv_obj_t* label_humid = NULL;
-lv_obj_t* label_time = NULL;
-lv_obj_t* label_info = NULL;
-lv_obj_t* label_date = NULL;
+static esp_err_t stage_nvs(void) {
+    esp_err_t ret = nvs_flash_init();
+    if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
+        ESP_ERROR_CHECK(nvs_flash_erase());
+        ret = nvs_flash_init();
+    }
+    return ret;
+}
 
-lv_obj_t* label_out_temp = NULL;
-lv_obj_t* label_out_feels = NULL;
-lv_obj_t* label_out_humidity = NULL;
-lv_obj_t* label_out_cond = NULL;
-lv_obj_t* label_out_wind = NULL;
+static esp_err_t stage_fonts(void) {
+    // Localised weather text needs the CJK glyphs from the font pack
+    if (font_pack_init() == ESP_OK && font_pack_get(UI_CJK_FONT, NULL)) {
+        weather_set_lang(WEATHER_LANG_LOCAL);
+    }
+    return ESP_OK;
+}
 
-lv_obj_t* screen_sensor = NULL;
-lv_obj_t* screen_info = NULL;
-lv_obj_t* screen_weather = NULL;
+static esp_err_t stage_lcd(void) {
+    init_start_screen();
+    task_start(TASK_BACKLIGHT, NULL);
+    return ESP_OK;
+}
+
+static esp_err_t stage_console(void) {
+    return diagnostics_start_console();
+}
+
+// I2C and the SCD41's 5 s warm-up, in parallel with Wi-Fi
+static esp_err_t stage_sensor(void) {
+    task_start(TASK_SENSOR, NULL);
+    return wait_data(SENSOR_DATA_READY);
+}
+
+// The supervisor never gives up, so neither does this stage
+static esp_err_t stage_wifi(void) {
+    task_start(TASK_WIFI, NULL);
+    return wait_data(WIFI_READY);
+}
+
+static esp_err_t stage_http(void) {
+    return diagnostics_start_http();
+}
+
+static esp_err_t stage_sntp(void) {
+    task_start(TASK_TIME, NULL);
+    return wait_data(TIME_DATA_READY);
+}
+
+static esp_err_t stage_fetch(void) {
+    task_start(TASK_WEATHER, NULL);
+    return wait_data(WEATHER_DATA_READY);
+}
+
+static esp_err_t stage_input(void) {
+    esp_err_t err = buttons_init();
+    if (err == ESP_OK) {
+        task_start(TASK_INPUT, NULL);
+    }
+    return err;
+}
+
+static const boot_stage_t boot_stages[] = {
+    [STAGE_NVS] = {"nvs", stage_nvs, 0, 0, tskNO_AFFINITY},
+    [STAGE_FONTS] = {"fonts", stage_fonts, 0, 0, tskNO_AFFINITY},
+    [STAGE_LCD] = {"lcd", stage_lcd, BOOT_DEP(STAGE_FONTS), 4096, UI_TASK_CORE},
+    [STAGE_CONSOLE] = {"console", stage_console, 0, 0, tskNO_AFFINITY},
+    [STAGE_SENSOR] = {"sensor", stage_sensor, 0, 0, SENSOR_TASK_CORE},
+    [STAGE_WIFI] = {"wifi", stage_wifi, BOOT_DEP(STAGE_NVS), 0, NET_TASK_CORE},
+    [STAGE_HTTP] = {"http", stage_http, BOOT_DEP(STAGE_WIFI), 0, NET_TASK_CORE},
+    [STAGE_SNTP] = {"sntp", stage_sntp, BOOT_DEP(STAGE_WIFI), 0, NET_TASK_CORE},
+    [STAGE_FETCH] = {"fetch", stage_fetch, BOOT_DEP(STAGE_WIFI), 0, NET_TASK_CORE},
+    [STAGE_INPUT] = {"input", stage_input, BOOT_DEP(STAGE_LCD), 0, UI_TASK_CORE},
+};
+
+/* Battery mode wake cycle, see components/power. The same stages without
+ * the console and diagnostics server; the network stages come last, so a
+ * cycle that does not need them just starts fewer stages. */
+
+enum {
+    CYCLE_NVS,
+    CYCLE_FONTS,
+    CYCLE_LCD,
+    CYCLE_SENSOR,
+    CYCLE_INPUT,
+    CYCLE_WIFI,
+    CYCLE_FETCH,
+    CYCLE_SNTP,
+    CYCLE_COUNT,
+};
+
+static const boot_stage_t cycle_stages[] = {
+    [CYCLE_NVS] = {"nvs", stage_nvs, 0, 0, tskNO_AFFINITY},
+    [CYCLE_FONTS] = {"fonts", stage_fonts, 0, 0, tskNO_AFFINITY},
+    [CYCLE_LCD] = {"lcd", stage_lcd, BOOT_DEP(CYCLE_FONTS), 4096, UI_TASK_CORE},
+    [CYCLE_SENSOR] = {"sensor", stage_sensor, 0, 0, SENSOR_TASK_CORE},
+    [CYCLE_INPUT] = {"input", stage_input, BOOT_DEP(CYCLE_LCD), 0, UI_TASK_CORE},
+    [CYCLE_WIFI] = {"wifi", stage_wifi, BOOT_DEP(CYCLE_NVS), 0, NET_TASK_CORE},
+    [CYCLE_FETCH] = {"fetch", stage_fetch, BOOT_DEP(CYCLE_WIFI), 0, NET_TASK_CORE},
+    [CYCLE_SNTP] = {"sntp", stage_sntp, BOOT_DEP(CYCLE_WIFI), 0, NET_TASK_CORE},
+};
+
+static void wake_cycle(void) {
+    power_wake_t wake = power_wake_cause();
+    // A button wake means someone looks at the panel, bring it up to date
+    bool fetch = wake == POWER_WAKE_BUTTON || power_cycle_due(POWER_WEATHER_EVERY);
+    bool sync = fetch && (!g_time_data.synced || power_cycle_due(POWER_TIME_SYNC_EVERY));
+    int count = sync ? CYCLE_COUNT : fetch ? CYCLE_SNTP : CYCLE_WIFI;
+
+    ESP_ERROR_CHECK(boot_start(cycle_stages, count));
+    // The RTC kept the clock, no need to wait for SNTP
+    time_publish();
+
+    uint32_t awake_ms = wake == POWER_WAKE_BUTTON ? POWER_BUTTON_AWAKE_MS : POWER_AWAKE_MAX_MS;
+    const EventBits_t data_bits = SENSOR_DATA_READY | TIME_DATA_READY | WEATHER_DATA_READY |
+                                  HISTORY_DATA_READY | CLOCK_TICK;
+    TickType_t start = xTaskGetTickCount();
+    bool done = false;
+    while (xTaskGetTickCount() - start < pdMS_TO_TICKS(awake_ms)) {
+        EventBits_t bits = xEventGroupWaitBits(data_events, data_bits, pdTRUE, pdFALSE,
+                                               pdMS_TO_TICKS(100));
+        screen_manager_update(bits);
+
+        done = done || boot_wait(BOOT_DEP(count) - 1, 0);
+        // After a button the panel stays up for the full time
+        if (done && wake != POWER_WAKE_BUTTON) {
+            break;
+        }
+    }
+    if (!done) {
+        ESP_LOGW(TAG, "Cycle timed out, going back to sleep");
+        boot_log_timeline();
+    }
+
+    // The last stage may have posted its data after the wait above
+    screen_manager_update(xEventGroupClearBits(data_events, data_bits));
+
+    sensor_sleep();
+    lcd_sleep();
+    power_deep_sleep();
+}
+
+// Applies data events to the UI, on the UI core, see task_plan.h
+void ui_task(void *pvParameters) {
+    while (1) {
+        EventBits_t bits = xEventGroupWaitBits(
+            data_events,
+            SENSOR_DATA_READY | TIME_DATA_READY | WEATHER_DATA_READY | HISTORY_DATA_READY |
+                CLOCK_TICK | SCHED_BENCH_EVENT,
+            pdTRUE,  // Clear bits on exit
+            pdFALSE, // Wait for ANY bit (not all)
+            portMAX_DELAY
+        );
+
+        if (bits & SCHED_BENCH_EVENT) {
+            sched_bench_on_ui();
+        }
+        // Only the visible screen is touched, hidden screens refresh on show
+        screen_manager_update(bits);
+        // Keep the next screen ready for the button
+        lcd_prerender_update(bits);
+    }
+}
 
 void app_main(void) {
     sensor_mutex = xSemaphoreCreateMutex();
@@ -47,135 +226,22 @@ void app_main(void) {
 
     data_events = xEventGroupCreate();
 
-    init_start_screen();
-
-    // xTaskCreate(wifi_connection_task, "wifi_connection_task", 4096, NULL, 6,
-    // NULL);
-
-    // EventBits_t bits = xEventGroupWaitBits(
-    //     data_events,
-    //     WIFI_READY,
-    //     pdTRUE,  // Clear bits on exit
-    //     pdTRUE,
-    //     pdMS_TO_TICKS(20000)
-    // );
-    //
-    // if (bits & WIFI_READY) {
-    //
-    //     xTaskCreate(sensor_task, "sensor_task", 4096, NULL, 5, NULL);
-    //     xTaskCreate(time_task, "time_task", 4096, NULL, 5, NULL);
-    //     xTaskCreate(weather_task, "weather_task", 8192, NULL, 5, NULL);
-    //
-    //     vTaskDelay(pdMS_TO_TICKS(500));
-    //
-    //     xTaskCreate(on_off_button_task, "on_off_button_task", 4096, NULL, 3,
-    //     NULL); xTaskCreate(next_screen_button_task, "next_screen_button_task",
-    //     4096, NULL, 3, NULL);
-    // }
-
-    // check_modules_state();
-
-    // while (1) {
-    //     bits = xEventGroupWaitBits(
-    //         data_events,
-    //         SENSOR_DATA_READY | TIME_DATA_READY | WEATHER_DATA_READY,
-    //         pdTRUE,  // Clear bits on exit
-    //         pdFALSE, // Wait for ANY bit (not all)
-    //         portMAX_DELAY
-    //     );
-    //
-    //     char sensor_buffer[64];
-    //     if (bits & SENSOR_DATA_READY) {
-    //         if (xSemaphoreTake(sensor_mutex, pdMS_TO_TICKS(100)) == pdTRUE) {
-    //             ESP_LOGI(TAG, "Processing sensor: CO2=%d ppm, Temp=%.1f°C,
-    //             Hum=%.1f%%",
-    //                     g_sensor_data.co2_ppm, g_sensor_data.temperature,
-    //                     g_sensor_data.humidity);
-    //
-    //             if (lvgl_port_lock(0)) {
-    //                 if (label_co2) {
-    //                     if (g_sensor_data.co2_ppm > 1000) {
-    //                         lv_obj_set_pos(label_co2, 63, 260);
-    //                     } else {
-    //                         lv_obj_set_pos(label_co2, 80, 260);
-    //                     }
-    //                     snprintf(sensor_buffer, sizeof(sensor_buffer), "%d",
-    //                     g_sensor_data.co2_ppm); lv_label_set_text(label_co2,
-    //                     sensor_buffer);
-    //                 }
-    //                 if (label_temp) {
-    //                     snprintf(sensor_buffer, sizeof(sensor_buffer), "%.1f",
-    //                     g_sensor_data.temperature);
-    //                     lv_label_set_text(label_temp, sensor_buffer);
-    //                 }
-    //                 if (label_humid) {
-    //                     snprintf(sensor_buffer, sizeof(sensor_buffer), "%.1f",
-    //                     g_sensor_data.humidity); lv_label_set_text(label_humid,
-    //                     sensor_buffer);
-    //                 }
-    //                 lvgl_port_unlock();
-    //             }
-    //
-    //             xSemaphoreGive(sensor_mutex);
-    //         }
-    //     }
-    //     char time_buffer[64];
-    //     if (bits & TIME_DATA_READY) {
-    //         if (xSemaphoreTake(time_mutex, pdMS_TO_TICKS(100)) == pdTRUE) {
-    //             ESP_LOGI(TAG, "Processing time: %02d:%02d:%02d",
-    //                     g_time_data.timeinfo.tm_hour,
-    //                     g_time_data.timeinfo.tm_min,
-    //                     g_time_data.timeinfo.tm_sec);
-    //
-    //             if (lvgl_port_lock(0)) {
-    //                 strftime(time_buffer, sizeof(time_buffer), "%I:%M %p",
-    //                 &g_time_data.timeinfo); lv_label_set_text(label_time,
-    //                 time_buffer);
-    //
-    //                 strftime(time_buffer, sizeof(time_buffer), "%Y/%m/%d",
-    //                 &g_time_data.timeinfo); lv_label_set_text(label_date,
-    //                 time_buffer); lvgl_port_unlock();
-    //             }
-    //             xSemaphoreGive(time_mutex);
-    //         }
-    //     }
-    //     char weather_buffer[128];
-    //     if (bits & WEATHER_DATA_READY) {
-    //         if (xSemaphoreTake(weather_mutex, pdMS_TO_TICKS(100)) == pdTRUE) {
-    //
-    //             ESP_LOGI(TAG, "Processing weather: %.1f°C, %s",
-    //                     g_weather_data.temperature, g_weather_data.condition);
-    //
-    //             if (lvgl_port_lock(0)) {
-    //                 // Update temperature
-    //                 snprintf(weather_buffer, sizeof(weather_buffer), "%d",
-    //                         (int)g_weather_data.temperature);
-    //                 lv_label_set_text(label_out_temp, weather_buffer);
-    //
-    //                 // Update feels like
-    //                 snprintf(weather_buffer, sizeof(weather_buffer), "(%d°C)",
-    //                         (int)g_weather_data.feels_like);
-    //                 lv_label_set_text(label_out_feels, weather_buffer);
-    //
-    //                 // Update humidity
-    //                 snprintf(weather_buffer, sizeof(weather_buffer), "%d",
-    //                         g_weather_data.humidity);
-    //                 lv_label_set_text(label_out_humidity, weather_buffer);
-    //
-    //                 // Update condition
-    //                 lv_label_set_text(label_out_cond,
-    //                 g_weather_data.condition);
-    //
-    //                 // Update wind speed
-    //                 snprintf(weather_buffer, sizeof(weather_buffer), "%.1f",
-    //                         g_weather_data.wind_speed);
-    //                 lv_label_set_text(label_out_wind, weather_buffer);
-    //
-    //                 lvgl_port_unlock();
-    //             }
-    //
-    //             xSemaphoreGive(weather_mutex);
-    //         }
-    //     }
-    // }
+    // Before any driver comes up, so each one sees the final clock setup
+    ESP_ERROR_CHECK(power_init());
+    if (POWER_DEEP_SLEEP) {
+        wake_cycle();
+    }
+    ESP_ERROR_CHECK(sched_bench_init());
+    // From the start, so the boot stages show up in the first samples
+    ESP_ERROR_CHECK(sysmon_init());
+    task_start(TASK_SYSMON, NULL);
+    ESP_ERROR_CHECK(boot_start(boot_stages, sizeof(boot_stages) / sizeof(boot_stages[0])));
+    boot_wait(BOOT_DEP(STAGE_LCD), portMAX_DELAY);
+
+    check_modules_state();
+    lcd_benchmark(LCD_BENCHMARK_FRAMES);
+
+    // The event loop moves to the UI core, the main task ends here
+    task_plan_log();
+    task_start(TASK_UI, NULL);
 }
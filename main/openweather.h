@@ -12,6 +12,15 @@
 #define TIME_DATA_READY     BIT1
 #define WEATHER_DATA_READY  BIT2
 #define WIFI_READY  BIT3
+#define HISTORY_DATA_READY  BIT4
+#define CLOCK_TICK          BIT5
+#define NET_LINK_UP         BIT6    // level: set while Wi-Fi has an IP, never cleared by waiters
+#define SCHED_BENCH_EVENT   BIT7    // synthetic event of the scheduling benchmark
+
+// Core affinity: Wi-Fi and lwIP live on core 0, LVGL renders on core 1
+#define NET_TASK_CORE       0
+#define SENSOR_TASK_CORE    0
+#define UI_TASK_CORE        1
 
 extern EventGroupHandle_t data_events;
 extern SemaphoreHandle_t sensor_mutex;
@@ -29,7 +38,7 @@ typedef struct {
     float temperature;
     float feels_like;
     int humidity;
-    char condition[64];
+    char condition[96];
     float wind_speed;
     uint64_t updated_at;
 } weather_data_t;
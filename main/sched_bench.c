@@ -0,0 +1,255 @@
+/* Scheduling latency benchmark.
+ *
+ * A task on the network core posts SCHED_BENCH_EVENT at random gaps and
+ * stamps it; the UI task answers with a real update of the visible screen
+ * under the LVGL lock and stamps again. The difference is the event-to-UI
+ * delay: cross-core wakeup, preemption on the UI core and the wait for the
+ * lock while LVGL renders. The flush that follows is not included, the
+ * display profiler covers it.
+ *
+ * Each run goes through no load, network load, render load and both. The
+ * load tasks come from the task plan at the priority of the work they
+ * stand in for, so the numbers hold for the real tasks as planned.
+ */
+#include "sched_bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "diagnostics.h"
+#include "esp_log.h"
+#include "esp_lvgl_port.h"
+#include "esp_random.h"
+#include "esp_timer.h"
+#include "lwip/sockets.h"
+#include "openweather.h"
+#include "screen_manager.h"
+#include "st7789.h"
+#include "task_plan.h"
+
+static const char *TAG = "sched_bench";
+
+static const char *s_load_names[] = {
+    [SCHED_LOAD_NONE] = "none",
+    [SCHED_LOAD_NET] = "net",
+    [SCHED_LOAD_RENDER] = "render",
+    [SCHED_LOAD_BOTH] = "both",
+};
+
+static sched_bench_result_t s_results[SCHED_LOAD_COUNT];
+static SemaphoreHandle_t s_load_done = NULL;    // given by each load task on exit
+static SemaphoreHandle_t s_run_done = NULL;
+static TaskHandle_t s_bench = NULL;
+static volatile bool s_stop = false;
+static volatile bool s_running = false;
+static int64_t s_post_us = 0;
+static int64_t s_ui_us = 0;
+static volatile uint32_t s_post_seq = 0;
+static volatile uint32_t s_ui_seq = 0;     // the event the UI last answered
+static sched_bench_result_t *s_current = NULL;
+
+void sched_bench_on_ui(void)
+{
+    if (lvgl_port_lock(0)) {
+        screen_manager_update(SENSOR_DATA_READY);
+        lvgl_port_unlock();
+    }
+    s_ui_us = esp_timer_get_time();
+    s_ui_seq = s_post_seq;
+    if (s_bench) {
+        xTaskNotifyGive(s_bench);
+    }
+}
+
+void sched_bench_net_task(void *pvParameters)
+{
+    static uint8_t buf[SCHED_BENCH_UDP_BYTES];
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(SCHED_BENCH_UDP_PORT),
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+    int rx = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    int tx = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+
+    if (rx < 0 || tx < 0 || bind(rx, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        ESP_LOGE(TAG, "Loopback sockets failed, no network load");
+    } else {
+        for (uint32_t n = 1; !s_stop; n++) {
+            if (sendto(tx, buf, sizeof(buf), 0, (struct sockaddr *)&addr, sizeof(addr)) > 0) {
+                s_current->udp_packets++;
+            }
+            while (recv(rx, buf, sizeof(buf), MSG_DONTWAIT) > 0) {
+            }
+            // Keeps the idle task, and so the task watchdog, fed
+            if (n % 32 == 0) {
+                vTaskDelay(1);
+            }
+        }
+    }
+
+    if (rx >= 0) {
+        close(rx);
+    }
+    if (tx >= 0) {
+        close(tx);
+    }
+    xSemaphoreGive(s_load_done);
+    vTaskDelete(NULL);
+}
+
+void sched_bench_render_task(void *pvParameters)
+{
+    while (!s_stop) {
+        if (lvgl_port_lock(0)) {
+            lv_obj_invalidate(lv_screen_active());
+            lvgl_port_unlock();
+            s_current->redraws++;
+        }
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+    xSemaphoreGive(s_load_done);
+    vTaskDelete(NULL);
+}
+
+static void run_load(sched_load_t load, int samples)
+{
+    sched_bench_result_t *r = &s_results[load];
+    *r = (sched_bench_result_t){.min_us = UINT32_MAX};
+    s_current = r;
+    s_stop = false;
+
+    int loads = 0;
+    if (load == SCHED_LOAD_NET || load == SCHED_LOAD_BOTH) {
+        loads += task_start(TASK_BENCH_NET, NULL) != NULL;
+    }
+    if (load == SCHED_LOAD_RENDER || load == SCHED_LOAD_BOTH) {
+        loads += task_start(TASK_BENCH_RENDER, NULL) != NULL;
+    }
+    vTaskDelay(pdMS_TO_TICKS(200));     // let the load settle
+
+    for (int i = 0; i < samples; i++) {
+        uint32_t seq = ++s_post_seq;
+        s_post_us = esp_timer_get_time();
+        xEventGroupSetBits(data_events, SCHED_BENCH_EVENT);
+
+        // A late answer to a missed event must not count for this one
+        bool seen = false;
+        while (!seen && ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(SCHED_BENCH_TIMEOUT_MS))) {
+            seen = s_ui_seq == seq;
+        }
+        if (!seen) {
+            r->missed++;
+        } else {
+            uint32_t us = s_ui_us - s_post_us;
+            r->samples++;
+            r->total_us += us;
+            r->min_us = us < r->min_us ? us : r->min_us;
+            r->max_us = us > r->max_us ? us : r->max_us;
+            r->over_frame += us > SCHED_BENCH_FRAME_US;
+        }
+        vTaskDelay(pdMS_TO_TICKS(SCHED_BENCH_GAP_MS / 2 + esp_random() % SCHED_BENCH_GAP_MS));
+    }
+
+    s_stop = true;
+    for (int i = 0; i < loads; i++) {
+        xSemaphoreTake(s_load_done, portMAX_DELAY);
+    }
+    if (r->samples == 0) {
+        r->min_us = 0;
+    }
+}
+
+void sched_bench_task(void *pvParameters)
+{
+    int samples = (intptr_t)pvParameters;
+
+    s_bench = xTaskGetCurrentTaskHandle();
+    for (int i = 0; i < SCHED_LOAD_COUNT; i++) {
+        run_load(i, samples);
+    }
+    s_bench = NULL;
+    // Keep the redraws out of the field numbers
+    lcd_profiler_reset();
+
+    xSemaphoreGive(s_run_done);
+    vTaskDelete(NULL);
+}
+
+esp_err_t sched_bench_run(int samples)
+{
+    if (s_running) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    s_running = true;
+    if (task_start(TASK_BENCH, (void *)(intptr_t)samples) == NULL) {
+        s_running = false;
+        return ESP_ERR_NO_MEM;
+    }
+    xSemaphoreTake(s_run_done, portMAX_DELAY);
+    s_running = false;
+    return ESP_OK;
+}
+
+void sched_bench_get_result(sched_load_t load, sched_bench_result_t *result)
+{
+    *result = s_results[load];
+}
+
+static int sched_cmd(int argc, char **argv)
+{
+    int samples = argc > 1 ? atoi(argv[1]) : SCHED_BENCH_SAMPLES;
+    if (samples <= 0) {
+        printf("usage: sched [samples]\n");
+        return 1;
+    }
+
+    printf("Running %d events per load...\n", samples);
+    esp_err_t err = sched_bench_run(samples);
+    if (err != ESP_OK) {
+        printf("sched: %s\n", esp_err_to_name(err));
+        return 1;
+    }
+
+    printf("load    samples missed  min us  avg us  max us  >frame  udp pkts  redraws\n");
+    for (int i = 0; i < SCHED_LOAD_COUNT; i++) {
+        const sched_bench_result_t *r = &s_results[i];
+        printf("%-7s %7lu %6lu %7lu %7llu %7lu %7lu %9lu %8lu\n", s_load_names[i],
+               (unsigned long)r->samples, (unsigned long)r->missed, (unsigned long)r->min_us,
+               r->samples ? r->total_us / r->samples : 0, (unsigned long)r->max_us,
+               (unsigned long)r->over_frame, (unsigned long)r->udp_packets,
+               (unsigned long)r->redraws);
+    }
+    return 0;
+}
+
+static void sched_metrics(diag_writer_t *w)
+{
+    for (int i = 0; i < SCHED_LOAD_COUNT; i++) {
+        const sched_bench_result_t *r = &s_results[i];
+        if (r->samples == 0) {
+            continue;
+        }
+        diag_printf(w, "sched_latency_max_us{load=\"%s\"} %lu\n", s_load_names[i],
+                    (unsigned long)r->max_us);
+        diag_printf(w, "sched_latency_avg_us{load=\"%s\"} %llu\n", s_load_names[i],
+                    r->total_us / r->samples);
+        diag_printf(w, "sched_missed{load=\"%s\"} %lu\n", s_load_names[i],
+                    (unsigned long)r->missed);
+    }
+}
+
+esp_err_t sched_bench_init(void)
+{
+    s_load_done = xSemaphoreCreateCounting(2, 0);
+    s_run_done = xSemaphoreCreateBinary();
+    if (s_load_done == NULL || s_run_done == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    diagnostics_register_command("sched", "Event-to-UI latency under network and render load",
+                                 sched_cmd);
+    diagnostics_register_metrics("sched", sched_metrics);
+    return ESP_OK;
+}
@@ -0,0 +1,47 @@
+// sched_bench.h
+#ifndef SCHED_BENCH_H
+#define SCHED_BENCH_H
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+// Event-to-UI latency under load, run with the "sched [samples]" command
+#define SCHED_BENCH_SAMPLES     200
+#define SCHED_BENCH_GAP_MS      20      // mean gap between events, randomised
+#define SCHED_BENCH_TIMEOUT_MS  500     // an event not handled by then is missed
+#define SCHED_BENCH_FRAME_US    33000   // one LVGL refresh period
+#define SCHED_BENCH_UDP_PORT    47001
+#define SCHED_BENCH_UDP_BYTES   1024
+
+typedef enum {
+    SCHED_LOAD_NONE,
+    SCHED_LOAD_NET,         // UDP loopback flood through lwIP on the network core
+    SCHED_LOAD_RENDER,      // full-screen redraws on the UI core
+    SCHED_LOAD_BOTH,
+    SCHED_LOAD_COUNT,
+} sched_load_t;
+
+typedef struct {
+    uint32_t samples;
+    uint32_t missed;
+    uint32_t over_frame;    // slower than SCHED_BENCH_FRAME_US
+    uint32_t min_us;
+    uint32_t max_us;
+    uint64_t total_us;
+    uint32_t udp_packets;   // load actually generated
+    uint32_t redraws;
+} sched_bench_result_t;
+
+esp_err_t sched_bench_init(void);
+// Runs every load in turn, blocks until done
+esp_err_t sched_bench_run(int samples);
+void sched_bench_get_result(sched_load_t load, sched_bench_result_t *result);
+// Called by the UI task for SCHED_BENCH_EVENT
+void sched_bench_on_ui(void);
+
+void sched_bench_task(void *pvParameters);
+void sched_bench_net_task(void *pvParameters);
+void sched_bench_render_task(void *pvParameters);
+
+#endif // SCHED_BENCH_H
@@ -0,0 +1,87 @@
+#include "task_plan.h"
+
+#include "backlight.h"
+#include "buttons.h"
+#include "esp_log.h"
+#include "get_sensor_data.h"
+#include "get_time.h"
+#include "get_weather.h"
+#include "sched_bench.h"
+#include "st7789.h"
+#include "sysmon.h"
+#include "wifi_connect.h"
+
+static const char *TAG = "task_plan";
+
+// File-scope compound literals have static storage, one buffer per entry
+#define STATIC_TASK(_name, _fn, _stack, _prio, _core)                                   \
+    {                                                                                    \
+        .name = (_name), .fn = (_fn), .stack = (_stack), .priority = (_prio),            \
+        .core = (_core), .stack_buf = (StackType_t[(_stack) / sizeof(StackType_t)]){0}, \
+        .tcb = &(StaticTask_t){0},                                                       \
+    }
+
+#define DYNAMIC_TASK(_name, _fn, _stack, _prio, _core)                                  \
+    { .name = (_name), .fn = (_fn), .stack = (_stack), .priority = (_prio), .core = (_core) }
+
+static const task_desc_t s_tasks[TASK_COUNT] = {
+    [TASK_UI] = STATIC_TASK("ui_task", ui_task, 4096, 6, UI_TASK_CORE),
+    [TASK_INPUT] = STATIC_TASK("input_task", input_task, 4096, 7, UI_TASK_CORE),
+    [TASK_BACKLIGHT] = STATIC_TASK("backlight_task", backlight_schedule_task, 3072, 2, UI_TASK_CORE),
+    [TASK_SENSOR] = STATIC_TASK("sensor_task", sensor_task, 4096, 5, SENSOR_TASK_CORE),
+    [TASK_WIFI] = STATIC_TASK("wifi_connection_task", wifi_connection_task, 4096, 6, NET_TASK_CORE),
+    [TASK_TIME] = STATIC_TASK("time_task", time_task, 4096, 3, NET_TASK_CORE),
+    [TASK_WEATHER] = STATIC_TASK("weather_task", weather_task, 8192, 3, NET_TASK_CORE),
+    // Lowest, a late sample only stretches its period
+    [TASK_SYSMON] = STATIC_TASK("sysmon", sysmon_task, 3072, 1, NET_TASK_CORE),
+    // Events come from core 0 like the sensor's, the load runs at the
+    // priority of what it stands in for
+    [TASK_BENCH] = DYNAMIC_TASK("sched_bench", sched_bench_task, 3072, 5, SENSOR_TASK_CORE),
+    [TASK_BENCH_NET] = DYNAMIC_TASK("bench_net", sched_bench_net_task, 3072, 3, NET_TASK_CORE),
+    [TASK_BENCH_RENDER] = DYNAMIC_TASK("bench_render", sched_bench_render_task, 3072, 4,
+                                       UI_TASK_CORE),
+};
+
+static TaskHandle_t s_handles[TASK_COUNT];
+
+TaskHandle_t task_start(task_id_t id, void *arg)
+{
+    const task_desc_t *t = &s_tasks[id];
+
+    if (t->stack_buf == NULL) {
+        TaskHandle_t handle = NULL;
+        if (xTaskCreatePinnedToCore(t->fn, t->name, t->stack, arg, t->priority, &handle,
+                                    t->core) != pdPASS) {
+            ESP_LOGE(TAG, "Cannot start %s", t->name);
+            return NULL;
+        }
+        return handle;
+    }
+
+    // Static buffers cannot be reused safely, permanent tasks start once
+    if (s_handles[id] == NULL) {
+        s_handles[id] = xTaskCreateStaticPinnedToCore(t->fn, t->name, t->stack, arg, t->priority,
+                                                      t->stack_buf, t->tcb, t->core);
+    }
+    return s_handles[id];
+}
+
+const task_desc_t *task_desc(task_id_t id)
+{
+    return id < TASK_COUNT ? &s_tasks[id] : NULL;
+}
+
+void task_plan_log(void)
+{
+    uint32_t static_bytes = 0;
+    for (int i = 0; i < TASK_COUNT; i++) {
+        const task_desc_t *t = &s_tasks[i];
+        ESP_LOGI(TAG, "%-20s core %d prio %2u stack %5lu %s", t->name, (int)t->core,
+                 (unsigned)t->priority, (unsigned long)t->stack,
+                 t->stack_buf ? (s_handles[i] ? "static" : "static, idle") : "heap");
+        static_bytes += t->stack_buf ? t->stack : 0;
+    }
+    ESP_LOGI(TAG, "%-20s core %d prio %2u stack %5u", "lvgl", LVGL_RENDER_CORE,
+             TASK_LVGL_PRIORITY, TASK_LVGL_STACK);
+    ESP_LOGI(TAG, "Static stacks: %lu B", (unsigned long)static_bytes);
+}
@@ -0,0 +1,59 @@
+// task_plan.h
+#ifndef TASK_PLAN_H
+#define TASK_PLAN_H
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "openweather.h"
+
+/* Where every task runs. Core 0 belongs to the network: Wi-Fi (23),
+ * esp_timer (22) and lwIP (18, pinned in sdkconfig) sit above everything
+ * here, the application's network and sensor tasks below them. Core 1 is
+ * the UI: input preempts the data updates, which preempt LVGL rendering,
+ * so an event reaches the screen without waiting for a frame to finish
+ * (it still waits for the LVGL lock). The console floats at 2 and the boot
+ * stage tasks are short-lived, see components/boot.
+ *
+ * Permanent tasks get static stacks and TCBs, so they never fragment the
+ * heap and show up in the size map. Benchmark load tasks come and go and
+ * are allocated when started. The sizes and the core split are checked
+ * against the "sysmon" command: stack never used and CPU per period. */
+
+// Driver-owned, configured from these
+#define TASK_LVGL_PRIORITY  5
+#define TASK_LVGL_STACK     7168
+
+typedef enum {
+    TASK_UI,            // applies data events to the visible screen
+    TASK_INPUT,
+    TASK_BACKLIGHT,
+    TASK_SENSOR,
+    TASK_WIFI,
+    TASK_TIME,
+    TASK_WEATHER,
+    TASK_SYSMON,        // per-task CPU, stack and heap samples
+    TASK_BENCH,         // sched_bench: posts events, measures
+    TASK_BENCH_NET,     // sched_bench: UDP loopback flood
+    TASK_BENCH_RENDER,  // sched_bench: full-screen redraws
+    TASK_COUNT,
+} task_id_t;
+
+typedef struct {
+    const char *name;
+    TaskFunction_t fn;
+    uint32_t stack;             // bytes
+    UBaseType_t priority;
+    BaseType_t core;
+    StackType_t *stack_buf;     // NULL: allocated when started
+    StaticTask_t *tcb;
+} task_desc_t;
+
+// Starts a task as planned. A permanent task already running is returned
+// as is, NULL if it could not be created.
+TaskHandle_t task_start(task_id_t id, void *arg);
+const task_desc_t *task_desc(task_id_t id);
+void task_plan_log(void);
+
+void ui_task(void *pvParameters);
+
+#endif // TASK_PLAN_H
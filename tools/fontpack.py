@@ -0,0 +1,175 @@
+#!/usr/bin/env python3
+"""Builds the font pack flashed to the "fonts" partition.
+
+Each font is rasterised with Pillow into antialiased bitmaps of 1, 2, 4 or
+8 bits per pixel. The glyphs are indexed by code point, sorted, so the
+device finds them with a binary search straight in the memory-mapped
+partition. Layout (little endian, must match components/font_pack):
+
+    pack header   magic "OWFP", u16 version, u16 font count,
+                  u32 total size, u32 reserved
+    font entries  char[16] name, u32 offset, u32 glyph count,
+                  u16 line height, i16 base line, u8 bpp, u8[3] reserved
+    per font      glyph index of u32 code point, u32 bitmap offset (from
+                  the font offset), u16 advance, u8 box w, u8 box h,
+                  i8 offset x, i8 offset y, u16 reserved
+                  then the bitmaps, rows packed MSB first with no padding,
+                  each glyph starting on a byte
+
+Example, a 20 px Japanese font with JIS level 1 kanji for weatherapi's
+lang=ja condition texts:
+
+    tools/fontpack.py --font jp20,NotoSansJP-Regular.ttf,20 \\
+        --charset ascii,kana,jis1 -o fonts.bin
+
+If fonts.bin sits in the project root, "idf.py flash" writes it to the
+partition; otherwise use
+"parttool.py write_partition --partition-name fonts --input fonts.bin".
+"""
+
+import argparse
+import struct
+import sys
+
+from PIL import Image, ImageDraw, ImageFont
+
+MAGIC = b"OWFP"
+VERSION = 1
+PACK_HEADER = struct.Struct("<4sHHII")
+FONT_ENTRY = struct.Struct("<16sIIHhB3x")
+GLYPH_ENTRY = struct.Struct("<IIHBBbbH")
+
+
+def charset_ranges(name):
+    if name == "ascii":
+        return [chr(c) for c in range(0x20, 0x7F)]
+    if name == "kana":
+        # CJK punctuation, hiragana, katakana, full-width forms
+        return [chr(c) for r in ((0x3000, 0x3040), (0x3040, 0x30A0),
+                                 (0x30A0, 0x3100), (0xFF01, 0xFF5F))
+                for c in range(*r)]
+    if name == "jis1":
+        # JIS X 0208 level 1 kanji, rows 16-47
+        chars = []
+        for row in range(0xB0, 0xD0):
+            for cell in range(0xA1, 0xFF):
+                try:
+                    chars.append(bytes([row, cell]).decode("euc_jp"))
+                except UnicodeDecodeError:
+                    pass
+        return chars
+    raise SystemExit(f"unknown charset {name}")
+
+
+def pack_bits(pixels, bpp):
+    out = bytearray()
+    acc = 0
+    nbits = 0
+    shift = 8 - bpp
+    for p in pixels:
+        acc = (acc << bpp) | (p >> shift)
+        nbits += bpp
+        if nbits == 8:
+            out.append(acc)
+            acc = 0
+            nbits = 0
+    if nbits:
+        out.append(acc << (8 - nbits))
+    return bytes(out)
+
+
+def render_font(path, size, bpp, chars):
+    font = ImageFont.truetype(path, size)
+    ascent, descent = font.getmetrics()
+    glyphs = []
+
+    for ch in sorted(set(chars)):
+        # Boxes relative to the pen position on the baseline
+        x0, y0, x1, y1 = font.getbbox(ch, anchor="ls")
+        w, h = max(0, x1 - x0), max(0, y1 - y0)
+        if w > 255 or h > 255:
+            raise SystemExit(f"glyph U+{ord(ch):04X} too large")
+
+        bitmap = b""
+        if w and h:
+            img = Image.new("L", (w, h), 0)
+            ImageDraw.Draw(img).text((-x0, -y0), ch, font=font, fill=255,
+                                     anchor="ls")
+            bitmap = pack_bits(img.tobytes(), bpp)
+        glyphs.append({
+            "cp": ord(ch),
+            "adv": round(font.getlength(ch)),
+            "w": w,
+            "h": h,
+            "x": x0,
+            "y": -y1,  # LVGL: bottom of the box above the baseline
+            "bitmap": bitmap,
+        })
+
+    return {"line_height": ascent + descent, "base_line": descent,
+            "glyphs": glyphs}
+
+
+def build_font_blob(font):
+    glyphs = font["glyphs"]
+    index = bytearray()
+    bitmaps = bytearray()
+    base = len(glyphs) * GLYPH_ENTRY.size
+
+    for g in glyphs:
+        index += GLYPH_ENTRY.pack(g["cp"], base + len(bitmaps), g["adv"],
+                                  g["w"], g["h"], g["x"], g["y"], 0)
+        bitmaps += g["bitmap"]
+    return bytes(index + bitmaps)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    parser.add_argument("--font", action="append", required=True,
+                        metavar="NAME,TTF,SIZE",
+                        help="font to add, may be repeated")
+    parser.add_argument("--bpp", type=int, default=2, choices=(1, 2, 4, 8))
+    parser.add_argument("--charset", default="ascii,kana,jis1",
+                        help="comma separated: ascii, kana, jis1")
+    parser.add_argument("--text", action="append", default=[],
+                        help="file whose characters are added too")
+    parser.add_argument("-o", "--output", required=True)
+    args = parser.parse_args()
+
+    chars = []
+    for name in args.charset.split(","):
+        if name:
+            chars += charset_ranges(name)
+    for path in args.text:
+        with open(path, encoding="utf-8") as f:
+            chars += [c for c in f.read() if c.isprintable()]
+
+    specs = [spec.split(",") for spec in args.font]
+    offset = PACK_HEADER.size + len(specs) * FONT_ENTRY.size
+    entries = bytearray()
+    blobs = bytearray()
+
+    for name, path, size in specs:
+        if len(name.encode()) >= 16:
+            raise SystemExit(f"font name {name} too long")
+        font = render_font(path, int(size), args.bpp, chars)
+        blob = build_font_blob(font)
+        # Word aligned, the device reads the index in place
+        blobs += b"\0" * (-(offset + len(blobs)) % 4)
+        entries += FONT_ENTRY.pack(name.encode(), offset + len(blobs),
+                                   len(font["glyphs"]), font["line_height"],
+                                   font["base_line"], args.bpp)
+        blobs += blob
+        print(f"{name}: {len(font['glyphs'])} glyphs, {len(blob)} bytes",
+              file=sys.stderr)
+
+    total = offset + len(blobs)
+    with open(args.output, "wb") as f:
+        f.write(PACK_HEADER.pack(MAGIC, VERSION, len(specs), total, 0))
+        f.write(entries)
+        f.write(blobs)
+    print(f"{args.output}: {total} bytes", file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,189 @@
+#include "host_png.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define STORED_BLOCK_MAX 65535
+
+static const uint8_t png_signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+
+static uint32_t crc32_update(uint32_t crc, const uint8_t *data, size_t len)
+{
+    crc = ~crc;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= data[i];
+        for (int k = 0; k < 8; k++) {
+            crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1)));
+        }
+    }
+    return ~crc;
+}
+
+static void put_be32(uint8_t *p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static uint32_t get_be32(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static void write_chunk(FILE *f, const char *type, const uint8_t *data, uint32_t len)
+{
+    uint8_t hdr[8];
+    put_be32(hdr, len);
+    memcpy(hdr + 4, type, 4);
+    fwrite(hdr, 1, 8, f);
+    if (len) {
+        fwrite(data, 1, len, f);
+    }
+
+    uint32_t crc = crc32_update(0, (const uint8_t *)type, 4);
+    crc = crc32_update(crc, data, len);
+    uint8_t crc_be[4];
+    put_be32(crc_be, crc);
+    fwrite(crc_be, 1, 4, f);
+}
+
+int png_write_rgb(const char *path, const uint8_t *rgb, int width, int height)
+{
+    size_t row = (size_t)width * 3 + 1;
+    size_t raw_len = row * height;
+    size_t blocks = (raw_len + STORED_BLOCK_MAX - 1) / STORED_BLOCK_MAX;
+    size_t z_len = 2 + blocks * 5 + raw_len + 4;
+
+    uint8_t *z = malloc(z_len);
+    if (z == NULL) {
+        return -1;
+    }
+
+    uint8_t *p = z;
+    *p++ = 0x78;  // zlib: deflate, 32K window
+    *p++ = 0x01;  // no preset dictionary, fastest
+
+    uint32_t a = 1, b = 0;  // adler32
+    size_t remaining = raw_len;
+    size_t pos = 0;
+    while (remaining) {
+        uint16_t n = remaining > STORED_BLOCK_MAX ? STORED_BLOCK_MAX : remaining;
+        remaining -= n;
+        *p++ = remaining ? 0 : 1;
+        *p++ = n & 0xff;
+        *p++ = n >> 8;
+        *p++ = ~n & 0xff;
+        *p++ = (~n >> 8) & 0xff;
+        for (uint16_t i = 0; i < n; i++, pos++) {
+            size_t x = pos % row;
+            uint8_t v = x == 0 ? 0 : rgb[(pos / row) * width * 3 + x - 1];
+            *p++ = v;
+            a = (a + v) % 65521;
+            b = (b + a) % 65521;
+        }
+    }
+    put_be32(p, (b << 16) | a);
+    p += 4;
+
+    FILE *f = fopen(path, "wb");
+    if (f == NULL) {
+        free(z);
+        return -1;
+    }
+
+    uint8_t ihdr[13];
+    put_be32(ihdr, width);
+    put_be32(ihdr + 4, height);
+    ihdr[8] = 8;   // bit depth
+    ihdr[9] = 2;   // truecolour
+    ihdr[10] = 0;  // deflate
+    ihdr[11] = 0;  // adaptive filtering (all rows use filter 0)
+    ihdr[12] = 0;  // no interlace
+
+    fwrite(png_signature, 1, sizeof(png_signature), f);
+    write_chunk(f, "IHDR", ihdr, sizeof(ihdr));
+    write_chunk(f, "IDAT", z, (uint32_t)(p - z));
+    write_chunk(f, "IEND", NULL, 0);
+
+    int ret = ferror(f) ? -1 : 0;
+    fclose(f);
+    free(z);
+    return ret;
+}
+
+int png_read_rgb(const char *path, uint8_t *rgb, int width, int height)
+{
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        return -1;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    uint8_t *file = malloc(size);
+    uint8_t *z = malloc(size);
+    int ret = -1;
+    if (file == NULL || z == NULL || fread(file, 1, size, f) != (size_t)size) {
+        goto out;
+    }
+    if (size < 8 || memcmp(file, png_signature, 8) != 0) {
+        goto out;
+    }
+
+    // Collect IDAT payloads
+    size_t z_len = 0;
+    long pos = 8;
+    while (pos + 12 <= size) {
+        uint32_t len = get_be32(file + pos);
+        const uint8_t *type = file + pos + 4;
+        const uint8_t *data = file + pos + 8;
+        if (pos + 12 + (long)len > size) {
+            goto out;
+        }
+        if (memcmp(type, "IHDR", 4) == 0) {
+            if (get_be32(data) != (uint32_t)width || get_be32(data + 4) != (uint32_t)height ||
+                data[8] != 8 || data[9] != 2) {
+                goto out;
+            }
+        } else if (memcmp(type, "IDAT", 4) == 0) {
+            memcpy(z + z_len, data, len);
+            z_len += len;
+        }
+        pos += 12 + len;
+    }
+
+    // Inflate stored blocks, drop the per-row filter byte
+    size_t row = (size_t)width * 3 + 1;
+    size_t out_pos = 0;
+    size_t zp = 2;
+    int final = 0;
+    while (!final && zp + 5 <= z_len) {
+        final = z[zp] & 1;
+        if ((z[zp] >> 1) & 3) {
+            goto out;  // compressed block, not written by png_write_rgb()
+        }
+        uint16_t n = z[zp + 1] | (z[zp + 2] << 8);
+        zp += 5;
+        for (uint16_t i = 0; i < n && zp < z_len; i++, zp++, out_pos++) {
+            size_t x = out_pos % row;
+            if (x == 0) {
+                if (z[zp] != 0) {
+                    goto out;
+                }
+            } else if (out_pos / row < (size_t)height) {
+                rgb[(out_pos / row) * width * 3 + x - 1] = z[zp];
+            }
+        }
+    }
+    ret = out_pos == row * height ? 0 : -1;
+
+out:
+    fclose(f);
+    free(file);
+    free(z);
+    return ret;
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <stdint.h>
+
+/* Minimal PNG I/O for golden images: 8-bit RGB, no filtering, stored
+ * (uncompressed) deflate blocks. The reader only accepts files written by
+ * png_write_rgb(), which is all the golden directory contains. */
+int png_write_rgb(const char *path, const uint8_t *rgb, int width, int height);
+int png_read_rgb(const char *path, uint8_t *rgb, int width, int height);
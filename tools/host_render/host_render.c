@@ -0,0 +1,407 @@
+/* Headless renderer for the UI screens.
+ *
+ * Builds every registered screen through the real screen manager and
+ * layout tables, renders it into a memory framebuffer using the same band
+ * height as the device, writes PNGs and reports per-frame render time,
+ * flush count, invalidated area and LVGL draw tasks. With --golden the
+ * frames are compared against reference PNGs and the exit code is non-zero
+ * on any pixel difference. Finally the seven-segment readouts are compared
+ * with the bitmap fonts they replaced.
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "host_png.h"
+#include "lvgl.h"
+#include "openweather.h"
+#include "screen_manager.h"
+#include "sensor_history.h"
+#include "st7789.h"
+#include "ui_segment.h"
+
+LV_FONT_DECLARE(jb_mono_bold_48);
+LV_FONT_DECLARE(jb_mono_bold_64);
+
+typedef struct {
+    double render_ms;
+    uint32_t flushes;
+    uint32_t flushed_px;
+    uint32_t inval_areas;
+    uint32_t inval_px;
+    uint32_t draw_tasks;
+} frame_stats_t;
+
+static uint16_t framebuffer[LCD_H_RES * LCD_V_RES];
+static uint8_t draw_buf[LCD_H_RES * LVGL_BUFFER_HEIGHT * sizeof(uint16_t)]
+    __attribute__((aligned(64)));
+static lv_display_t *disp = NULL;
+static frame_stats_t frame;
+
+static double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static uint32_t tick_cb(void)
+{
+    return (uint32_t)now_ms();
+}
+
+static void flush_cb(lv_display_t *d, const lv_area_t *area, uint8_t *px_map)
+{
+    int32_t w = lv_area_get_width(area);
+    const uint16_t *src = (const uint16_t *)px_map;
+
+    for (int32_t y = area->y1; y <= area->y2; y++) {
+        memcpy(&framebuffer[y * LCD_H_RES + area->x1], src, w * sizeof(uint16_t));
+        src += w;
+    }
+
+    frame.flushes++;
+    frame.flushed_px += lv_area_get_size(area);
+    lv_display_flush_ready(d);
+}
+
+static void invalidate_cb(lv_event_t *e)
+{
+    const lv_area_t *area = lv_event_get_param(e);
+    frame.inval_areas++;
+    frame.inval_px += lv_area_get_size(area);
+}
+
+static void draw_task_cb(lv_event_t *e)
+{
+    frame.draw_tasks++;
+}
+
+static lv_obj_tree_walk_res_t count_draw_tasks(lv_obj_t *obj, void *user_data)
+{
+    if (!lv_obj_has_flag(obj, LV_OBJ_FLAG_SEND_DRAW_TASK_EVENTS)) {
+        lv_obj_add_flag(obj, LV_OBJ_FLAG_SEND_DRAW_TASK_EVENTS);
+        lv_obj_add_event_cb(obj, draw_task_cb, LV_EVENT_DRAW_TASK_ADDED, NULL);
+    }
+    return LV_OBJ_TREE_WALK_NEXT;
+}
+
+// Replaces the ST7789 driver: LVGL renders into the memory framebuffer
+void init_lcd(int rotation)
+{
+    lv_init();
+    lv_tick_set_cb(tick_cb);
+
+    disp = lv_display_create(LCD_H_RES, LCD_V_RES);
+    lv_display_set_color_format(disp, LV_COLOR_FORMAT_RGB565);
+    lv_display_set_flush_cb(disp, flush_cb);
+    lv_display_set_buffers(disp, draw_buf, NULL, sizeof(draw_buf),
+                           LV_DISPLAY_RENDER_MODE_PARTIAL);
+    lv_display_add_event_cb(disp, invalidate_cb, LV_EVENT_INVALIDATE_AREA, NULL);
+    lv_display_set_rotation(disp, rotation);
+}
+
+static void load_fixture(int variant)
+{
+    g_sensor_data = (sensor_data_t){
+        .co2_ppm = variant ? 1240 : 612,
+        .temperature = variant ? 24.8f : 22.5f,
+        .humidity = variant ? 38.0f : 45.5f,
+        .timestamp = 1,
+    };
+
+    g_time_data.current_time = variant ? 1736905380 : 1736905320;
+    g_time_data.timeinfo = (struct tm){
+        .tm_year = 125, .tm_mon = 0, .tm_mday = 15,
+        .tm_hour = 10, .tm_min = variant ? 43 : 42,
+    };
+    g_time_data.synced = true;
+
+    g_weather_data = (weather_data_t){
+        .temperature = variant ? 9.0f : 8.0f,
+        .feels_like = variant ? 6.5f : 5.5f,
+        .humidity = variant ? 61 : 58,
+        .wind_speed = variant ? 14.4f : 11.2f,
+        .updated_at = 1,
+    };
+    strcpy(g_weather_data.condition, variant ? "Light rain" : "Partly cloudy");
+}
+
+#define HISTORY_STEP_MS 5000ULL
+
+static uint64_t history_ms = 0;
+
+// Synthetic daily cycle sampled every 5 s like the SCD41
+static void add_history_samples(int count)
+{
+    for (int i = 0; i < count; i++, history_ms += HISTORY_STEP_MS) {
+        double day = (double)(history_ms % (24ULL * 3600 * 1000)) / (24.0 * 3600 * 1000);
+        sensor_data_t sample = {
+            .co2_ppm = 600 + (uint16_t)(500 * day) + (history_ms / HISTORY_STEP_MS) % 37,
+            .temperature = 19.0f + 6.0f * (float)day,
+            .humidity = 55.0f - 15.0f * (float)day,
+            .timestamp = history_ms,
+        };
+        sensor_history_add(&sample);
+    }
+}
+
+static void render(frame_stats_t *out)
+{
+    lv_obj_tree_walk(lv_screen_active(), count_draw_tasks, NULL);
+
+    double t0 = now_ms();
+    lv_refr_now(disp);
+    frame.render_ms = now_ms() - t0;
+    *out = frame;
+    memset(&frame, 0, sizeof(frame));
+}
+
+static void framebuffer_to_rgb(uint8_t *rgb)
+{
+    for (int i = 0; i < LCD_H_RES * LCD_V_RES; i++) {
+        uint16_t p = framebuffer[i];
+        rgb[i * 3 + 0] = ((p >> 11) & 0x1f) * 255 / 31;
+        rgb[i * 3 + 1] = ((p >> 5) & 0x3f) * 255 / 63;
+        rgb[i * 3 + 2] = (p & 0x1f) * 255 / 31;
+    }
+}
+
+// Returns the number of differing pixels, -1 if the golden is missing
+static int compare_golden(const char *dir, const char *name, const uint8_t *rgb,
+                          const char *out_dir)
+{
+    static uint8_t golden[LCD_H_RES * LCD_V_RES * 3];
+    static uint8_t diff[LCD_H_RES * LCD_V_RES * 3];
+    char path[512];
+
+    snprintf(path, sizeof(path), "%s/%s.png", dir, name);
+    if (png_read_rgb(path, golden, LCD_H_RES, LCD_V_RES) != 0) {
+        return -1;
+    }
+
+    int mismatches = 0;
+    for (int i = 0; i < LCD_H_RES * LCD_V_RES; i++) {
+        bool same = memcmp(&rgb[i * 3], &golden[i * 3], 3) == 0;
+        mismatches += !same;
+        // Differences in red over a dimmed copy of the golden
+        diff[i * 3 + 0] = same ? golden[i * 3 + 0] / 4 : 255;
+        diff[i * 3 + 1] = same ? golden[i * 3 + 1] / 4 : 0;
+        diff[i * 3 + 2] = same ? golden[i * 3 + 2] / 4 : 0;
+    }
+
+    if (mismatches) {
+        snprintf(path, sizeof(path), "%s/%s.diff.png", out_dir, name);
+        png_write_rgb(path, diff, LCD_H_RES, LCD_V_RES);
+    }
+    return mismatches;
+}
+
+static void print_stats(const char *screen, const char *step, const frame_stats_t *s)
+{
+    printf("%-10s %-8s %9.3f %7lu %10lu %6lu %10lu %6lu\n", screen, step, s->render_ms,
+           (unsigned long)s->flushes, (unsigned long)s->flushed_px,
+           (unsigned long)s->inval_areas, (unsigned long)s->inval_px,
+           (unsigned long)s->draw_tasks);
+}
+
+// Full redraw and one-digit change of a bitmap font label against the
+// seven-segment readout that replaced it
+static void compare_readouts(int iterations)
+{
+    static const struct {
+        const lv_font_t *font;
+        const char *font_name;
+        int32_t height;
+        const char *text;
+        const char *next;
+    } cases[] = {
+        {&jb_mono_bold_64, "bold_64", 56, "12:34", "12:35"},
+        {&jb_mono_bold_48, "bold_48", 40, "1240", "1241"},
+    };
+
+    lv_obj_t *screen = lv_obj_create(NULL);
+    lv_obj_set_style_bg_color(screen, lv_color_black(), 0);
+    lv_screen_load(screen);
+    render(&(frame_stats_t){0});
+
+    printf("\n%-10s %-8s %9s %10s %10s\n", "readout", "text", "redraw_ms", "change_px",
+           "glyph_B");
+
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        lv_obj_t *label = lv_label_create(screen);
+        lv_obj_set_style_text_font(label, cases[i].font, 0);
+        lv_obj_set_style_text_color(label, lv_color_white(), 0);
+        lv_obj_t *seg = ui_segment_create(screen, cases[i].height);
+        lv_obj_set_style_text_color(seg, lv_color_white(), 0);
+
+        lv_obj_t *objs[2] = {label, seg};
+        const char *names[2] = {cases[i].font_name, "segment"};
+        for (int k = 0; k < 2; k++) {
+            lv_obj_t *obj = objs[k];
+            lv_obj_add_flag(objs[!k], LV_OBJ_FLAG_HIDDEN);
+            lv_obj_remove_flag(obj, LV_OBJ_FLAG_HIDDEN);
+            if (k == 0) {
+                lv_label_set_text(obj, cases[i].text);
+            } else {
+                ui_segment_set_text(obj, cases[i].text);
+            }
+
+            frame_stats_t stats;
+            double sum = 0;
+            for (int n = 0; n < iterations; n++) {
+                lv_obj_invalidate(obj);
+                render(&stats);
+                sum += stats.render_ms;
+            }
+
+            if (k == 0) {
+                lv_label_set_text(obj, cases[i].next);
+            } else {
+                ui_segment_set_text(obj, cases[i].next);
+            }
+            render(&stats);
+
+            // Bitmap bytes of the glyphs shown, the geometry needs none
+            uint32_t glyph_bytes = 0;
+            if (k == 0) {
+                for (const char *c = cases[i].text; *c; c++) {
+                    lv_font_glyph_dsc_t g;
+                    if (lv_font_get_glyph_dsc(cases[i].font, &g, *c, 0)) {
+                        glyph_bytes += (g.box_w * g.box_h + 7) / 8;
+                    }
+                }
+            }
+
+            printf("%-10s %-8s %9.3f %10lu %10lu\n", names[k], cases[i].text,
+                   iterations > 0 ? sum / iterations : 0.0,
+                   (unsigned long)stats.flushed_px, (unsigned long)glyph_bytes);
+        }
+
+        lv_obj_delete(label);
+        lv_obj_delete(seg);
+    }
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [--out DIR] [--golden DIR] [--update-golden] [--iterations N]\n",
+            prog);
+}
+
+int main(int argc, char **argv)
+{
+    const char *out_dir = ".";
+    const char *golden_dir = NULL;
+    bool update_golden = false;
+    int iterations = 20;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+            out_dir = argv[++i];
+        } else if (strcmp(argv[i], "--golden") == 0 && i + 1 < argc) {
+            golden_dir = argv[++i];
+        } else if (strcmp(argv[i], "--update-golden") == 0) {
+            update_golden = true;
+        } else if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc) {
+            iterations = atoi(argv[++i]);
+        } else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (update_golden && golden_dir == NULL) {
+        usage(argv[0]);
+        return 2;
+    }
+    if (mkdir(out_dir, 0755) != 0 && errno != EEXIST) {
+        perror(out_dir);
+        return 2;
+    }
+
+    load_fixture(0);
+    // A full week, so every history window is populated
+    add_history_samples(7 * 24 * 3600 * 1000ULL / HISTORY_STEP_MS);
+    init_start_screen();
+
+    screen_stats_t screens[SCREEN_MANAGER_MAX_SCREENS];
+    int count = screen_manager_get_stats(screens, SCREEN_MANAGER_MAX_SCREENS);
+    static uint8_t rgb[LCD_H_RES * LCD_V_RES * 3];
+    int failures = 0;
+
+    printf("%-10s %-8s %9s %7s %10s %6s %10s %6s\n", "screen", "step", "render_ms",
+           "flushes", "flushed_px", "inval", "inval_px", "draws");
+
+    for (int id = 0; id < count; id++) {
+        const char *name = screens[id].name;
+        frame_stats_t stats;
+        char path[512];
+
+        // Live system figures, nothing stable to compare
+        if (strcmp(name, "diag") == 0) {
+            continue;
+        }
+
+        // Full frame with the first fixture
+        load_fixture(0);
+        screen_manager_show(id);
+        render(&stats);
+        print_stats(name, "show", &stats);
+
+        framebuffer_to_rgb(rgb);
+        snprintf(path, sizeof(path), "%s/%s.png", out_dir, name);
+        png_write_rgb(path, rgb, LCD_H_RES, LCD_V_RES);
+
+        if (update_golden) {
+            snprintf(path, sizeof(path), "%s/%s.png", golden_dir, name);
+            png_write_rgb(path, rgb, LCD_H_RES, LCD_V_RES);
+        } else if (golden_dir) {
+            int diff = compare_golden(golden_dir, name, rgb, out_dir);
+            if (diff != 0) {
+                failures++;
+                if (diff < 0) {
+                    printf("%-10s golden missing\n", name);
+                } else {
+                    printf("%-10s %d pixels differ from golden\n", name, diff);
+                }
+            }
+        }
+
+        // Full-screen redraw benchmark
+        double min = 1e9, max = 0, sum = 0;
+        for (int i = 0; i < iterations; i++) {
+            lv_obj_invalidate(lv_screen_active());
+            render(&stats);
+            min = stats.render_ms < min ? stats.render_ms : min;
+            max = stats.render_ms > max ? stats.render_ms : max;
+            sum += stats.render_ms;
+        }
+        if (iterations > 0) {
+            printf("%-10s %-8s min %.3f avg %.3f max %.3f ms over %d frames\n", name,
+                   "redraw", min, sum / iterations, max, iterations);
+        }
+
+        // Incremental frame after a data change, 30 s of samples complete
+        // at least one more 1h history point
+        load_fixture(1);
+        add_history_samples(6);
+        screen_manager_update(SENSOR_DATA_READY | TIME_DATA_READY | WEATHER_DATA_READY |
+                              HISTORY_DATA_READY);
+        render(&stats);
+        print_stats(name, "update", &stats);
+
+        // One seconds tick, should only touch the seconds digits
+        g_time_data.timeinfo.tm_sec = (g_time_data.timeinfo.tm_sec + 1) % 60;
+        screen_manager_update(CLOCK_TICK);
+        render(&stats);
+        print_stats(name, "tick", &stats);
+    }
+
+    compare_readouts(iterations);
+
+    return failures ? 1 : 0;
+}
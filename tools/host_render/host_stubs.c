@@ -0,0 +1,100 @@
+/* Host replacements for the device-only modules the screen code links to */
+#include "boot.h"
+#include "font_pack.h"
+#include "lvgl.h"
+#include "lvgl_mem.h"
+#include "openweather.h"
+#include "st7789.h"
+#include "sysmon.h"
+
+EventGroupHandle_t data_events;
+SemaphoreHandle_t sensor_mutex;
+SemaphoreHandle_t time_mutex;
+SemaphoreHandle_t weather_mutex;
+
+sensor_data_t g_sensor_data = {0};
+time_data_t g_time_data = {0};
+weather_data_t g_weather_data = {0};
+
+/* lvgl_mem: the host uses LVGL's builtin allocator, owners are not tracked */
+
+static int s_owner_count = 1;
+static int s_current_owner = LVGL_MEM_OWNER_CORE;
+
+int lvgl_mem_register_owner(const char *name)
+{
+    (void)name;
+    return s_owner_count < LVGL_MEM_MAX_OWNERS ? s_owner_count++ : LVGL_MEM_OWNER_CORE;
+}
+
+int lvgl_mem_set_owner(int owner)
+{
+    int prev = s_current_owner;
+    s_current_owner = owner;
+    return prev;
+}
+
+size_t lvgl_mem_owner_bytes(int owner)
+{
+    (void)owner;
+    return 0;
+}
+
+void lvgl_mem_get_stats(lvgl_mem_stats_t *stats)
+{
+    lv_mem_monitor_t mon;
+    lv_mem_monitor(&mon);
+    *stats = (lvgl_mem_stats_t){
+        .pool_bytes = mon.total_size,
+        .used_bytes = mon.total_size - mon.free_size,
+        .peak_bytes = mon.max_used,
+        .free_bytes = mon.free_size,
+        .largest_free = mon.free_biggest_size,
+        .frag_pct = mon.frag_pct,
+    };
+}
+
+void lvgl_mem_log_stats(void)
+{
+    lv_mem_monitor_t mon;
+    lv_mem_monitor(&mon);
+    fprintf(stderr, "I (lvgl_mem) %u/%u B used, peak %u B, frag %u%%\n",
+            (unsigned)(mon.total_size - mon.free_size), (unsigned)mon.total_size,
+            (unsigned)mon.max_used, (unsigned)mon.frag_pct);
+}
+
+/* st7789: no panel, the low-power modes have nothing to switch */
+
+void lcd_mode_set_caps(bool idle_ok, int content_y1, int content_y2)
+{
+}
+
+void lcd_profiler_get_stats(lcd_profile_stats_t *stats)
+{
+    *stats = (lcd_profile_stats_t){0};
+}
+
+/* boot: no stages on the host, the timeline is not kept */
+
+void boot_mark(const char *name)
+{
+    (void)name;
+}
+
+/* sysmon: no tasks to sample, the diag screen keeps its placeholders */
+
+bool sysmon_get_sample(int age, sysmon_sample_t *sample)
+{
+    (void)age;
+    (void)sample;
+    return false;
+}
+
+/* font_pack: no partition, screens keep their compiled-in fonts */
+
+const lv_font_t *font_pack_get(const char *name, const lv_font_t *fallback)
+{
+    (void)name;
+    (void)fallback;
+    return NULL;
+}
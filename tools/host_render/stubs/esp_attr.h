@@ -0,0 +1,4 @@
+/* Host stub: no RTC memory, the retained state is plain data */
+#pragma once
+
+#define RTC_DATA_ATTR
@@ -0,0 +1,30 @@
+/* Host stub: every data source reports ready immediately */
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+
+typedef void *EventGroupHandle_t;
+typedef uint32_t EventBits_t;
+
+static inline EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits,
+                                              BaseType_t clear, BaseType_t all,
+                                              TickType_t ticks)
+{
+    (void)group;
+    (void)clear;
+    (void)all;
+    (void)ticks;
+    return bits;
+}
+
+static inline EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits)
+{
+    (void)group;
+    return bits;
+}
+
+static inline EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits)
+{
+    (void)group;
+    return bits;
+}